@@ -1,8 +1,26 @@
+#include <algorithm>
 #include <cmath>
 #include <esp_log.h>
+#include <string.h>
 
 #include "mcp3008_driver.h"
 
+#if defined(__has_include)
+#if __has_include(<esp_idf_version.h>)
+#include <esp_idf_version.h>
+#endif
+#endif
+
+// spi_device_polling_transmit() and spi_device_acquire_bus() are not in older ESP-IDF versions.
+#if defined(ESP_IDF_VERSION_VAL)
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 0, 0)
+#define MCP3008_HAS_POLLING 1
+#endif
+#endif
+#ifndef MCP3008_HAS_POLLING
+#define MCP3008_HAS_POLLING 0
+#endif
+
 #define TAG "Mcp3008Driver"
 
 namespace mcp3008 {
@@ -11,7 +29,17 @@ Driver::Driver()
     : m_spi(NULL)
     , m_spi_dev(HSPI_HOST)
     , m_installed(false)
-    , m_channels_mask(0xFF) {
+    , m_polling(false)
+    , m_channels_mask(0xFF)
+    , m_frame_front(0)
+    , m_frame_seq(0)
+    , m_sampling(false)
+    , m_sampling_task(nullptr)
+    , m_sampling_timer(nullptr) {
+    for (int i = 0; i < 2; ++i) {
+        m_frames[i] = {};
+        m_frame_versions[i] = 0;
+    }
 }
 
 Driver::~Driver() {
@@ -49,6 +77,14 @@ esp_err_t Driver::install(const Driver::Config& cfg) {
 
     m_spi_dev = cfg.spi_dev;
     m_channels_mask = cfg.channels_mask;
+#if MCP3008_HAS_POLLING
+    m_polling = cfg.polling;
+#else
+    if (cfg.polling) {
+        ESP_LOGW(TAG, "Config::polling needs ESP-IDF 4.0 or newer, using the queued transactions.");
+    }
+    m_polling = false;
+#endif
     m_installed = true;
     return ESP_OK;
 }
@@ -57,7 +93,11 @@ esp_err_t Driver::uninstall() {
     if (!m_installed)
         return ESP_OK;
 
-    esp_err_t res = spi_bus_remove_device(m_spi);
+    esp_err_t res = stopSampling();
+    if (res != ESP_OK)
+        return res;
+
+    res = spi_bus_remove_device(m_spi);
     if (res != ESP_OK)
         return res;
 
@@ -85,13 +125,20 @@ int Driver::requestToChannel(int request) const {
     return 0;
 }
 
-esp_err_t Driver::read(std::vector<uint16_t>& results, bool differential) const {
-    int requested = 0;
-    for (int i = 0; i < CHANNELS; ++i) {
+int Driver::channelToRequest(int channel) const {
+    if (((1 << channel) & m_channels_mask) == 0)
+        return -1;
+
+    int request = 0;
+    for (int i = 0; i < channel; ++i) {
         if (((1 << i) & m_channels_mask) != 0)
-            ++requested;
+            ++request;
     }
+    return request;
+}
 
+esp_err_t Driver::read(std::vector<uint16_t>& results, bool differential) const {
+    const int requested = getChannelsCount();
     const size_t orig_size = results.size();
     results.resize(orig_size + requested);
 
@@ -107,6 +154,60 @@ esp_err_t Driver::read(uint16_t* dest, bool differential) const {
     if (!m_installed)
         return ESP_FAIL;
 
+    if (m_sampling.load()) {
+        Frame frame;
+        if (differential || !latestFrame(frame))
+            return ESP_FAIL;
+
+        memcpy(dest, frame.values, getChannelsCount() * sizeof(uint16_t));
+        return ESP_OK;
+    }
+
+    return readChip(dest, differential);
+}
+
+esp_err_t Driver::readChip(uint16_t* dest, bool differential) const {
+    if (m_polling)
+        return readChipPolling(dest, differential);
+    return readChipQueued(dest, differential);
+}
+
+esp_err_t Driver::readChipPolling(uint16_t* dest, bool differential) const {
+#if MCP3008_HAS_POLLING
+    // The chip starts a conversion on CS falling edge, so each channel still needs its own
+    // transaction. Hold the bus for all of them and busy-wait, a 3-byte transfer is only
+    // ~18us at the default clock, less than an interrupt and a context switch would take.
+    esp_err_t res = spi_device_acquire_bus(m_spi, portMAX_DELAY);
+    if (res != ESP_OK)
+        return res;
+
+    int requested = 0;
+    for (int i = 0; i < CHANNELS; ++i) {
+        if (((1 << i) & m_channels_mask) == 0)
+            continue;
+
+        spi_transaction_t t = {};
+        t.flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA;
+        t.length = 3 * 8;
+        t.tx_data[0] = 1;
+        t.tx_data[1] = (!differential << 7) | ((i & 0x07) << 4);
+
+        res = spi_device_polling_transmit(m_spi, &t);
+        if (res != ESP_OK)
+            break;
+
+        dest[requested++] = ((t.rx_data[1] & 0x03) << 8) | t.rx_data[2];
+    }
+
+    spi_device_release_bus(m_spi);
+    return res;
+#else
+    // Never set without polling support, see install().
+    return readChipQueued(dest, differential);
+#endif
+}
+
+esp_err_t Driver::readChipQueued(uint16_t* dest, bool differential) const {
     int requested = 0;
     spi_transaction_t transactions[CHANNELS] = { 0 };
     for (int i = 0; i < CHANNELS; ++i) {
@@ -149,13 +250,31 @@ uint16_t Driver::readChannel(uint8_t channel, bool differential, esp_err_t* resu
         return 0xFFFF;
     }
 
+    if (m_sampling.load()) {
+        Frame frame;
+        const int request = channelToRequest(channel);
+        if (differential || request < 0 || !latestFrame(frame)) {
+            if (result)
+                *result = ESP_FAIL;
+            return 0xFFFF;
+        }
+
+        if (result)
+            *result = ESP_OK;
+        return frame.values[request];
+    }
+
     spi_transaction_t trans = { 0 };
     trans.flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA;
     trans.length = 3 * 8;
     trans.tx_data[0] = 1;
     trans.tx_data[1] = (!differential << 7) | ((channel & 0x07) << 4);
 
+#if MCP3008_HAS_POLLING
+    esp_err_t res = m_polling ? spi_device_polling_transmit(m_spi, &trans) : spi_device_transmit(m_spi, &trans);
+#else
     esp_err_t res = spi_device_transmit(m_spi, &trans);
+#endif
     if (res != ESP_OK) {
         if (result)
             *result = res;
@@ -167,4 +286,138 @@ uint16_t Driver::readChannel(uint8_t channel, bool differential, esp_err_t* resu
     return ((trans.rx_data[1] & 0x03) << 8) | trans.rx_data[2];
 }
 
+esp_err_t Driver::startSampling(uint32_t rate_hz, UBaseType_t task_priority) {
+    if (!m_installed || m_sampling.load() || rate_hz == 0)
+        return ESP_FAIL;
+
+    for (int i = 0; i < 2; ++i) {
+        m_frames[i].seq = 0;
+        m_frame_versions[i] = 0;
+    }
+    m_frame_front = 0;
+    m_frame_seq = 0;
+    m_filter.reset();
+
+    // Take the first sample synchronously, so that the reads work right away.
+    uint16_t values[CHANNELS];
+    esp_err_t res = readChip(values, false);
+    if (res != ESP_OK)
+        return res;
+    m_filter.apply(values, getChannelsCount());
+    publishFrame(values);
+
+    TaskHandle_t task = nullptr;
+    if (xTaskCreate(&Driver::samplingTaskTrampoline, "mcp3008_sample", 2048, this, task_priority, &task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    m_sampling_task = task;
+
+    esp_timer_create_args_t args = {
+        .callback = samplingTimerCallback,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mcp3008_sample",
+    };
+    res = esp_timer_create(&args, &m_sampling_timer);
+    if (res == ESP_OK) {
+        m_sampling = true;
+        res = esp_timer_start_periodic(m_sampling_timer, std::max(uint32_t(1), 1000000 / rate_hz));
+    }
+
+    if (res != ESP_OK) {
+        stopSampling();
+        return res;
+    }
+    return ESP_OK;
+}
+
+esp_err_t Driver::stopSampling() {
+    if (m_sampling_timer != nullptr) {
+        esp_timer_stop(m_sampling_timer);
+        esp_timer_delete(m_sampling_timer);
+        m_sampling_timer = nullptr;
+    }
+
+    const TaskHandle_t task = m_sampling_task.load();
+    if (task != nullptr) {
+        m_sampling = false;
+        xTaskNotifyGive(task);
+        // The task clears m_sampling_task right before it deletes itself.
+        while (m_sampling_task.load() != nullptr) {
+            vTaskDelay(1);
+        }
+    }
+
+    m_sampling = false;
+    return ESP_OK;
+}
+
+esp_err_t Driver::setFilter(Filter::Type type, uint8_t strength) {
+    if (m_sampling.load())
+        return ESP_FAIL;
+    m_filter.configure(type, strength);
+    return ESP_OK;
+}
+
+bool Driver::latestFrame(Frame& dest) const {
+    while (true) {
+        const uint8_t idx = m_frame_front.load(std::memory_order_acquire);
+        const uint32_t version = m_frame_versions[idx].load(std::memory_order_acquire);
+        if ((version & 1) != 0)
+            continue;
+
+        dest = m_frames[idx];
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_frame_versions[idx].load(std::memory_order_relaxed) == version)
+            break;
+    }
+    return dest.seq != 0;
+}
+
+void Driver::samplingTimerCallback(void* cookie) {
+    auto* self = (Driver*)cookie;
+    xTaskNotifyGive(self->m_sampling_task.load());
+}
+
+void Driver::samplingTaskTrampoline(void* cookie) {
+    ((Driver*)cookie)->samplingTask();
+}
+
+void Driver::samplingTask() {
+    uint16_t values[CHANNELS];
+    const int count = getChannelsCount();
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!m_sampling.load())
+            break;
+
+        if (readChip(values, false) == ESP_OK) {
+            m_filter.apply(values, count);
+            publishFrame(values);
+            onSample(values);
+        }
+    }
+
+    m_sampling_task = nullptr;
+    vTaskDelete(nullptr);
+}
+
+void Driver::publishFrame(const uint16_t* values) {
+    const uint8_t back = !m_frame_front.load(std::memory_order_relaxed);
+    auto& version = m_frame_versions[back];
+    auto& frame = m_frames[back];
+
+    version.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(frame.values, values, sizeof(frame.values));
+    frame.timestamp_us = esp_timer_get_time();
+    frame.seq = ++m_frame_seq;
+
+    version.fetch_add(1, std::memory_order_release);
+    m_frame_front.store(back, std::memory_order_release);
+}
+
 }; // namespace mcp3008
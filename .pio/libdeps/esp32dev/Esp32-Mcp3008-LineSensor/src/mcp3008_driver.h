@@ -1,15 +1,23 @@
 #pragma once
 
+#include <atomic>
 #include <driver/spi_master.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <vector>
 
+#include "mcp3008_filter.h"
+
 namespace mcp3008 {
 
 /**
  * \brief The MCP3008 driver.
  *
  * This class is not thread-safe, you have to make sure the methods are called
- * from one thread at a time only.
+ * from one thread at a time only. The exception is the sampling mode, see startSampling():
+ * while it is active, the read methods only copy the latest sample and can be called
+ * from any task.
  * The install() method has to be called before you can use any other methods.
  */
 class Driver {
@@ -17,16 +25,29 @@ public:
     static constexpr int CHANNELS = 8; //!< Amount of channels on the chip
     static constexpr uint16_t MAX_VAL = 1023; //!< Maximum value returned by from the chip (10bits).
 
+    typedef ChannelFilter<CHANNELS> Filter;
+
+    /**
+     * \brief One set of values from all the enabled channels, captured by the sampling task.
+     */
+    struct Frame {
+        uint16_t values[CHANNELS]; //!< Same layout as the output of read(): only the enabled channels, packed.
+        int64_t timestamp_us; //!< esp_timer_get_time() when the values were read
+        uint32_t seq; //!< Incremented with each sample, starting at 1. 0 means no sample was taken yet.
+    };
+
     /**
      * \brief The Driver SPI configuration.
      */
     struct Config {
         Config(gpio_num_t pin_cs = GPIO_NUM_25, gpio_num_t pin_mosi = GPIO_NUM_33,
             gpio_num_t pin_miso = GPIO_NUM_32, gpio_num_t pin_sck = GPIO_NUM_26,
-            uint8_t channels_mask = 0xFF, int freq = 1350000, spi_host_device_t spi_dev = HSPI_HOST) {
+            uint8_t channels_mask = 0xFF, int freq = 1350000, spi_host_device_t spi_dev = HSPI_HOST,
+            bool polling = false) {
             this->freq = freq;
             this->spi_dev = spi_dev;
             this->channels_mask = channels_mask;
+            this->polling = polling;
 
             this->pin_cs = pin_cs;
             this->pin_mosi = pin_mosi;
@@ -38,6 +59,9 @@ public:
         spi_host_device_t spi_dev; //!< Which ESP32 SPI device to use.
         uint8_t channels_mask; //!< Which channels to use, bit mask:
             //!< (1 << 0) | (1 << 2) == channels 0 and 2 only.
+        bool polling; //!< Busy-wait for the SPI transactions without interrupts instead of blocking until they are done.
+            //!< Needs ESP-IDF 4.0 or newer, ignored on older versions. Not measured on hardware yet,
+            //!< see examples/benchmark.
 
         gpio_num_t pin_cs;
         gpio_num_t pin_mosi;
@@ -67,6 +91,7 @@ public:
     esp_err_t uninstall();
 
     uint8_t getChannelsMask() const { return m_channels_mask; } //!< Get the channel mask, specified in Config::channels_mask
+    uint8_t getChannelsCount() const { return __builtin_popcount(m_channels_mask); } //!< Get the amount of enabled channels
 
     /**
      * \brief Read values from the chip. Returns values in range <0; Driver::MAX_VAL>.
@@ -96,16 +121,94 @@ public:
      */
     uint16_t readChannel(uint8_t channel, bool differential = false, esp_err_t* result = nullptr) const;
 
+    /**
+     * \brief Start reading all the enabled channels in the background.
+     *
+     * A dedicated task reads the chip at \p rate_hz and stores the values into a double buffer.
+     * While sampling is active, read() and readChannel() (and the calibrated reads in LineSensor)
+     * do not touch the SPI bus at all and instead return the latest sample in constant time.
+     * Differential reads are not supported in this mode.
+     *
+     * \param rate_hz how many times per second to read the chip. Several kHz are possible
+     *        with the default SPI frequency.
+     * \param task_priority FreeRTOS priority of the sampling task.
+     * \return ESP_OK or any error code encountered during the initialization.
+     *         Will return ESP_FAIL if called when not installed or already sampling.
+     */
+    esp_err_t startSampling(uint32_t rate_hz = 2000, UBaseType_t task_priority = 10);
+
+    /**
+     * \brief Stop the background sampling started with startSampling().
+     *
+     * The read methods go back to reading the chip synchronously.
+     */
+    esp_err_t stopSampling();
+
+    bool isSampling() const { return m_sampling.load(); } //!< Returns true if the background sampling is active
+
+    /**
+     * \brief Set the filter applied to each channel by the sampling task, see startSampling().
+     *
+     * The filter runs at the sampling rate, on the raw values, so it has no effect when
+     * not sampling. It can only be changed while the sampling is stopped.
+     *
+     * \param type Filter::NONE (the default), Filter::IIR or Filter::MEDIAN
+     * \param strength for IIR, the smoothing factor is 1/2^strength (1-8),
+     *        for MEDIAN, the window size is 3 or 5 samples.
+     * \return ESP_FAIL if sampling is active, ESP_OK otherwise.
+     */
+    esp_err_t setFilter(Filter::Type type, uint8_t strength = 2);
+
+    /**
+     * \brief Copy the latest sample taken by the sampling task.
+     *
+     * Never blocks on the SPI bus, takes constant time.
+     *
+     * \param dest the latest frame is copied here.
+     * \return false if sampling is not active or no sample was taken yet.
+     */
+    bool latestFrame(Frame& dest) const;
+
 protected:
     int requestToChannel(int request) const;
+    int channelToRequest(int channel) const;
+
+    /**
+     * \brief Called from the sampling task with each new set of (filtered) values,
+     *        right after they were published. Must be quick and must not block.
+     */
+    virtual void onSample(const uint16_t* values) {}
 
 private:
     Driver(const Driver&) = delete;
 
+    esp_err_t readChip(uint16_t* dest, bool differential) const;
+    esp_err_t readChipQueued(uint16_t* dest, bool differential) const;
+    esp_err_t readChipPolling(uint16_t* dest, bool differential) const;
+
+    static void samplingTimerCallback(void* cookie);
+    static void samplingTaskTrampoline(void* cookie);
+    void samplingTask();
+    void publishFrame(const uint16_t* values);
+
     spi_device_handle_t m_spi;
     spi_host_device_t m_spi_dev;
     bool m_installed;
+    bool m_polling;
     uint8_t m_channels_mask;
+
+    // Single writer (the sampling task) double buffer, each slot guarded by a seqlock-style
+    // version, which is odd while the slot is being written.
+    Frame m_frames[2];
+    std::atomic<uint32_t> m_frame_versions[2];
+    std::atomic<uint8_t> m_frame_front;
+    uint32_t m_frame_seq;
+
+    Filter m_filter;
+
+    std::atomic<bool> m_sampling;
+    std::atomic<TaskHandle_t> m_sampling_task;
+    esp_timer_handle_t m_sampling_timer;
 };
 
 }; // namespace mcp3008
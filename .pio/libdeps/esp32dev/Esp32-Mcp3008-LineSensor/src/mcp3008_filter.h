@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace mcp3008 {
+
+/**
+ * \brief Per-channel filter for a stream of samples, used by Driver's sampling task.
+ *
+ * Integer-only and without allocations, for any uint16_t values.
+ * The same filter is applied to each channel independently.
+ */
+template <int CHANNELS>
+class ChannelFilter {
+public:
+    enum Type : uint8_t {
+        NONE, //!< Values are passed through unchanged
+        IIR, //!< Exponential moving average, y += (x - y) / 2^strength. strength 1-8.
+        MEDIAN, //!< Median of the last 3 (strength <= 3) or 5 (strength > 3) samples, removes spikes
+    };
+
+    static constexpr int MEDIAN_MAX = 5;
+
+    ChannelFilter()
+        : m_type(NONE)
+        , m_strength(0) {
+        reset();
+    }
+
+    void configure(Type type, uint8_t strength) {
+        m_type = type;
+        if (type == IIR) {
+            m_strength = strength < 1 ? 1 : (strength > 8 ? 8 : strength);
+        } else if (type == MEDIAN) {
+            m_strength = strength <= 3 ? 3 : MEDIAN_MAX;
+        } else {
+            m_strength = 0;
+        }
+        reset();
+    }
+
+    Type type() const { return m_type; }
+    uint8_t strength() const { return m_strength; }
+
+    void reset() {
+        m_count = 0;
+        m_hist_idx = 0;
+    }
+
+    /**
+     * \brief Feed one new set of values, they are replaced by the filtered ones.
+     */
+    void apply(uint16_t* values, int count) {
+        switch (m_type) {
+        case NONE:
+            return;
+        case IIR:
+            applyIir(values, count);
+            break;
+        case MEDIAN:
+            applyMedian(values, count);
+            break;
+        }
+        if (m_count < 0xFF)
+            ++m_count;
+    }
+
+private:
+    // With fewer bits, small steps up would stop moving the state before it reaches them:
+    // the truncated delta is 0 while x - y < 2^strength, but steps down would converge.
+    // 0xFFFF << 10 still fits into int32_t.
+    static constexpr int IIR_FRAC_BITS = 10;
+
+    void applyIir(uint16_t* values, int count) {
+        for (int i = 0; i < count; ++i) {
+            const int32_t x = int32_t(values[i]) << IIR_FRAC_BITS;
+            if (m_count == 0) {
+                m_iir[i] = x;
+            } else {
+                m_iir[i] += (x - m_iir[i] + (1 << (m_strength - 1))) >> m_strength;
+            }
+            values[i] = (m_iir[i] + (1 << (IIR_FRAC_BITS - 1))) >> IIR_FRAC_BITS;
+        }
+    }
+
+    void applyMedian(uint16_t* values, int count) {
+        if (m_count == 0) {
+            // Start with the window full of the first sample.
+            for (int s = 0; s < m_strength; ++s)
+                memcpy(m_hist[s], values, sizeof(uint16_t) * count);
+        } else {
+            memcpy(m_hist[m_hist_idx], values, sizeof(uint16_t) * count);
+        }
+        m_hist_idx = (m_hist_idx + 1) % m_strength;
+
+        for (int i = 0; i < count; ++i) {
+            uint16_t win[MEDIAN_MAX];
+            for (int s = 0; s < m_strength; ++s) {
+                const uint16_t v = m_hist[s][i];
+                int j = s;
+                for (; j > 0 && win[j - 1] > v; --j)
+                    win[j] = win[j - 1];
+                win[j] = v;
+            }
+            values[i] = win[m_strength / 2];
+        }
+    }
+
+    Type m_type;
+    uint8_t m_strength;
+    uint8_t m_count;
+    uint8_t m_hist_idx;
+
+    int32_t m_iir[CHANNELS];
+    uint16_t m_hist[MEDIAN_MAX][CHANNELS];
+};
+
+}; // namespace mcp3008
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+
+#include "mcp3008_linemath.h"
+
+namespace mcp3008 {
+
+// Same as Driver::MAX_VAL, this file must not depend on the driver.
+static constexpr uint16_t MAX_VAL = 1023;
+
+float LineMath::calculateLine(const uint16_t* vals, size_t vals_size, bool white_line, float line_threshold) {
+    static_assert(MAX_VAL == 0x3FF, "the white_line inversion below needs MAX_VAL to be all ones");
+
+    // MAX_VAL - val == val ^ MAX_VAL for all the values in range <0; MAX_VAL>
+    const uint16_t flip = white_line ? MAX_VAL : 0;
+    const uint16_t threshold = line_threshold * MAX_VAL;
+
+    uint16_t min = MAX_VAL;
+    uint16_t max = 0;
+    for (size_t i = 0; i < vals_size; ++i) {
+        const uint16_t val = vals[i] ^ flip;
+        if (val < min)
+            min = val;
+        if (val > max)
+            max = val;
+    }
+
+    const uint32_t range = max - min;
+    if (max < threshold || range < threshold || range == 0)
+        return nanf("");
+
+    // Stretch the values to <0; MAX_VAL> and compute the weighted average of the channel indexes,
+    // everything in integers. With 8 channels, weighted * MAX_VAL is at most ~29.3M, fits easily.
+    uint32_t weighted = 0;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < vals_size; ++i) {
+        const uint32_t val = uint32_t((vals[i] ^ flip) - min) * MAX_VAL / range;
+        weighted += val * i;
+        sum += val;
+    }
+
+    if (sum == 0)
+        return nanf("");
+
+    const int32_t middle = int32_t(vals_size - 1) * MAX_VAL / 2;
+    if (middle == 0)
+        return 0.f;
+
+    const int32_t result = int32_t(weighted * MAX_VAL / sum) - middle;
+    return std::min(1.f, std::max(-1.f, float(result) / float(middle)));
+}
+
+float LineMath::calculateLineParabolic(const uint16_t* vals, size_t vals_size, bool white_line, float line_threshold, float* confidence) {
+    const uint16_t flip = white_line ? MAX_VAL : 0;
+    const uint16_t threshold = line_threshold * MAX_VAL;
+
+    if (confidence)
+        *confidence = 0.f;
+
+    uint16_t min = MAX_VAL;
+    uint16_t max = 0;
+    size_t peak = 0;
+    for (size_t i = 0; i < vals_size; ++i) {
+        const uint16_t val = vals[i] ^ flip;
+        if (val < min)
+            min = val;
+        if (val > max) {
+            max = val;
+            peak = i;
+        }
+    }
+
+    const uint16_t range = max - min;
+    if (vals_size == 0 || max < threshold || range < threshold || range == 0)
+        return nanf("");
+
+    if (confidence)
+        *confidence = calculateLineConfidence(vals, vals_size, white_line);
+
+    const int32_t middle = int32_t(vals_size - 1) * MAX_VAL / 2;
+    if (middle == 0)
+        return 0.f;
+
+    // Vertex of the parabola through (peak-1, y0), (peak, y1), (peak+1, y2),
+    // as an offset from the peak in 1/MAX_VAL of the sensor spacing.
+    // A missing neighbour at the edge is taken as background.
+    const int32_t y0 = peak > 0 ? (vals[peak - 1] ^ flip) : min;
+    const int32_t y1 = max;
+    const int32_t y2 = peak + 1 < vals_size ? (vals[peak + 1] ^ flip) : min;
+    const int32_t denom = y0 - 2 * y1 + y2;
+    int32_t offset = 0;
+    if (denom != 0) {
+        offset = (y0 - y2) * int32_t(MAX_VAL) / (2 * denom);
+        offset = std::min(int32_t(MAX_VAL / 2), std::max(-int32_t(MAX_VAL / 2), offset));
+    }
+
+    const int32_t result = int32_t(peak) * MAX_VAL + offset - middle;
+    return std::min(1.f, std::max(-1.f, float(result) / float(middle)));
+}
+
+float LineMath::calculateLineConfidence(const uint16_t* vals, size_t vals_size, bool white_line) {
+    const uint16_t flip = white_line ? MAX_VAL : 0;
+
+    uint16_t min = MAX_VAL;
+    uint16_t max = 0;
+    size_t peak = 0;
+    for (size_t i = 0; i < vals_size; ++i) {
+        const uint16_t val = vals[i] ^ flip;
+        if (val < min)
+            min = val;
+        if (val > max) {
+            max = val;
+            peak = i;
+        }
+    }
+
+    const uint32_t range = max - min;
+    if (range == 0)
+        return 0.f;
+
+    // How much are the channels which are not next to the peak lit up, relative to the peak.
+    uint32_t stray = 0;
+    uint32_t stray_count = 0;
+    for (size_t i = 0; i < vals_size; ++i) {
+        if (i + 1 >= peak && i <= peak + 1)
+            continue;
+        stray += uint32_t((vals[i] ^ flip) - min) * MAX_VAL / range;
+        ++stray_count;
+    }
+
+    uint32_t conf = range;
+    if (stray_count != 0)
+        conf = conf * (MAX_VAL - stray / stray_count) / MAX_VAL;
+    return float(conf) / float(MAX_VAL);
+}
+
+float LineMath::estimateLine(LineEstimator estimator, const uint16_t* vals, size_t vals_size, bool white_line,
+    float line_threshold, float* confidence) {
+    if (estimator == ESTIMATOR_PARABOLIC)
+        return calculateLineParabolic(vals, vals_size, white_line, line_threshold, confidence);
+
+    const float line = calculateLine(vals, vals_size, white_line, line_threshold);
+    if (confidence)
+        *confidence = std::isnan(line) ? 0.f : calculateLineConfidence(vals, vals_size, white_line);
+    return line;
+}
+
+uint16_t LineMath::calibrateValue(uint16_t val, uint16_t min, uint16_t range) {
+    if (val <= min || range == 0) {
+        return 0;
+    } else {
+        val = int32_t(val - min) * MAX_VAL / range;
+        return std::min(MAX_VAL, val);
+    }
+}
+
+}; // namespace mcp3008
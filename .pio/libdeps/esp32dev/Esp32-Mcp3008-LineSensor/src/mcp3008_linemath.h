@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mcp3008 {
+
+/**
+ * \brief The line position math used by LineSensor.
+ *
+ * It depends only on the values passed in, not on the ESP32 or the chip,
+ * so it can also run on a PC, e.g. to replay recorded sensor data.
+ * All values are expected in range <0; Driver::MAX_VAL>.
+ */
+class LineMath {
+public:
+    /**
+     * \brief The algorithm LineSensor::readLine() uses to compute the line position.
+     */
+    enum LineEstimator : uint8_t {
+        ESTIMATOR_CENTROID, //!< Weighted average of all channels, see calculateLine(). The default.
+        ESTIMATOR_PARABOLIC, //!< Parabola fitted around the strongest channel, see calculateLineParabolic().
+    };
+
+    /**
+     * \brief The line position computation used by LineSensor::readLine(), on values you already have.
+     *
+     * Uses only integer math and no heap allocations, can be used outside of the ESP32
+     * (e.g. on recorded values).
+     *
+     * \param vals calibrated values, in range <0; Driver::MAX_VAL>, as returned by LineSensor::calibratedRead().
+     * \param vals_size number of values in \p vals, at most Driver::CHANNELS.
+     * \return same as LineSensor::readLine()
+     */
+    static float calculateLine(const uint16_t* vals, size_t vals_size, bool white_line = false, float line_threshold = 0.20f);
+
+    /**
+     * \brief Line position by fitting a parabola through the strongest channel and its neighbours.
+     *
+     * Unlike calculateLine(), the result is not pulled towards the middle by the other channels
+     * and moves continuously between two sensors, giving finer resolution with a narrow line.
+     * Integer math only, same inputs and return value as calculateLine().
+     *
+     * \param confidence if not null, receives the same value as in LineSensor::readLineWithConfidence().
+     */
+    static float calculateLineParabolic(const uint16_t* vals, size_t vals_size, bool white_line = false,
+        float line_threshold = 0.20f, float* confidence = nullptr);
+
+    /**
+     * \brief The confidence value reported by LineSensor::readLineWithConfidence(), on values you already have.
+     */
+    static float calculateLineConfidence(const uint16_t* vals, size_t vals_size, bool white_line = false);
+
+
+    /**
+     * \brief Compute the line position using the selected \p estimator.
+     *
+     * \param confidence if not null, receives the same value as in LineSensor::readLineWithConfidence().
+     */
+    static float estimateLine(LineEstimator estimator, const uint16_t* vals, size_t vals_size, bool white_line = false,
+        float line_threshold = 0.20f, float* confidence = nullptr);
+
+    /**
+     * \brief Stretch a raw value from <min; min + range> to <0; Driver::MAX_VAL>,
+     *        as specified in LineSensor::CalibrationData.
+     */
+    static uint16_t calibrateValue(uint16_t val, uint16_t min, uint16_t range);
+};
+
+}; // namespace mcp3008
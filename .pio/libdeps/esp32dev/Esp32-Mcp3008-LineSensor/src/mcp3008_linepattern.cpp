@@ -0,0 +1,112 @@
+#include "mcp3008_linepattern.h"
+
+namespace mcp3008 {
+
+// Same as Driver::MAX_VAL, this file must not depend on the driver.
+static constexpr uint16_t MAX_VAL = 1023;
+
+LinePatternDetector::LinePatternDetector()
+    : m_white_line(false)
+    , m_threshold(MAX_VAL / 2)
+    , m_debounce_us(20000) {
+    reset();
+}
+
+void LinePatternDetector::configure(bool white_line, uint16_t threshold, uint32_t debounce_us) {
+    m_white_line = white_line;
+    m_threshold = threshold;
+    m_debounce_us = debounce_us;
+    reset();
+}
+
+void LinePatternDetector::reset() {
+    m_pattern = PATTERN_NONE;
+    m_candidate = PATTERN_NONE;
+    m_candidate_since_us = 0;
+    m_line_centered = false;
+}
+
+LinePatternDetector::Pattern LinePatternDetector::classify(const uint16_t* vals, size_t vals_size, bool white_line, uint16_t threshold) {
+    const uint16_t flip = white_line ? MAX_VAL : 0;
+
+    size_t active = 0;
+    uint32_t mask = 0;
+    for (size_t i = 0; i < vals_size; ++i) {
+        if ((vals[i] ^ flip) >= threshold) {
+            mask |= (1 << i);
+            ++active;
+        }
+    }
+
+    if (active == 0)
+        return PATTERN_NONE;
+
+    // Allow one sensor to miss the line, e.g. between two tape segments.
+    if (vals_size >= 3 && active + 1 >= vals_size)
+        return PATTERN_CROSSING;
+
+    const bool left_edge = (mask & 1) != 0;
+    const bool right_edge = (mask & (1 << (vals_size - 1))) != 0;
+    const size_t half = (vals_size + 1) / 2;
+
+    // A branch covers at least half of the sensors from one edge.
+    if (left_edge && !right_edge && active >= half)
+        return PATTERN_LEFT;
+    if (right_edge && !left_edge && active >= half)
+        return PATTERN_RIGHT;
+    return PATTERN_LINE;
+}
+
+bool LinePatternDetector::update(const uint16_t* vals, size_t vals_size, int64_t timestamp_us, LineEvent& ev) {
+    const Pattern p = classify(vals, vals_size, m_white_line, m_threshold);
+
+    if (p == PATTERN_LINE) {
+        // Remember where the line was, to tell a line end from the line leaving to the side.
+        const uint16_t flip = m_white_line ? MAX_VAL : 0;
+        size_t first = vals_size, last = 0;
+        for (size_t i = 0; i < vals_size; ++i) {
+            if ((vals[i] ^ flip) >= m_threshold) {
+                if (first == vals_size)
+                    first = i;
+                last = i;
+            }
+        }
+        const size_t quarter = vals_size / 4;
+        m_line_centered = first >= quarter && last + quarter < vals_size;
+    }
+
+    if (p != m_candidate) {
+        m_candidate = p;
+        m_candidate_since_us = timestamp_us;
+    }
+
+    if (m_candidate == m_pattern || timestamp_us - m_candidate_since_us < int64_t(m_debounce_us))
+        return false;
+
+    const Pattern prev = m_pattern;
+    m_pattern = m_candidate;
+    ev.timestamp_us = m_candidate_since_us;
+
+    switch (m_pattern) {
+    case PATTERN_NONE:
+        ev.type = (prev == PATTERN_LINE && m_line_centered) ? LineEvent::END : LineEvent::LOST;
+        return true;
+    case PATTERN_LINE:
+        if (prev != PATTERN_NONE)
+            return false;
+        ev.type = LineEvent::FOUND;
+        return true;
+    case PATTERN_CROSSING:
+        ev.type = LineEvent::CROSSING;
+        return true;
+    case PATTERN_LEFT:
+        ev.type = LineEvent::LEFT_BRANCH;
+        return true;
+    case PATTERN_RIGHT:
+        ev.type = LineEvent::RIGHT_BRANCH;
+        return true;
+    }
+    return false;
+}
+
+}; // namespace mcp3008
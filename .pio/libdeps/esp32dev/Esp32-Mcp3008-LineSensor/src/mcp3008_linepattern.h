@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace mcp3008 {
+
+/**
+ * \brief An event detected by LinePatternDetector.
+ */
+struct LineEvent {
+    enum Type : uint8_t {
+        FOUND, //!< The line appeared under the sensors
+        LOST, //!< The line left the sensors to one side
+        END, //!< The line ended while it was in the middle of the sensors
+        CROSSING, //!< All the sensors are on the line
+        LEFT_BRANCH, //!< The line extends from the middle to the left edge (channel with smallest ID)
+        RIGHT_BRANCH, //!< The line extends from the middle to the right edge
+    };
+
+    Type type;
+    int64_t timestamp_us; //!< When the pattern was first seen, before the debouncing
+};
+
+/**
+ * \brief Recognizes crossings, branches and line ends in the calibrated sensor values.
+ *
+ * Each frame is classified into a Pattern, and a pattern has to stay the same
+ * for the debounce time before it is accepted and an event is emitted.
+ * Has no dependencies on the ESP32, so it can also run on recorded data.
+ */
+class LinePatternDetector {
+public:
+    enum Pattern : uint8_t {
+        PATTERN_NONE, //!< No sensor is on the line
+        PATTERN_LINE, //!< A narrow line
+        PATTERN_CROSSING,
+        PATTERN_LEFT,
+        PATTERN_RIGHT,
+    };
+
+    LinePatternDetector();
+
+    /**
+     * \param white_line the line is white on black background.
+     * \param threshold calibrated value above which a sensor is on the line, in range <0; Driver::MAX_VAL>
+     * \param debounce_us how long a pattern has to last before an event is emitted.
+     */
+    void configure(bool white_line, uint16_t threshold, uint32_t debounce_us);
+
+    void reset();
+
+    /**
+     * \brief Classify a single frame, without any debouncing.
+     */
+    static Pattern classify(const uint16_t* vals, size_t vals_size, bool white_line, uint16_t threshold);
+
+    /**
+     * \brief Feed a new frame.
+     *
+     * \param vals calibrated values, as returned by LineSensor::calibratedRead()
+     * \param timestamp_us time the values were measured
+     * \param ev filled if an event was detected
+     * \return true if an event was detected
+     */
+    bool update(const uint16_t* vals, size_t vals_size, int64_t timestamp_us, LineEvent& ev);
+
+    Pattern pattern() const { return m_pattern; } //!< The current debounced pattern
+
+private:
+    bool m_white_line;
+    uint16_t m_threshold;
+    uint32_t m_debounce_us;
+
+    Pattern m_pattern;
+    Pattern m_candidate;
+    int64_t m_candidate_since_us;
+    bool m_line_centered;
+};
+
+}; // namespace mcp3008
@@ -1,5 +1,6 @@
 #include <cmath>
 #include <esp_log.h>
+#include <string.h>
 
 #include "mcp3008_linesensor.h"
 
@@ -8,7 +9,10 @@
 namespace mcp3008 {
 
 LineSensor::LineSensor()
-    : Driver() {
+    : Driver()
+    , m_estimator(ESTIMATOR_CENTROID)
+    , m_auto_cal(nullptr)
+    , m_events_enabled(false) {
     for (int i = 0; i < Driver::CHANNELS; ++i) {
         m_calibration.min[i] = 0;
         m_calibration.range[i] = Driver::MAX_VAL;
@@ -16,60 +20,111 @@ LineSensor::LineSensor()
 }
 
 LineSensor::~LineSensor() {
+    // The sampling task must not call onSample() anymore.
+    stopSampling();
+    delete m_auto_cal.load();
 }
 
 LineSensorCalibrator LineSensor::startCalibration() {
     return LineSensorCalibrator(*this);
 }
 
-float LineSensor::readLine(bool white_line, float line_threshold) const {
-    std::vector<uint16_t> vals;
-    auto res = this->calibratedRead(vals);
-    if (res != ESP_OK || vals.size() == 0) {
-        ESP_LOGE(TAG, "read() failed: %d", res);
-        return nanf("");
-    }
+esp_err_t LineSensor::startAutoCalibration() {
+    if (!isSampling())
+        return ESP_FAIL;
 
-    uint32_t weighted = 0;
-    uint16_t sum = 0;
+    // Checked under the lock, so that only one of concurrent calls creates the calibrator.
+    std::lock_guard<std::mutex> l(m_auto_cal_mutex);
+    if (m_auto_cal != nullptr)
+        return ESP_FAIL;
+    m_auto_cal = new LineSensorCalibrator(*this);
+    return ESP_OK;
+}
 
-    const uint16_t threshold = line_threshold * MAX_VAL;
+bool LineSensor::applyAutoCalibration() {
+    std::lock_guard<std::mutex> l(m_auto_cal_mutex);
+    auto* cal = m_auto_cal.load();
+    if (cal == nullptr)
+        return false;
+    return cal->save();
+}
 
-    uint16_t min = MAX_VAL;
-    uint16_t max = 0;
-    for (size_t i = 0; i < vals.size(); ++i) {
-        auto val = vals[i];
-        if (white_line)
-            val = MAX_VAL - val;
+bool LineSensor::stopAutoCalibration(bool apply) {
+    const bool res = apply ? applyAutoCalibration() : false;
 
-        if (val < min)
-            min = val;
-        if (val > max)
-            max = val;
+    LineSensorCalibrator* cal;
+    {
+        std::lock_guard<std::mutex> l(m_auto_cal_mutex);
+        cal = m_auto_cal.exchange(nullptr);
     }
+    delete cal;
+    return res;
+}
 
-    const uint16_t range = max - min;
-    if (max < threshold || range < threshold)
-        return nanf("");
+esp_err_t LineSensor::startEventDetection(event_callback_t callback, bool white_line, float threshold, uint32_t debounce_ms) {
+    if (!isSampling() || !callback)
+        return ESP_FAIL;
+
+    std::lock_guard<std::mutex> l(m_events_mutex);
+    m_events_detector.configure(white_line, threshold * MAX_VAL, debounce_ms * 1000);
+    m_events_callback = callback;
+    m_events_enabled = true;
+    return ESP_OK;
+}
 
-    for (size_t i = 0; i < vals.size(); ++i) {
-        auto val = vals[i];
-        if (white_line)
-            val = MAX_VAL - val;
+void LineSensor::stopEventDetection() {
+    std::lock_guard<std::mutex> l(m_events_mutex);
+    m_events_enabled = false;
+    m_events_callback = nullptr;
+}
+
+void LineSensor::onSample(const uint16_t* values) {
+    // Never block the sampling task, losing a sample here and there does not matter.
+    if (m_auto_cal != nullptr && m_auto_cal_mutex.try_lock()) {
+        auto* cal = m_auto_cal.load();
+        if (cal != nullptr)
+            cal->record(values);
+        m_auto_cal_mutex.unlock();
+    }
 
-        val = float(val - min) / range * MAX_VAL;
+    if (m_events_enabled && m_events_mutex.try_lock()) {
+        if (m_events_enabled) {
+            uint16_t vals[CHANNELS];
+            memcpy(vals, values, sizeof(uint16_t) * getChannelsCount());
+            calibrateResults(vals);
 
-        weighted += uint32_t(val) * i * MAX_VAL;
-        sum += val;
+            LineEvent ev;
+            if (m_events_detector.update(vals, getChannelsCount(), esp_timer_get_time(), ev))
+                m_events_callback(ev);
+        }
+        m_events_mutex.unlock();
     }
+}
 
-    if (sum == 0)
+float LineSensor::readLine(bool white_line, float line_threshold) const {
+    uint16_t vals[Driver::CHANNELS];
+    const size_t vals_size = getChannelsCount();
+    auto res = this->calibratedRead(vals);
+    if (res != ESP_OK || vals_size == 0) {
+        ESP_LOGE(TAG, "read() failed: %d", res);
         return nanf("");
+    }
 
-    const int16_t middle = float(vals.size() - 1) / 2 * MAX_VAL;
-    const int16_t result = (weighted / sum) - middle;
+    return estimateLine(m_estimator, vals, vals_size, white_line, line_threshold);
+}
 
-    return std::min(1.f, std::max(-1.f, float(result) / float(middle)));
+float LineSensor::readLineWithConfidence(float& confidence, bool white_line, float line_threshold) const {
+    confidence = 0.f;
+
+    uint16_t vals[Driver::CHANNELS];
+    const size_t vals_size = getChannelsCount();
+    auto res = this->calibratedRead(vals);
+    if (res != ESP_OK || vals_size == 0) {
+        ESP_LOGE(TAG, "read() failed: %d", res);
+        return nanf("");
+    }
+
+    return estimateLine(m_estimator, vals, vals_size, white_line, line_threshold, &confidence);
 }
 
 bool LineSensor::setCalibration(const LineSensor::CalibrationData& data) {
@@ -98,15 +153,6 @@ void LineSensor::calibrateResults(uint16_t* dest) const {
     }
 }
 
-uint16_t LineSensor::calibrateValue(int chan, uint16_t val) const {
-    if (val <= m_calibration.min[chan]) {
-        return 0;
-    } else {
-        val = int32_t(val - m_calibration.min[chan]) * MAX_VAL / m_calibration.range[chan];
-        return std::min(MAX_VAL, val);
-    }
-}
-
 esp_err_t LineSensor::calibratedRead(std::vector<uint16_t>& results) const {
     const auto res = read(results);
     if (res == ESP_OK)
@@ -127,7 +173,9 @@ uint16_t LineSensor::calibratedReadChannel(uint8_t channel, esp_err_t* result) c
 }
 
 LineSensorCalibrator::LineSensorCalibrator(LineSensor& sensor)
-    : m_sensor(sensor) {
+    : m_sensor(sensor)
+    , m_low_pct(2)
+    , m_high_pct(98) {
     reset();
 }
 
@@ -135,10 +183,13 @@ LineSensorCalibrator::~LineSensorCalibrator() {
 }
 
 void LineSensorCalibrator::reset() {
-    for (int i = 0; i < Driver::CHANNELS; ++i) {
-        m_data.min[i] = Driver::MAX_VAL;
-        m_max[i] = 0;
-    }
+    memset(m_histogram, 0, sizeof(m_histogram));
+    memset(m_counts, 0, sizeof(m_counts));
+}
+
+void LineSensorCalibrator::setPercentiles(uint8_t low_pct, uint8_t high_pct) {
+    m_low_pct = std::min(low_pct, uint8_t(100));
+    m_high_pct = std::max(m_low_pct, std::min(high_pct, uint8_t(100)));
 }
 
 esp_err_t LineSensorCalibrator::record() {
@@ -148,27 +199,68 @@ esp_err_t LineSensorCalibrator::record() {
         return res;
     }
 
+    record(vals);
+    return ESP_OK;
+}
+
+void LineSensorCalibrator::record(const uint16_t* vals) {
     int idx = 0;
     const auto mask = m_sensor.getChannelsMask();
     for (int i = 0; i < Driver::CHANNELS; ++i) {
         if (((1 << i) & mask) == 0)
             continue;
 
-        if (vals[idx] < m_data.min[i])
-            m_data.min[i] = vals[idx];
-        if (vals[idx] > m_max[i])
-            m_max[i] = vals[idx];
+        auto* hist = m_histogram[i];
+        const int bin = std::min(int(Driver::MAX_VAL), int(vals[idx])) >> BIN_SHIFT;
+        if (hist[bin] == 0xFFFF) {
+            // Halve the whole channel, which also makes older samples count less.
+            m_counts[i] = 0;
+            for (int b = 0; b < HISTOGRAM_BINS; ++b) {
+                hist[b] /= 2;
+                m_counts[i] += hist[b];
+            }
+        }
+        ++hist[bin];
+        ++m_counts[i];
         ++idx;
     }
+}
 
-    return ESP_OK;
+uint16_t LineSensorCalibrator::percentile(int chan, uint32_t pct) const {
+    const uint32_t target = uint64_t(m_counts[chan]) * pct / 100;
+    uint32_t cumulative = 0;
+    for (int b = 0; b < HISTOGRAM_BINS; ++b) {
+        cumulative += m_histogram[chan][b];
+        if ((cumulative != 0 && cumulative >= target) || b + 1 == HISTOGRAM_BINS) {
+            // Use the middle of the bin.
+            return std::min(int(Driver::MAX_VAL), (b << BIN_SHIFT) + (1 << (BIN_SHIFT - 1)));
+        }
+    }
+    return Driver::MAX_VAL;
 }
 
-void LineSensorCalibrator::save() {
+bool LineSensorCalibrator::save() {
+    auto data = m_sensor.getCalibration();
+    bool all = true;
+
+    const auto mask = m_sensor.getChannelsMask();
     for (int i = 0; i < Driver::CHANNELS; ++i) {
-        m_data.range[i] = m_max[i] - m_data.min[i];
+        if (((1 << i) & mask) == 0)
+            continue;
+
+        const uint16_t low = percentile(i, m_low_pct);
+        const uint16_t high = percentile(i, m_high_pct);
+        if (m_counts[i] == 0 || high < low + MIN_RANGE) {
+            ESP_LOGW(TAG, "channel %d: not enough contrast for calibration (%hu-%hu), keeping the previous one", i, low, high);
+            all = false;
+            continue;
+        }
+
+        data.min[i] = low;
+        data.range[i] = high - low;
     }
-    m_sensor.setCalibration(m_data);
+    m_sensor.setCalibration(data);
+    return all;
 }
 
 }; // namespace mcp3008
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <driver/spi_master.h>
+#include <functional>
+#include <mutex>
 #include <vector>
 
 #include "mcp3008_driver.h"
+#include "mcp3008_linemath.h"
+#include "mcp3008_linepattern.h"
 
 namespace mcp3008 {
 
@@ -15,7 +20,7 @@ class LineSensorCalibrator;
  * This class is not thread-safe, you have to make sure the methods are called
  * from one thread at a time only.
  */
-class LineSensor : public Driver {
+class LineSensor : public Driver, public LineMath {
 public:
     /**
      * \brief The LineSensor's calibration data
@@ -38,6 +43,56 @@ public:
      */
     LineSensorCalibrator startCalibration();
 
+    /**
+     * \brief Start calibrating from the background sampling stream, see Driver::startSampling().
+     *
+     * Every sample taken by the sampling task is recorded into an internal LineSensorCalibrator,
+     * so the calibration keeps being refined for as long as it runs, e.g. while the robot drives.
+     * Nothing changes in the current calibration until applyAutoCalibration() or stopAutoCalibration()
+     * is called.
+     *
+     * \return ESP_FAIL if the sampling is not active or the auto calibration is already running.
+     */
+    esp_err_t startAutoCalibration();
+
+    /**
+     * \brief Store what the auto calibration gathered so far, it keeps running.
+     *
+     * \return false if it is not running or some of the channels did not see enough contrast yet,
+     *         these keep their previous calibration.
+     */
+    bool applyAutoCalibration();
+
+    /**
+     * \brief Stop the auto calibration.
+     *
+     * \param apply call applyAutoCalibration() before stopping
+     * \return result of applyAutoCalibration() or false if \p apply is false.
+     */
+    bool stopAutoCalibration(bool apply = true);
+
+    bool isAutoCalibrating() const { return m_auto_cal != nullptr; } //!< Returns true if the auto calibration is running
+
+    typedef std::function<void(const LineEvent&)> event_callback_t;
+
+    /**
+     * \brief Start detecting crossings, branches and line ends in the background sampling stream.
+     *
+     * Each sample taken by the sampling task (see Driver::startSampling()) is calibrated and fed
+     * to a LinePatternDetector, so this adds no SPI traffic.
+     *
+     * \param callback called with each detected event. It runs on the sampling task,
+     *        so it must be quick and must not block, e.g. just post the event to a queue.
+     * \param white_line the line is white on black background.
+     * \param threshold calibrated value above which a sensor is on the line, as a fraction.
+     * \param debounce_ms how long a pattern has to last before its event is emitted.
+     * \return ESP_FAIL if the sampling is not active.
+     */
+    esp_err_t startEventDetection(event_callback_t callback, bool white_line = false,
+        float threshold = 0.5f, uint32_t debounce_ms = 20);
+
+    void stopEventDetection(); //!< Stop the detection started with startEventDetection()
+
     /**
      * \brief Get the calibration data used by linesensor, feel free to save this
      *        structure somewhere and load it afterwards using setCalibration().
@@ -71,6 +126,23 @@ public:
      */
     float readLine(bool white_line = false, float line_threshold = 0.20f) const;
 
+    /**
+     * \brief Same as readLine(), but also reports how sure the estimate is.
+     *
+     * \param confidence set to a value in range <0; 1>, 0 when the line is not found.
+     *        It is the contrast between the line and the background, lowered when channels
+     *        away from the line are also active (crossings, wide marks, noise).
+     */
+    float readLineWithConfidence(float& confidence, bool white_line = false, float line_threshold = 0.20f) const;
+
+    /**
+     * \brief Select the algorithm used by readLine() and readLineWithConfidence().
+     *
+     * The return value contract of readLine() does not change.
+     */
+    void setLineEstimator(LineEstimator estimator) { m_estimator = estimator; }
+    LineEstimator getLineEstimator() const { return m_estimator; }
+
     /**
      * \brief Same as Driver::read(), but returns calibrated result if possible
      *
@@ -89,6 +161,13 @@ public:
      */
     esp_err_t calibratedRead(uint16_t* dest) const;
 
+    /**
+     * \brief Apply the calibration to values you already have, in place.
+     *
+     * \param vals raw values as returned by Driver::read().
+     */
+    void calibrate(uint16_t* vals) const { calibrateResults(vals); }
+
     /**
      * \brief Same as Driver::readChannel(), but returns calibrated data.
      *
@@ -97,13 +176,27 @@ public:
      */
     uint16_t calibratedReadChannel(uint8_t channel, esp_err_t* result = nullptr) const;
 
+protected:
+    void onSample(const uint16_t* values) override;
+
 private:
     LineSensor(const LineSensor&) = delete;
 
     void calibrateResults(uint16_t* dest) const;
-    inline uint16_t calibrateValue(int chan, uint16_t val) const;
+    inline uint16_t calibrateValue(int chan, uint16_t val) const {
+        return LineMath::calibrateValue(val, m_calibration.min[chan], m_calibration.range[chan]);
+    }
 
     CalibrationData m_calibration;
+    LineEstimator m_estimator;
+
+    std::mutex m_auto_cal_mutex;
+    std::atomic<LineSensorCalibrator*> m_auto_cal;
+
+    std::mutex m_events_mutex;
+    std::atomic<bool> m_events_enabled;
+    LinePatternDetector m_events_detector;
+    event_callback_t m_events_callback;
 };
 
 /**
@@ -114,6 +207,10 @@ private:
  * and then storing the data to the LineSensor instance via the
  * save() method.
  *
+ * Each channel's values are collected into a histogram, and the calibration
+ * range is taken from its low and high percentiles instead of the absolute
+ * minimum and maximum, so that a few noisy samples do not ruin it.
+ *
  * The parent LineSensor is modified only by the save() method.
  * This calibrator can be reused multiple times by calling
  * the reset() method between each session.
@@ -125,10 +222,21 @@ class LineSensorCalibrator {
     friend class LineSensor;
 
 public:
+    static constexpr int HISTOGRAM_BINS = 128; //!< Amount of histogram bins per channel
+    static constexpr uint16_t MIN_RANGE = Driver::MAX_VAL / 10; //!< Channels with smaller range are not calibrated by save()
+
     ~LineSensorCalibrator();
 
     void reset(); //!< Reset this calibrator to the initial state.
 
+    /**
+     * \brief Set which percentiles of the recorded values are used as the calibration range.
+     *
+     * \param low_pct values below this percentile are considered noise, default 2.
+     * \param high_pct values above this percentile are considered noise, default 98.
+     */
+    void setPercentiles(uint8_t low_pct, uint8_t high_pct);
+
     /**
      * \brief Record current sensor values.
      *
@@ -138,14 +246,35 @@ public:
      */
     esp_err_t record();
 
-    void save(); //!< Store the calibrated values to the parent LineSensor.
+    /**
+     * \brief Record values you already have, e.g. from Driver::latestFrame().
+     *
+     * \param vals raw values, in the same layout as returned by Driver::read().
+     */
+    void record(const uint16_t* vals);
+
+    /**
+     * \brief Store the calibrated values to the parent LineSensor.
+     *
+     * Channels which did not see at least MIN_RANGE between the low and high percentile
+     * keep their previous calibration.
+     *
+     * \return true if all the enabled channels were calibrated.
+     */
+    bool save();
 
 private:
+    static constexpr int BIN_SHIFT = 3; // 1024 values / 128 bins
+
     LineSensorCalibrator(LineSensor& sensor);
 
+    uint16_t percentile(int chan, uint32_t pct) const;
+
     LineSensor& m_sensor;
-    LineSensor::CalibrationData m_data;
-    uint16_t m_max[Driver::CHANNELS];
+    uint16_t m_histogram[Driver::CHANNELS][HISTOGRAM_BINS];
+    uint32_t m_counts[Driver::CHANNELS];
+    uint8_t m_low_pct;
+    uint8_t m_high_pct;
 };
 
 }; // namespace mcp3008
@@ -0,0 +1,66 @@
+// Checks that the IIR filter of ChannelFilter settles on the input after a step,
+// the same way for rising and falling steps, with every strength.
+//
+// Build on a PC, from the library's root directory:
+//   g++ -std=c++11 -O2 -Isrc tools/filter_check.cpp -o filter_check
+//
+// Usage:
+//   ./filter_check
+//
+// Returns 1 if the output does not reach the input of any step.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mcp3008_filter.h"
+
+typedef mcp3008::ChannelFilter<1> Filter;
+
+// Returns how far the output ends up from the input after stepping from `from` to `to`.
+static int settledError(uint8_t strength, uint16_t from, uint16_t to) {
+    Filter filter;
+    filter.configure(Filter::IIR, strength);
+
+    uint16_t val = from;
+    filter.apply(&val, 1);
+
+    // The step response decays by (1 - 1/2^strength) per sample, leave it plenty of time.
+    const int samples = 40 << strength;
+    for (int i = 0; i < samples; ++i) {
+        val = to;
+        filter.apply(&val, 1);
+    }
+    return int(val) - int(to);
+}
+
+int main() {
+    static const uint16_t levels[] = { 0, 1, 2, 7, 100, 115, 500, 511, 512, 1000, 1022, 1023, 0xFFFF };
+    static const int level_count = sizeof(levels) / sizeof(levels[0]);
+
+    int failures = 0;
+    for (uint8_t strength = 1; strength <= 8; ++strength) {
+        int worst_up = 0;
+        int worst_down = 0;
+        for (int a = 0; a < level_count; ++a) {
+            for (int b = 0; b < level_count; ++b) {
+                const int err = settledError(strength, levels[a], levels[b]);
+                if (levels[b] > levels[a]) {
+                    worst_up = abs(err) > abs(worst_up) ? err : worst_up;
+                } else {
+                    worst_down = abs(err) > abs(worst_down) ? err : worst_down;
+                }
+                if (err != 0) {
+                    ++failures;
+                }
+            }
+        }
+        printf("strength %d: worst error after a rising step %d, after a falling step %d\n", strength, worst_up,
+            worst_down);
+    }
+
+    if (failures != 0) {
+        printf("%d steps did not settle on the input\n", failures);
+        return 1;
+    }
+    return 0;
+}
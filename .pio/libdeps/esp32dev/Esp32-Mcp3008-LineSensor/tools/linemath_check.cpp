@@ -0,0 +1,189 @@
+// Checks LineMath::calculateLine() against the float implementation it replaced,
+// on random frames, and compares the speed of both.
+//
+// Build on a PC, from the library's root directory:
+//   g++ -std=c++11 -O2 -Isrc tools/linemath_check.cpp src/mcp3008_linemath.cpp -o linemath_check
+//
+// Usage:
+//   ./linemath_check [--frames N] [--seed N] [--tolerance X]
+//
+// Returns 1 if the positions differ by more than the tolerance, or if only one of them is NaN.
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "mcp3008_linemath.h"
+
+using mcp3008::LineMath;
+
+static constexpr uint16_t MAX_VAL = 1023;
+static constexpr size_t CHANNELS = 8;
+
+// LineSensor::readLine() before it moved to integer math, with the values passed in.
+// Only the range == 0 and middle == 0 checks are new, the old code divided by zero there.
+static float calculateLineFloat(const uint16_t* vals, size_t vals_size, bool white_line, float line_threshold) {
+    uint32_t weighted = 0;
+    uint16_t sum = 0;
+
+    const uint16_t threshold = line_threshold * MAX_VAL;
+
+    uint16_t min = MAX_VAL;
+    uint16_t max = 0;
+    for (size_t i = 0; i < vals_size; ++i) {
+        auto val = vals[i];
+        if (white_line)
+            val = MAX_VAL - val;
+
+        if (val < min)
+            min = val;
+        if (val > max)
+            max = val;
+    }
+
+    const uint16_t range = max - min;
+    if (max < threshold || range < threshold || range == 0)
+        return nanf("");
+
+    for (size_t i = 0; i < vals_size; ++i) {
+        auto val = vals[i];
+        if (white_line)
+            val = MAX_VAL - val;
+
+        val = float(val - min) / range * MAX_VAL;
+
+        weighted += uint32_t(val) * i * MAX_VAL;
+        sum += val;
+    }
+
+    if (sum == 0)
+        return nanf("");
+
+    const int16_t middle = float(vals_size - 1) / 2 * MAX_VAL;
+    if (middle == 0)
+        return 0.f;
+    const int16_t result = (weighted / sum) - middle;
+
+    return std::min(1.f, std::max(-1.f, float(result) / float(middle)));
+}
+
+struct Frame {
+    uint16_t vals[CHANNELS];
+    uint8_t size;
+    bool white_line;
+    float threshold;
+};
+
+// Half of the frames are a line under the sensor with noise, the rest are uniform noise.
+static Frame randomFrame(std::mt19937& rng) {
+    std::uniform_int_distribution<int> channels(2, CHANNELS);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    std::normal_distribution<float> noise(0.f, 20.f);
+
+    Frame f;
+    f.size = channels(rng);
+    f.white_line = unit(rng) < 0.5f;
+    f.threshold = unit(rng) * 0.6f;
+
+    const bool line = unit(rng) < 0.5f;
+    const float center = unit(rng) * (f.size + 1) - 1;
+    const float width = 0.3f + unit(rng) * 1.5f;
+    const float background = unit(rng) * 300;
+    const float peak = 300 + unit(rng) * 723;
+    for (size_t i = 0; i < f.size; ++i) {
+        float val;
+        if (line) {
+            const float d = (float(i) - center) / width;
+            val = background + (peak - background) * expf(-d * d) + noise(rng);
+        } else {
+            val = unit(rng) * MAX_VAL;
+        }
+        val = std::min(float(MAX_VAL), std::max(0.f, val));
+        f.vals[i] = f.white_line ? MAX_VAL - uint16_t(val) : uint16_t(val);
+    }
+    return f;
+}
+
+template <typename Fn>
+static double timeNs(const std::vector<Frame>& frames, Fn fn, float& sink) {
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& f : frames) {
+        const float pos = fn(f);
+        if (!std::isnan(pos))
+            sink += pos;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / frames.size();
+}
+
+int main(int argc, char** argv) {
+    size_t count = 1000000;
+    unsigned seed = 1;
+    float tolerance = 0.001f;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_val = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_val) {
+            count = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_val) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--tolerance") == 0 && has_val) {
+            tolerance = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--frames N] [--seed N] [--tolerance X]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::mt19937 rng(seed);
+    std::vector<Frame> frames;
+    frames.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        frames.push_back(randomFrame(rng));
+
+    size_t identical = 0;
+    size_t nan_mismatch = 0;
+    size_t over_tolerance = 0;
+    size_t no_line = 0;
+    float max_diff = 0;
+    for (const auto& f : frames) {
+        const float a = LineMath::calculateLine(f.vals, f.size, f.white_line, f.threshold);
+        const float b = calculateLineFloat(f.vals, f.size, f.white_line, f.threshold);
+        if (std::isnan(a) || std::isnan(b)) {
+            if (std::isnan(a) != std::isnan(b)) {
+                if (nan_mismatch++ < 5)
+                    fprintf(stderr, "NaN mismatch: integer %f, float %f\n", a, b);
+            } else {
+                ++no_line;
+                ++identical;
+            }
+            continue;
+        }
+
+        const float diff = fabsf(a - b);
+        max_diff = std::max(max_diff, diff);
+        if (diff == 0) {
+            ++identical;
+        } else if (diff > tolerance && over_tolerance++ < 5) {
+            fprintf(stderr, "difference %f: integer %f, float %f\n", diff, a, b);
+        }
+    }
+
+    float sink = 0;
+    const double int_ns = timeNs(frames, [](const Frame& f) {
+        return LineMath::calculateLine(f.vals, f.size, f.white_line, f.threshold);
+    }, sink);
+    const double float_ns = timeNs(frames, [](const Frame& f) {
+        return calculateLineFloat(f.vals, f.size, f.white_line, f.threshold);
+    }, sink);
+
+    printf("frames: %u, no line: %u, identical: %u, max difference: %g\n", unsigned(count), unsigned(no_line),
+        unsigned(identical), max_diff);
+    printf("NaN mismatches: %u, over tolerance %g: %u\n", unsigned(nan_mismatch), tolerance, unsigned(over_tolerance));
+    printf("integer: %.1f ns per frame, float: %.1f ns per frame (%g)\n", int_ns, float_ns, sink);
+    return nan_mismatch == 0 && over_tolerance == 0 ? 0 : 1;
+}
@@ -123,6 +123,33 @@ bool _GridUi::handleRbPacket(const std::string& cmd, rbjson::Object* pkt) {
     return true;
 }
 
+bool _GridUi::addHotJoystick(rb::Protocol* protocol) {
+    // Only the joystick "pos" events carry st.jx and st.jy.
+    return protocol->add_hot_command(
+        "_gev", { "id", "st.jx", "st.jy" },
+        [this](const rb::Protocol::HotValues& v) {
+            handleJoystickPos(uint16_t(v.values[0]), v.values[1], v.values[2]);
+        },
+        [](const rb::Protocol::HotValues& v) {
+            return v.has(0) && v.has(1) && v.has(2);
+        });
+}
+
+void _GridUi::handleJoystickPos(uint16_t uuid, float x, float y) {
+    m_states_mu.lock();
+    auto* state = stateByUuidLocked(uuid);
+    if (state == nullptr) {
+        m_states_mu.unlock();
+        return;
+    }
+
+    state->update("jx", x);
+    state->update("jy", y);
+    m_states_mu.unlock();
+
+    state->call("pos");
+}
+
 void _GridUi::stateChangeTask(void* selfVoid) {
     auto* self = (_GridUi*)selfVoid;
 
@@ -37,6 +37,16 @@ public:
 
     bool handleRbPacket(const std::string& command, rbjson::Object* pkt);
 
+    /**
+     * \brief Handle the position events of joysticks on the receive task, see rb::Protocol::add_hot_command().
+     *
+     * The "_gev" packets with the joystick position are decoded without building
+     * the rbjson::Object tree and only the latest one is kept when they come
+     * faster than they are handled. The other events still go through handleRbPacket().
+     * Must be called before rb::Protocol::start().
+     */
+    bool addHotJoystick(rb::Protocol* protocol);
+
     rb::Protocol* protocol() const { return m_protocol.load(); }
 
     builder::Arm& arm(float x, float y, float w, float h, uint16_t uuid = 0) {
@@ -102,6 +112,8 @@ private:
         return nullptr;
     }
 
+    void handleJoystickPos(uint16_t uuid, float x, float y);
+
     static void stateChangeTask(void* self);
 
     void notifyStateChange() {
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <math.h>
+
 #include "widget.h"
 
 namespace gridui {
@@ -20,6 +22,41 @@ public:
     double y() const {
         return data().getDouble("armY");
     }
+
+    /**
+     * \brief Update the absolute angles of the arm's bones, in radians.
+     *
+     * The state is only modified (and sent to the app) if at least one
+     * of the angles moved by more than ANGLE_EPSILON, so it is cheap
+     * to call this periodically.
+     */
+    void setAngles(const float* angles, size_t count) {
+        const auto* old = data().getArray("angles");
+        if (old != nullptr && old->size() == count) {
+            size_t i = 0;
+            for (; i < count; ++i) {
+                if (fabs(old->getDouble(i) - angles[i]) >= ANGLE_EPSILON)
+                    break;
+            }
+            if (i == count)
+                return;
+        }
+
+        auto* arr = new rbjson::Array();
+        for (size_t i = 0; i < count; ++i) {
+            arr->push_back(new rbjson::Number(angles[i]));
+        }
+        m_state->set("angles", arr);
+    }
+
+    double angle(size_t boneIdx) const {
+        const auto* arr = data().getArray("angles");
+        if (arr == nullptr)
+            return NAN;
+        return arr->getDouble(boneIdx, NAN);
+    }
+
+    static constexpr float ANGLE_EPSILON = 0.01f; //!< ~0.5 degree
 };
 
 };
@@ -57,6 +57,13 @@ private:
         m_mutex.unlock();
     }
 
+    void update(const std::string& key, double number) {
+        m_mutex.lock();
+        m_data.set(key, number);
+        markGlobalChangedLocked(key);
+        m_mutex.unlock();
+    }
+
     std::map<std::string, void*>& callbacks() {
         if (!m_callbacks) {
             m_callbacks.reset(new std::map<std::string, void*>);
@@ -240,7 +240,33 @@ Widget.createSubclass(Arm, {
         this.bones.push(prev)
       }
     }
-  ).disableEdit()
+  ).disableEdit(),
+  angles: new Prop(
+    Array,
+    function () {
+      var res = []
+      for (var i = 0; i < this.bones.length; ++i) res.push(this.bones[i].angle)
+      return res
+    },
+    function (angles) {
+      // Don't fight the user while they are moving the arm
+      if (this.touched || this.animation !== null) return
+
+      var prev = null
+      for (var i = 0; i < this.bones.length && i < angles.length; ++i) {
+        var b = this.bones[i]
+        b.angle = angles[i]
+        if (prev === null) {
+          b.relAngle = b.angle
+        } else {
+          b.relAngle = clampAng(b.angle - prev.angle)
+        }
+        prev = b
+      }
+    }
+  )
+    .disableEdit()
+    .setIgnoreInBuilder()
 })
 
 Arm.prototype.applyState = function (state) {
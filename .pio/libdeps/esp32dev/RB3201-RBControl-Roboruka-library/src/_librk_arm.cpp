@@ -12,6 +12,7 @@ namespace rk {
 
 ArmWrapper::ArmWrapper() {
     m_arm = nullptr;
+    m_ui_timer = Timers::INVALID_ID;
 }
 
 ArmWrapper::~ArmWrapper() {
@@ -49,6 +50,24 @@ void ArmWrapper::setup(const rkConfig& cfg) {
     for (size_t i = 0; i < m_bone_trims.size(); ++i) {
         m_bone_trims[i] = Angle::deg(cfg.arm_bone_trims[i]);
     }
+
+    m_ui_angles.resize(m_arm->definition().bones.size());
+}
+
+// Uses the SmartServoBus position cache, so it never waits for the servo bus.
+bool ArmWrapper::readCachedAngles(float* dest) {
+    const auto& def = m_arm->definition();
+    auto& servo = Manager::get().servoBus();
+    for (size_t i = 0; i < def.bones.size(); ++i) {
+        const auto& b = def.bones[i];
+        auto pos = servo.posOffline(b.servo_id);
+        if (pos.isNaN())
+            return false;
+
+        pos -= m_bone_trims[b.servo_id];
+        dest[i] = b.calcAbsAng(pos).rad();
+    }
+    return true;
 }
 
 std::unique_ptr<rbjson::Object> ArmWrapper::getInfo() {
@@ -63,20 +82,15 @@ std::unique_ptr<rbjson::Object> ArmWrapper::getInfo() {
     auto* bones = new rbjson::Array();
     info->set("bones", bones);
 
-    auto& servo = Manager::get().servoBus();
-    for (const auto& b : def.bones) {
-        auto pos = servo.pos(b.servo_id);
-        if (pos.isNaN()) {
-            while (bones->size() != 0)
-                bones->remove(bones->size() - 1);
-            break;
-        }
+    if (!readCachedAngles(m_ui_angles.data()))
+        return info;
 
-        pos -= m_bone_trims[b.servo_id];
+    for (size_t i = 0; i < def.bones.size(); ++i) {
+        const auto& b = def.bones[i];
 
         auto* info_b = new rbjson::Object();
         info_b->set("len", b.length);
-        info_b->set("angle", b.calcAbsAng(pos).rad());
+        info_b->set("angle", m_ui_angles[i]);
         info_b->set("rmin", b.rel_min.rad());
         info_b->set("rmax", b.rel_max.rad());
         info_b->set("amin", b.abs_min.rad());
@@ -88,8 +102,21 @@ std::unique_ptr<rbjson::Object> ArmWrapper::getInfo() {
     return info;
 }
 
-void ArmWrapper::sendInfo() {
-    gCtx.prot()->send_mustarrive("arminfo", getInfo().release());
+void ArmWrapper::linkUi(gridui::Arm widget, uint32_t period_ms) {
+    auto& timers = Manager::get().timers();
+    if (m_ui_timer != Timers::INVALID_ID) {
+        timers.cancel(m_ui_timer);
+    }
+
+    m_ui = std::move(widget);
+    m_ui_timer = timers.schedule(period_ms, std::bind(&ArmWrapper::updateUi, this));
+}
+
+bool ArmWrapper::updateUi() {
+    if (readCachedAngles(m_ui_angles.data())) {
+        m_ui.setAngles(m_ui_angles.data(), m_ui_angles.size());
+    }
+    return true;
 }
 
 bool ArmWrapper::moveTo(double x, double y) {
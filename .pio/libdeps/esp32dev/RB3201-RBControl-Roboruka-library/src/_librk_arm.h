@@ -17,7 +17,7 @@ public:
     void setup(const rkConfig& cfg);
 
     std::unique_ptr<rbjson::Object> getInfo();
-    void sendInfo();
+    void linkUi(gridui::Arm widget, uint32_t period_ms);
     bool moveTo(double x, double y);
     void setGrabbing(bool grab);
     bool isGrabbing() const;
@@ -27,8 +27,15 @@ public:
 private:
     ArmWrapper(const ArmWrapper&) = delete;
 
+    bool readCachedAngles(float* dest);
+    bool updateUi();
+
     rb::Arm* m_arm;
     std::vector<rb::Angle> m_bone_trims;
+
+    gridui::Arm m_ui;
+    std::vector<float> m_ui_angles;
+    uint16_t m_ui_timer;
 };
 
 }; // namespace rk
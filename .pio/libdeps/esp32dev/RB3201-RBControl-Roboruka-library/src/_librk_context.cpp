@@ -7,6 +7,7 @@
 #include "rbwebserver.h"
 #include "rbwifi.h"
 #include <stdio.h>
+#include <string.h>
 
 #include "_librk_context.h"
 
@@ -19,8 +20,22 @@ namespace rk {
 
 Context gCtx;
 
+// Stored in NVS as "linecal". Older versions stored the bare CalibrationData, which is still accepted.
+struct LineCalibrationBlob {
+    static constexpr uint16_t MAGIC = 0x4C43; // "LC"
+    static constexpr uint8_t VERSION = 1;
+
+    uint16_t magic;
+    uint8_t version;
+    uint8_t channels;
+    LineSensor::CalibrationData data;
+} __attribute__((packed));
+
 Context::Context() {
     m_prot = nullptr;
+    m_line_sample_rate_hz = 0;
+    m_line_events = nullptr;
+    m_line_ready = false;
 }
 
 Context::~Context() {
@@ -52,6 +67,7 @@ void Context::setup(const rkConfig& cfg) {
     m_line_cfg.pin_mosi = (gpio_num_t)cfg.pins.line_mosi;
     m_line_cfg.pin_miso = (gpio_num_t)cfg.pins.line_miso;
     m_line_cfg.pin_sck = (gpio_num_t)cfg.pins.line_sck;
+    m_line_sample_rate_hz = cfg.line_sample_rate_hz;
 
     // Set the battery measurement coeficient
     auto& batt = man.battery();
@@ -75,6 +91,7 @@ void Context::setup(const rkConfig& cfg) {
         using namespace std::placeholders;
         m_prot = new Protocol(cfg.owner, cfg.name, "Compiled at " __DATE__ " " __TIME__,
             std::bind(&Context::handleRbcontrollerMessage, this, _1, _2));
+        UI.addHotJoystick(m_prot);
         m_prot->start();
 
         UI.begin(m_prot);
@@ -105,9 +122,49 @@ LineSensor& Context::line() {
         m_line.setCalibration(data);
     }
 
+    if (m_line_sample_rate_hz != 0) {
+        res = m_line.startSampling(m_line_sample_rate_hz);
+        if (res != ESP_OK) {
+            ESP_LOGE(TAG, "failed to start linesensor sampling: %d!", res);
+        }
+    }
+
+    m_line_ready = true;
     return m_line;
 }
 
+LineSensor* Context::lineIfInstalled() {
+    return m_line_ready ? &m_line : nullptr;
+}
+
+bool Context::startLineEvents(bool white_line, float threshold, uint16_t debounce_ms) {
+    static_assert(int(RK_LINE_RIGHT_BRANCH) == int(LineEvent::RIGHT_BRANCH), "rkLineEventType has to match mcp3008::LineEvent");
+
+    if (m_line_events == nullptr) {
+        m_line_events = xQueueCreate(16, sizeof(rkLineEvent));
+    } else {
+        xQueueReset(m_line_events);
+    }
+
+    const auto res = line().startEventDetection([this](const LineEvent& ev) {
+        const rkLineEvent rkev = { rkLineEventType(ev.type), ev.timestamp_us };
+        xQueueSend(m_line_events, &rkev, 0);
+    },
+        white_line, threshold, debounce_ms);
+
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "failed to start line event detection, is rkConfig.line_sample_rate_hz set?");
+        return false;
+    }
+    return true;
+}
+
+bool Context::waitForLineEvent(rkLineEvent& ev, uint32_t timeout_ms) {
+    if (m_line_events == nullptr)
+        return false;
+    return xQueueReceive(m_line_events, &ev, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+}
+
 bool Context::loadLineCalibration(LineSensor::CalibrationData& data) {
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -133,21 +190,40 @@ bool Context::loadLineCalibration(LineSensor::CalibrationData& data) {
         return false;
     }
 
-    size_t size = sizeof(data);
-    ret = nvs_get_blob(nvs_ns, "linecal", &data, &size);
-    nvs_commit(nvs_ns);
+    LineCalibrationBlob blob;
+    size_t size = sizeof(blob);
+    ret = nvs_get_blob(nvs_ns, "linecal", &blob, &size);
     nvs_close(nvs_ns);
 
-    if (ret == ESP_OK) {
+    if (ret != ESP_OK) {
+        if (ret != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "failed to nvs_get_blob: %d", ret);
+        }
+        return false;
+    }
+
+    if (size == sizeof(data)) {
+        memcpy(&data, &blob, sizeof(data));
         return true;
-    } else if (ret != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "failed to nvs_get_blob: %d", ret);
     }
-    return false;
+
+    if (size != sizeof(blob) || blob.magic != LineCalibrationBlob::MAGIC
+        || blob.version != LineCalibrationBlob::VERSION || blob.channels != Driver::CHANNELS) {
+        ESP_LOGE(TAG, "unknown line calibration format in NVS (size %d, version %d), ignoring it.",
+            (int)size, size >= 3 ? blob.version : -1);
+        return false;
+    }
+
+    data = blob.data;
+    return true;
 }
 
 void Context::saveLineCalibration() {
-    const auto& data = m_line.getCalibration();
+    LineCalibrationBlob blob;
+    blob.magic = LineCalibrationBlob::MAGIC;
+    blob.version = LineCalibrationBlob::VERSION;
+    blob.channels = Driver::CHANNELS;
+    blob.data = m_line.getCalibration();
 
     nvs_handle nvs_ns;
     esp_err_t ret = nvs_open("roboruka", NVS_READWRITE, &nvs_ns);
@@ -156,7 +232,9 @@ void Context::saveLineCalibration() {
         return;
     }
 
-    ret = nvs_set_blob(nvs_ns, "linecal", &data, sizeof(data));
+    ret = nvs_set_blob(nvs_ns, "linecal", &blob, sizeof(blob));
+    if (ret == ESP_OK)
+        ret = nvs_commit(nvs_ns);
     nvs_close(nvs_ns);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "failed to nvs_set_blob: %d", ret);
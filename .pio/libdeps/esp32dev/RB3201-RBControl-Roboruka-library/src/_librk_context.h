@@ -2,12 +2,18 @@
 
 #include <atomic>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
 #include "RBControl_arm.hpp"
 
 #include "mcp3008_linesensor.h"
 
 #include "_librk_arm.h"
+#include "_librk_line_follower.h"
+#include "_librk_line_recorder.h"
 #include "_librk_motors.h"
+#include "_librk_telemetry.h"
 #include "_librk_wifi.h"
 
 namespace rk {
@@ -23,9 +29,16 @@ public:
     ArmWrapper& arm() { return m_arm; }
     Motors& motors() { return m_motors; }
     mcp3008::LineSensor& line();
+    mcp3008::LineSensor* lineIfInstalled(); //!< Unlike line(), doesn't install the sensor, returns NULL if it isn't yet
+    LineFollower& lineFollower() { return m_line_follower; }
+    LineRecorder& lineRecorder() { return m_line_recorder; }
+    Telemetry& telemetry() { return m_telemetry; }
 
     void saveLineCalibration();
 
+    bool startLineEvents(bool white_line, float threshold, uint16_t debounce_ms);
+    bool waitForLineEvent(rkLineEvent& ev, uint32_t timeout_ms);
+
 private:
     void handleRbcontrollerMessage(const std::string& cmd, rbjson::Object* pkt);
     bool loadLineCalibration(mcp3008::LineSensor::CalibrationData& data);
@@ -38,8 +51,14 @@ private:
     std::atomic<bool> m_initialized;
 
     std::atomic<bool> m_line_installed;
+    std::atomic<bool> m_line_ready; //!< Set once line() has finished installing the sensor
     mcp3008::Driver::Config m_line_cfg;
+    uint16_t m_line_sample_rate_hz;
     mcp3008::LineSensor m_line;
+    QueueHandle_t m_line_events;
+    LineFollower m_line_follower;
+    LineRecorder m_line_recorder;
+    Telemetry m_telemetry;
 };
 
 extern Context gCtx;
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+namespace rk {
+
+/**
+ * \brief The line following regulator: PID on the line position plus the lost-line handling.
+ *
+ * It has no dependencies on the hardware or FreeRTOS, so it can be driven
+ * by a simulated track on the host. LineFollower runs it in its own task.
+ */
+class LineController {
+public:
+    enum LostStrategy : uint8_t {
+        LOST_STOP, //!< Stop the motors until the line is found again
+        LOST_KEEP, //!< Keep the last motor powers
+        LOST_SEARCH, //!< Spin towards the side where the line was seen last
+    };
+
+    LineController()
+        : m_kp(0)
+        , m_ki(0)
+        , m_kd(0)
+        , m_base_speed(0)
+        , m_lost_strategy(LOST_STOP)
+        , m_lost_speed(0)
+        , m_lost_timeout_us(0) {
+        reset();
+    }
+
+    void setGains(float kp, float ki, float kd) {
+        m_kp = kp;
+        m_ki = ki;
+        m_kd = kd;
+        if (m_ki == 0.f)
+            m_integral = 0.f;
+    }
+
+    void setSpeed(int8_t base_speed) { m_base_speed = base_speed; }
+
+    void setLostStrategy(LostStrategy strategy, int8_t speed, uint32_t timeout_us) {
+        m_lost_strategy = strategy;
+        m_lost_speed = speed;
+        m_lost_timeout_us = timeout_us;
+    }
+
+    float kp() const { return m_kp; }
+    float ki() const { return m_ki; }
+    float kd() const { return m_kd; }
+    int8_t speed() const { return m_base_speed; }
+
+    void reset() {
+        m_integral = 0.f;
+        m_prev_error = 0.f;
+        m_has_prev = false;
+        m_last_seen_side = 0.f;
+        m_lost_us = 0;
+        m_left = 0;
+        m_right = 0;
+    }
+
+    /**
+     * \brief Compute new motor powers.
+     *
+     * \param position line position from LineSensor::readLine(), <-1; 1> or NaN if not found.
+     *        Positive values mean the line is on the right, so the robot turns right.
+     * \param dt_us time since the previous step
+     * \param left output power of the left motor, <-100; 100>
+     * \param right output power of the right motor, <-100; 100>
+     * \return false if the line was lost for longer than the lost timeout (the motors are stopped).
+     */
+    bool step(float position, uint32_t dt_us, int8_t& left, int8_t& right) {
+        if (isnan(position)) {
+            m_has_prev = false;
+            m_lost_us += dt_us;
+            if (m_lost_timeout_us != 0 && m_lost_us >= m_lost_timeout_us) {
+                m_left = m_right = 0;
+            } else {
+                switch (m_lost_strategy) {
+                case LOST_STOP:
+                    m_left = m_right = 0;
+                    break;
+                case LOST_KEEP:
+                    break;
+                case LOST_SEARCH:
+                    m_left = m_last_seen_side >= 0.f ? m_lost_speed : -m_lost_speed;
+                    m_right = -m_left;
+                    break;
+                }
+            }
+            left = m_left;
+            right = m_right;
+            return m_lost_timeout_us == 0 || m_lost_us < m_lost_timeout_us;
+        }
+
+        m_lost_us = 0;
+        if (position != 0.f)
+            m_last_seen_side = position;
+
+        const float dt = float(dt_us) / 1000000.f;
+        float out = m_kp * position;
+
+        if (m_ki != 0.f && dt > 0.f) {
+            // Anti-windup: the integral term alone never exceeds full power.
+            const float limit = 100.f / fabsf(m_ki);
+            m_integral = std::min(limit, std::max(-limit, m_integral + position * dt));
+            out += m_ki * m_integral;
+        }
+
+        if (m_has_prev && dt > 0.f) {
+            out += m_kd * (position - m_prev_error) / dt;
+        }
+        m_prev_error = position;
+        m_has_prev = true;
+
+        m_left = clampPower(int32_t(m_base_speed) + int32_t(out));
+        m_right = clampPower(int32_t(m_base_speed) - int32_t(out));
+        left = m_left;
+        right = m_right;
+        return true;
+    }
+
+private:
+    static int8_t clampPower(int32_t val) {
+        return std::min(int32_t(100), std::max(int32_t(-100), val));
+    }
+
+    float m_kp, m_ki, m_kd;
+    int8_t m_base_speed;
+
+    LostStrategy m_lost_strategy;
+    int8_t m_lost_speed;
+    uint32_t m_lost_timeout_us;
+
+    float m_integral;
+    float m_prev_error;
+    bool m_has_prev;
+    float m_last_seen_side;
+    uint32_t m_lost_us;
+    int8_t m_left, m_right;
+};
+
+}; // namespace rk
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "_librk_context.h"
+#include "_librk_line_follower.h"
+
+#define TAG "roboruka"
+
+namespace rk {
+
+LineFollower::LineFollower()
+    : m_period_sum_us(0)
+    , m_error_sum(0)
+    , m_running(false)
+    , m_stop_requested(false) {
+    resetStatsLocked();
+}
+
+LineFollower::~LineFollower() {
+    stop();
+}
+
+bool LineFollower::start(const rkLineFollowConfig& cfg) {
+    if (m_running) {
+        ESP_LOGE(TAG, "line following is already running!");
+        return false;
+    }
+
+    if (cfg.period_ms == 0) {
+        ESP_LOGE(TAG, "invalid line following period_ms 0!");
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(m_mutex);
+        m_cfg = cfg;
+        m_controller.reset();
+        m_controller.setGains(cfg.kp, cfg.ki, cfg.kd);
+        m_controller.setSpeed(cfg.base_speed);
+        m_controller.setLostStrategy(LineController::LostStrategy(cfg.lost_strategy),
+            cfg.lost_speed, cfg.lost_timeout_ms * 1000);
+        resetStatsLocked();
+    }
+
+    gCtx.lineRecorder().setWhiteLine(cfg.white_line);
+    m_stop_requested = false;
+    m_running = true;
+    if (xTaskCreate(&LineFollower::taskTrampoline, "rk_linefollow", 3072, this, 5, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "failed to create line following task!");
+        m_running = false;
+        return false;
+    }
+    return true;
+}
+
+void LineFollower::stop() {
+    if (!m_running)
+        return;
+
+    m_stop_requested = true;
+    while (m_running) {
+        vTaskDelay(1);
+    }
+}
+
+void LineFollower::setGains(float kp, float ki, float kd) {
+    std::lock_guard<std::mutex> l(m_mutex);
+    m_cfg.kp = kp;
+    m_cfg.ki = ki;
+    m_cfg.kd = kd;
+    m_controller.setGains(kp, ki, kd);
+}
+
+void LineFollower::setSpeed(int8_t base_speed) {
+    std::lock_guard<std::mutex> l(m_mutex);
+    m_cfg.base_speed = base_speed;
+    m_controller.setSpeed(base_speed);
+}
+
+rkLineFollowStats LineFollower::stats(bool reset) {
+    std::lock_guard<std::mutex> l(m_mutex);
+    rkLineFollowStats res = m_stats;
+    if (res.iterations > 1) {
+        res.period_avg_us = m_period_sum_us / (res.iterations - 1);
+    }
+    if (res.iterations > res.lost_iterations) {
+        res.error_avg_abs = float(m_error_sum) / (res.iterations - res.lost_iterations) / 1000.f;
+    }
+    if (reset)
+        resetStatsLocked();
+    return res;
+}
+
+void LineFollower::resetStatsLocked() {
+    m_stats = rkLineFollowStats();
+    m_period_sum_us = 0;
+    m_error_sum = 0;
+}
+
+void LineFollower::taskTrampoline(void* self) {
+    ((LineFollower*)self)->task();
+}
+
+void LineFollower::task() {
+    auto& line = gCtx.line();
+    auto& motors = gCtx.motors();
+    auto& recorder = gCtx.lineRecorder();
+    const size_t channels = line.getChannelsCount();
+
+    const bool white_line = m_cfg.white_line;
+    const float threshold = float(m_cfg.line_threshold_pct) / 100.f;
+    const TickType_t period = std::max(TickType_t(1), TickType_t(pdMS_TO_TICKS(m_cfg.period_ms)));
+    TickType_t last_wake = xTaskGetTickCount();
+    int64_t last_us = esp_timer_get_time();
+
+    int8_t left = 0, right = 0;
+    while (!m_stop_requested) {
+        const int64_t now = esp_timer_get_time();
+        const uint32_t dt_us = now - last_us;
+        last_us = now;
+
+        // Read the raw values, so that they can be recorded for replay.
+        float pos = nanf("");
+        uint16_t raw[mcp3008::Driver::CHANNELS];
+        const bool read_ok = line.read(raw) == ESP_OK;
+        if (read_ok) {
+            uint16_t vals[mcp3008::Driver::CHANNELS];
+            memcpy(vals, raw, sizeof(vals));
+            line.calibrate(vals);
+            pos = mcp3008::LineMath::estimateLine(line.getLineEstimator(), vals, channels, white_line, threshold);
+        }
+
+        bool following;
+        {
+            std::lock_guard<std::mutex> l(m_mutex);
+            following = m_controller.step(pos, dt_us, left, right);
+
+            auto& st = m_stats;
+            if (st.iterations != 0) {
+                m_period_sum_us += dt_us;
+                st.period_min_us = st.iterations == 1 ? dt_us : std::min(st.period_min_us, dt_us);
+                st.period_max_us = std::max(st.period_max_us, dt_us);
+            }
+            ++st.iterations;
+            if (isnan(pos)) {
+                ++st.lost_iterations;
+            } else {
+                const float err = fabsf(pos);
+                m_error_sum += uint32_t(err * 1000.f);
+                st.error_max_abs = std::max(st.error_max_abs, err);
+            }
+        }
+
+        motors.set(left, right);
+
+        if (read_ok && recorder.isRecording())
+            recorder.record(raw, left, right);
+
+        if (!following) {
+            ESP_LOGW(TAG, "line lost for too long, line following stopped.");
+            break;
+        }
+
+        vTaskDelayUntil(&last_wake, period);
+    }
+
+    motors.set(0, 0);
+    m_running = false;
+    vTaskDelete(nullptr);
+}
+
+}; // namespace rk
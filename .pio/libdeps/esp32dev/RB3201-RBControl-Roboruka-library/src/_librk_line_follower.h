@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "_librk_line_controller.h"
+#include "roboruka.h"
+
+namespace rk {
+
+class LineFollower {
+public:
+    LineFollower();
+    ~LineFollower();
+
+    bool start(const rkLineFollowConfig& cfg);
+    void stop();
+    bool isRunning() const { return m_running; }
+
+    void setGains(float kp, float ki, float kd);
+    void setSpeed(int8_t base_speed);
+
+    rkLineFollowStats stats(bool reset);
+
+private:
+    LineFollower(const LineFollower&) = delete;
+
+    static void taskTrampoline(void* self);
+    void task();
+
+    void resetStatsLocked();
+
+    std::mutex m_mutex;
+    LineController m_controller;
+    rkLineFollowConfig m_cfg;
+    rkLineFollowStats m_stats;
+    uint64_t m_period_sum_us;
+    uint64_t m_error_sum;
+
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_stop_requested;
+};
+
+}; // namespace rk
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace rk {
+
+// The line recording file format, shared by LineRecorder and tools/line_replay.cpp,
+// so it must not depend on anything ESP32 specific.
+// Little endian, LineRecordHeader followed by LineRecordHeader::count LineRecordEntry items.
+
+static constexpr int LINE_RECORD_CHANNELS = 8; //!< Same as mcp3008::Driver::CHANNELS
+
+struct LineRecordHeader {
+    static constexpr uint32_t MAGIC = 0x524C4B52; // "RKLR"
+    static constexpr uint8_t VERSION = 1;
+
+    uint32_t magic;
+    uint8_t version;
+    uint8_t channels; //!< How many values in each entry are valid
+    uint8_t white_line;
+    uint8_t estimator; //!< mcp3008::LineMath::LineEstimator used while recording
+    uint16_t cal_min[LINE_RECORD_CHANNELS]; //!< Calibration for each valid value, see mcp3008::LineSensor::CalibrationData
+    uint16_t cal_range[LINE_RECORD_CHANNELS];
+    uint32_t count;
+} __attribute__((packed));
+
+struct LineRecordEntry {
+    uint32_t time_us; //!< Time since the start of the recording
+    uint16_t raw[LINE_RECORD_CHANNELS]; //!< Uncalibrated values, as returned by mcp3008::Driver::read()
+    int8_t left; //!< Motor powers set after this frame was processed
+    int8_t right;
+} __attribute__((packed));
+
+}; // namespace rk
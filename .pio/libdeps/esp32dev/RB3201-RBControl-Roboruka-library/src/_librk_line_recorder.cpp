@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "rbprotocol.h"
+
+#include "_librk_line_recorder.h"
+
+#define TAG "roboruka"
+
+using namespace mcp3008;
+
+namespace rk {
+
+static_assert(LINE_RECORD_CHANNELS == Driver::CHANNELS, "the line recording format has to match the driver");
+
+LineRecorder::LineRecorder()
+    : m_head(0)
+    , m_count(0)
+    , m_start_us(0)
+    , m_recording(false)
+    , m_white_line(false) {
+}
+
+LineRecorder::~LineRecorder() {
+}
+
+bool LineRecorder::start(size_t capacity) {
+    if (capacity == 0)
+        return false;
+
+    std::lock_guard<std::mutex> l(m_mutex);
+    m_entries.clear();
+    m_entries.shrink_to_fit();
+    m_entries.resize(capacity);
+    m_head = 0;
+    m_count = 0;
+    m_start_us = esp_timer_get_time();
+    m_recording = true;
+    return true;
+}
+
+void LineRecorder::stop() {
+    std::lock_guard<std::mutex> l(m_mutex);
+    m_recording = false;
+}
+
+void LineRecorder::record(const uint16_t* raw, int8_t left, int8_t right) {
+    std::lock_guard<std::mutex> l(m_mutex);
+    if (!m_recording)
+        return;
+
+    auto& e = m_entries[m_head];
+    e.time_us = esp_timer_get_time() - m_start_us;
+    memcpy(e.raw, raw, sizeof(e.raw));
+    e.left = left;
+    e.right = right;
+
+    m_head = (m_head + 1) % m_entries.size();
+    if (m_count < m_entries.size())
+        ++m_count;
+}
+
+size_t LineRecorder::size() const {
+    std::lock_guard<std::mutex> l(m_mutex);
+    return m_count;
+}
+
+void LineRecorder::fillHeader(FileHeader& hdr, const LineSensor& line) const {
+    const auto& cal = line.getCalibration();
+
+    hdr.magic = FileHeader::MAGIC;
+    hdr.version = FileHeader::VERSION;
+    hdr.channels = line.getChannelsCount();
+    hdr.white_line = m_white_line;
+    hdr.estimator = line.getLineEstimator();
+    hdr.count = m_count;
+
+    // Entry::raw is packed the same way as Driver::read() output.
+    int idx = 0;
+    for (int i = 0; i < Driver::CHANNELS; ++i) {
+        if ((line.getChannelsMask() & (1 << i)) == 0)
+            continue;
+        hdr.cal_min[idx] = cal.min[i];
+        hdr.cal_range[idx] = cal.range[i];
+        ++idx;
+    }
+    for (; idx < Driver::CHANNELS; ++idx) {
+        hdr.cal_min[idx] = 0;
+        hdr.cal_range[idx] = Driver::MAX_VAL;
+    }
+}
+
+void LineRecorder::snapshot(FileHeader& hdr, std::vector<Entry>& entries, const LineSensor& line) const {
+    std::lock_guard<std::mutex> l(m_mutex);
+    fillHeader(hdr, line);
+
+    entries.clear();
+    entries.reserve(m_count);
+    const size_t capacity = m_entries.size();
+    const size_t first = (m_head + capacity - m_count) % std::max(size_t(1), capacity);
+    for (size_t i = 0; i < m_count; ++i) {
+        entries.push_back(m_entries[(first + i) % capacity]);
+    }
+}
+
+bool LineRecorder::save(const char* path, const LineSensor& line) {
+    // Copy it out, so that the recording is not blocked while this is being written.
+    FileHeader hdr;
+    std::vector<Entry> entries;
+    snapshot(hdr, entries, line);
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "failed to open %s for writing!", path);
+        return false;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    if (ok && !entries.empty())
+        ok = fwrite(entries.data(), sizeof(Entry), entries.size(), f) == entries.size();
+
+    fclose(f);
+    if (!ok) {
+        ESP_LOGE(TAG, "failed to write the line recording to %s!", path);
+    }
+    return ok;
+}
+
+bool LineRecorder::send(rb::Protocol& prot, const LineSensor& line) {
+    constexpr size_t CHUNK = 16;
+
+    FileHeader hdr;
+    std::vector<Entry> entries;
+    snapshot(hdr, entries, line);
+
+    // A dropped chunk would leave a hole in the recording, so the upload stops there.
+    auto waitFor = [&](uint32_t id) -> bool {
+        auto state = prot.mustarrive_state(id);
+        for (int i = 0; i < 300 && state == rb::Protocol::MUSTARRIVE_PENDING; ++i) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+            state = prot.mustarrive_state(id);
+        }
+        return state == rb::Protocol::MUSTARRIVE_DELIVERED;
+    };
+
+    auto* info = new rbjson::Object();
+    info->set("count", hdr.count);
+    info->set("channels", hdr.channels);
+    info->set("white_line", hdr.white_line);
+    info->set("estimator", hdr.estimator);
+    auto* cal_min = new rbjson::Array();
+    auto* cal_range = new rbjson::Array();
+    for (int i = 0; i < hdr.channels; ++i) {
+        cal_min->push_back(new rbjson::Number(hdr.cal_min[i]));
+        cal_range->push_back(new rbjson::Number(hdr.cal_range[i]));
+    }
+    info->set("cal_min", cal_min);
+    info->set("cal_range", cal_range);
+    if (!waitFor(prot.send_mustarrive("linerec_start", info))) {
+        ESP_LOGE(TAG, "failed to send the line recording header!");
+        return false;
+    }
+
+    // Each entry is an array [ time_us, left, right, raw values... ]
+    for (size_t off = 0; off < entries.size(); off += CHUNK) {
+        auto* chunk = new rbjson::Object();
+        auto* data = new rbjson::Array();
+        chunk->set("i", off);
+        for (size_t i = off; i < std::min(off + CHUNK, entries.size()); ++i) {
+            const auto& e = entries[i];
+            auto* row = new rbjson::Array();
+            row->push_back(new rbjson::Number(e.time_us));
+            row->push_back(new rbjson::Number(e.left));
+            row->push_back(new rbjson::Number(e.right));
+            for (int c = 0; c < hdr.channels; ++c)
+                row->push_back(new rbjson::Number(e.raw[c]));
+            data->push_back(row);
+        }
+        chunk->set("d", data);
+
+        if (!waitFor(prot.send_mustarrive("linerec", chunk))) {
+            ESP_LOGE(TAG, "failed to send the line recording at entry %d!", (int)off);
+            return false;
+        }
+    }
+    return true;
+}
+
+}; // namespace rk
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "mcp3008_linesensor.h"
+
+#include "_librk_line_record.h"
+
+namespace rb {
+class Protocol;
+};
+
+namespace rk {
+
+/**
+ * \brief Records raw line sensor frames and motor commands into a RAM ring buffer.
+ *
+ * The recording can be saved to a file (on SPIFFS, so it can be downloaded from
+ * the robot's web server) or sent over RBProtocol, and then replayed on a PC
+ * with tools/line_replay.cpp.
+ *
+ * See _librk_line_record.h for the file format.
+ */
+class LineRecorder {
+public:
+    typedef LineRecordHeader FileHeader;
+    typedef LineRecordEntry Entry;
+
+    LineRecorder();
+    ~LineRecorder();
+
+    bool start(size_t capacity);
+    void stop();
+    bool isRecording() const { return m_recording; }
+
+    void setWhiteLine(bool white_line) { m_white_line = white_line; }
+
+    /**
+     * \brief Add a frame, overwriting the oldest one if the buffer is full.
+     */
+    void record(const uint16_t* raw, int8_t left, int8_t right);
+
+    size_t size() const;
+
+    bool save(const char* path, const mcp3008::LineSensor& line);
+    bool send(rb::Protocol& prot, const mcp3008::LineSensor& line);
+
+private:
+    LineRecorder(const LineRecorder&) = delete;
+
+    void fillHeader(FileHeader& hdr, const mcp3008::LineSensor& line) const;
+    void snapshot(FileHeader& hdr, std::vector<Entry>& entries, const mcp3008::LineSensor& line) const;
+
+    mutable std::mutex m_mutex;
+    std::vector<Entry> m_entries;
+    size_t m_head;
+    size_t m_count;
+    int64_t m_start_us;
+    std::atomic<bool> m_recording;
+    bool m_white_line;
+};
+
+}; // namespace rk
@@ -5,7 +5,9 @@ namespace rk {
 
 Motors::Motors()
     : m_id_left(rb::MotorId::M1)
-    , m_id_right(rb::MotorId::M1) {
+    , m_id_right(rb::MotorId::M1)
+    , m_power_left(0)
+    , m_power_right(0) {
 }
 
 Motors::~Motors() {
@@ -22,6 +24,9 @@ void Motors::setup(const rkConfig& cfg) {
 }
 
 void Motors::set(int8_t left, int8_t right) {
+    m_power_left = left;
+    m_power_right = right;
+
     if (m_polarity_switch_left)
         left = -left;
     if (m_polarity_switch_right)
@@ -31,6 +36,9 @@ void Motors::set(int8_t left, int8_t right) {
 }
 
 void Motors::set(int8_t left, int8_t right, uint8_t power_left, uint8_t power_right) {
+    m_power_left = left;
+    m_power_right = right;
+
     if (m_polarity_switch_left)
         left = -left;
     if (m_polarity_switch_right)
@@ -40,6 +48,11 @@ void Motors::set(int8_t left, int8_t right, uint8_t power_left, uint8_t power_ri
 }
 
 void Motors::setById(rb::MotorId id, int8_t power) {
+    if (id == m_id_left)
+        m_power_left = power;
+    if (id == m_id_right)
+        m_power_right = power;
+
     if ((m_polarity_switch_left && id == m_id_left) || (m_polarity_switch_right && id == m_id_right))
         power = - power;
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <stdint.h>
 
 #include "RBControl_pinout.hpp"
@@ -22,6 +23,10 @@ public:
     rb::MotorId idLeft() const { return m_id_left; }
     rb::MotorId idRight() const { return m_id_right; }
 
+    // The last powers set through this class, before the polarity switch.
+    int8_t powerLeft() const { return m_power_left; }
+    int8_t powerRight() const { return m_power_right; }
+
 private:
     Motors(const Motors&) = delete;
 
@@ -31,6 +36,8 @@ private:
     rb::MotorId m_id_right;
     bool m_polarity_switch_left;
     bool m_polarity_switch_right;
+    std::atomic<int8_t> m_power_left;
+    std::atomic<int8_t> m_power_right;
 };
 
 }; // namespace rk
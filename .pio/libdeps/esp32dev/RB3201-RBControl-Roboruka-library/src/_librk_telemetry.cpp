@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "RBControl_manager.hpp"
+#include "rbprotocol.h"
+
+#include "_librk_context.h"
+#include "_librk_telemetry.h"
+
+#define TAG "roboruka"
+
+namespace rk {
+
+static_assert(TELEMETRY_LINE_CHANNELS == mcp3008::Driver::CHANNELS, "the telemetry format has to match the driver");
+static_assert(TELEMETRY_FRAME_MAX + 1 <= RBPROTOCOL_SEND_SLOT_SIZE, "the telemetry frame has to fit into one send slot");
+
+Telemetry::Telemetry()
+    : m_prot(nullptr)
+    , m_channels(0)
+    , m_period_ms(0)
+    , m_seq(0)
+    , m_sent(0)
+    , m_skipped(0)
+    , m_running(false)
+    , m_stop_requested(false) {
+}
+
+Telemetry::~Telemetry() {
+    stop();
+}
+
+bool Telemetry::start(rb::Protocol* prot, uint16_t channels, uint16_t rate_hz) {
+    if (m_running) {
+        ESP_LOGE(TAG, "telemetry is already running!");
+        return false;
+    }
+
+    if (prot == nullptr) {
+        ESP_LOGE(TAG, "telemetry needs the RBControl app communication, set rkConfig.rbcontroller_app_enable!");
+        return false;
+    }
+
+    if (rate_hz == 0 || rate_hz > 1000) {
+        ESP_LOGE(TAG, "invalid telemetry rate_hz %d!", (int)rate_hz);
+        return false;
+    }
+
+    m_prot = prot;
+    m_channels = channels & ((1 << TELEMETRY_CHANNEL_COUNT) - 1);
+    m_period_ms = 1000 / rate_hz;
+    m_seq = 0;
+    m_sent = 0;
+    m_skipped = 0;
+
+    m_stop_requested = false;
+    m_running = true;
+    if (xTaskCreate(&Telemetry::taskTrampoline, "rk_telemetry", 3072, this, 2, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "failed to create telemetry task!");
+        m_running = false;
+        return false;
+    }
+    return true;
+}
+
+void Telemetry::stop() {
+    if (!m_running)
+        return;
+
+    m_stop_requested = true;
+    while (m_running) {
+        vTaskDelay(1);
+    }
+}
+
+void Telemetry::taskTrampoline(void* self) {
+    ((Telemetry*)self)->task();
+}
+
+void Telemetry::task() {
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+
+    const TickType_t period = std::max(TickType_t(1), TickType_t(pdMS_TO_TICKS(m_period_ms)));
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (!m_stop_requested) {
+        const size_t size = fillFrame(frame);
+        if (m_prot->send_binary(frame, size)) {
+            ++m_sent;
+        } else {
+            ++m_skipped;
+        }
+        ++m_seq;
+
+        // Don't try to catch up after falling behind, just leave a gap in the sequence numbers.
+        const TickType_t elapsed = xTaskGetTickCount() - last_wake;
+        if (elapsed >= 2 * period) {
+            const uint32_t missed = elapsed / period - 1;
+            last_wake += missed * period;
+            m_seq += missed;
+            m_skipped += missed;
+        }
+
+        vTaskDelayUntil(&last_wake, period);
+    }
+
+    m_running = false;
+    vTaskDelete(nullptr);
+}
+
+size_t Telemetry::fillFrame(uint8_t* frame) {
+    auto& man = rb::Manager::get();
+
+    auto* hdr = (TelemetryFrameHeader*)frame;
+    hdr->magic = TelemetryFrameHeader::MAGIC;
+    hdr->version = TelemetryFrameHeader::VERSION;
+    hdr->flags = 0;
+    hdr->channels = m_channels;
+    hdr->period_ms = m_period_ms;
+    hdr->seq = m_seq;
+    const int64_t now = esp_timer_get_time();
+    hdr->time_us = uint32_t(now);
+    hdr->client_time_us = 0;
+    int64_t client_us;
+    if (m_prot->client_time_us(now, client_us)) {
+        hdr->client_time_us = client_us;
+        hdr->flags |= TELEMETRY_FLAG_CLIENT_TIME;
+    }
+
+    uint8_t* itr = frame + sizeof(TelemetryFrameHeader);
+
+    if (m_channels & TELEMETRY_ENCODERS) {
+        TelemetryEncoders enc;
+        const rb::MotorId ids[2] = { gCtx.motors().idLeft(), gCtx.motors().idRight() };
+        for (int i = 0; i < 2; ++i) {
+            auto* e = man.motor(ids[i]).encoder();
+            enc.count[i] = e->value();
+            enc.speed[i] = e->speed();
+        }
+        memcpy(itr, &enc, sizeof(enc));
+        itr += sizeof(enc);
+    }
+
+    if (m_channels & TELEMETRY_MOTORS) {
+        const TelemetryMotors mot = { { gCtx.motors().powerLeft(), gCtx.motors().powerRight() } };
+        memcpy(itr, &mot, sizeof(mot));
+        itr += sizeof(mot);
+    }
+
+    if (m_channels & TELEMETRY_LINE) {
+        // Only the sample taken by the sampling task. Reading the chip from here would race
+        // with the other tasks using the sensor, and gCtx.line() would install it on robots without one.
+        TelemetryLine line = {};
+        auto* sensor = gCtx.lineIfInstalled();
+        mcp3008::Driver::Frame latest;
+        if (sensor != nullptr && sensor->latestFrame(latest)) {
+            memcpy(line.raw, latest.values, sizeof(line.raw));
+        } else {
+            hdr->flags |= TELEMETRY_FLAG_LINE_MISSING;
+        }
+        memcpy(itr, &line, sizeof(line));
+        itr += sizeof(line);
+    }
+
+    if (m_channels & TELEMETRY_BATTERY) {
+        const TelemetryBattery batt = { uint16_t(std::min(man.battery().voltageMv(), uint32_t(UINT16_MAX))) };
+        memcpy(itr, &batt, sizeof(batt));
+        itr += sizeof(batt);
+    }
+
+    if (m_channels & TELEMETRY_SERVOS) {
+        TelemetryServos servos;
+        auto& bus = man.servoBus();
+        for (int i = 0; i < TELEMETRY_SERVOS_COUNT; ++i) {
+            const auto pos = bus.posOffline(i);
+            servos.pos_decideg[i] = pos.isNaN() ? TELEMETRY_SERVO_UNKNOWN : int16_t(pos.deg() * 10);
+        }
+        memcpy(itr, &servos, sizeof(servos));
+        itr += sizeof(servos);
+    }
+
+    if (m_channels & TELEMETRY_TASKS) {
+        const TelemetryTasks tasks = {
+            esp_get_free_heap_size(),
+            esp_get_minimum_free_heap_size(),
+            uint16_t(uxTaskGetNumberOfTasks()),
+            uint16_t(std::min(uint32_t(m_skipped), uint32_t(UINT16_MAX))),
+        };
+        memcpy(itr, &tasks, sizeof(tasks));
+        itr += sizeof(tasks);
+    }
+
+    return itr - frame;
+}
+
+}; // namespace rk
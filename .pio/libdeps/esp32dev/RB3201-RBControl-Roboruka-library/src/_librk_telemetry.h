@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "_librk_telemetry_frame.h"
+
+namespace rb {
+class Protocol;
+};
+
+namespace rk {
+
+/**
+ * \brief Samples the robot state at a fixed rate and streams it over RBProtocol.
+ *
+ * Each sample is one binary frame, see _librk_telemetry_frame.h, sent with
+ * rb::Protocol::send_binary(), so it is never retransmitted. Frames that can't
+ * be sent are counted and skipped. tools/telemetry_csv.cpp converts the frames to CSV.
+ */
+class Telemetry {
+public:
+    Telemetry();
+    ~Telemetry();
+
+    bool start(rb::Protocol* prot, uint16_t channels, uint16_t rate_hz);
+    void stop();
+    bool isRunning() const { return m_running; }
+
+    uint32_t sent() const { return m_sent; }
+    uint32_t skipped() const { return m_skipped; }
+
+private:
+    Telemetry(const Telemetry&) = delete;
+
+    static void taskTrampoline(void* self);
+    void task();
+
+    size_t fillFrame(uint8_t* frame);
+
+    rb::Protocol* m_prot;
+    uint16_t m_channels;
+    uint16_t m_period_ms;
+    uint32_t m_seq;
+
+    std::atomic<uint32_t> m_sent;
+    std::atomic<uint32_t> m_skipped;
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_stop_requested;
+};
+
+}; // namespace rk
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace rk {
+
+// The telemetry frame format, shared by Telemetry and tools/telemetry_csv.cpp,
+// so it must not depend on anything ESP32 specific.
+// Little endian, TelemetryFrameHeader followed by the payload of each channel
+// set in TelemetryFrameHeader::channels, in the order of the bits.
+// Over RBProtocol, each frame is one datagram prefixed with RBPROTOCOL_BINARY_TAG (0xc1).
+
+enum TelemetryChannel : uint16_t {
+    TELEMETRY_ENCODERS = (1 << 0), //!< TelemetryEncoders
+    TELEMETRY_MOTORS = (1 << 1), //!< TelemetryMotors
+    TELEMETRY_LINE = (1 << 2), //!< TelemetryLine
+    TELEMETRY_BATTERY = (1 << 3), //!< TelemetryBattery
+    TELEMETRY_SERVOS = (1 << 4), //!< TelemetryServos
+    TELEMETRY_TASKS = (1 << 5), //!< TelemetryTasks
+
+    TELEMETRY_CHANNEL_COUNT = 6,
+};
+
+static constexpr int TELEMETRY_LINE_CHANNELS = 8; //!< Same as mcp3008::Driver::CHANNELS
+static constexpr int TELEMETRY_SERVOS_COUNT = 3;
+static constexpr int16_t TELEMETRY_SERVO_UNKNOWN = INT16_MIN;
+
+enum TelemetryFrameFlags : uint8_t {
+    TELEMETRY_FLAG_LINE_MISSING = (1 << 0), //!< TelemetryLine is all zeros, the sensor is not in use or not sampling
+    TELEMETRY_FLAG_CLIENT_TIME = (1 << 1), //!< TelemetryFrameHeader::client_time_us is valid
+};
+
+struct TelemetryFrameHeader {
+    static constexpr uint16_t MAGIC = 0x5452; // "RT"
+    static constexpr uint8_t VERSION = 2;
+
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags; //!< TelemetryFrameFlags
+    uint16_t channels; //!< TelemetryChannel bits of the payloads that follow
+    uint16_t period_ms; //!< Configured sampling period
+    uint32_t seq; //!< Incremented with each sampled frame, gaps mean lost or skipped frames
+    uint32_t time_us; //!< Lower 32 bits of esp_timer_get_time() when the frame was sampled
+    int64_t client_time_us; //!< The same moment in the possessing client's clock, see rb::Protocol::client_time_us().
+        //!< Only with TELEMETRY_FLAG_CLIENT_TIME, once the clocks are synchronized, 0 otherwise.
+} __attribute__((packed));
+
+struct TelemetryEncoders {
+    int32_t count[2]; //!< Left and right, edges since the encoder was installed
+    float speed[2]; //!< Left and right, edges per second
+} __attribute__((packed));
+
+struct TelemetryMotors {
+    int8_t power[2]; //!< Left and right, the last power set by the library, -100 to 100
+} __attribute__((packed));
+
+struct TelemetryLine {
+    uint16_t raw[TELEMETRY_LINE_CHANNELS]; //!< Uncalibrated values of the latest sample, see mcp3008::Driver::latestFrame()
+} __attribute__((packed));
+
+struct TelemetryBattery {
+    uint16_t voltage_mv;
+} __attribute__((packed));
+
+struct TelemetryServos {
+    int16_t pos_decideg[TELEMETRY_SERVOS_COUNT]; //!< Last known positions in tenths of degree or TELEMETRY_SERVO_UNKNOWN
+} __attribute__((packed));
+
+struct TelemetryTasks {
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint16_t task_count;
+    uint16_t skipped; //!< Frames not sent since the start, because the task was late or the send buffers were full
+} __attribute__((packed));
+
+inline size_t telemetryChannelSize(uint16_t channel) {
+    switch (channel) {
+    case TELEMETRY_ENCODERS:
+        return sizeof(TelemetryEncoders);
+    case TELEMETRY_MOTORS:
+        return sizeof(TelemetryMotors);
+    case TELEMETRY_LINE:
+        return sizeof(TelemetryLine);
+    case TELEMETRY_BATTERY:
+        return sizeof(TelemetryBattery);
+    case TELEMETRY_SERVOS:
+        return sizeof(TelemetryServos);
+    case TELEMETRY_TASKS:
+        return sizeof(TelemetryTasks);
+    default:
+        return 0;
+    }
+}
+
+static constexpr size_t TELEMETRY_FRAME_MAX = sizeof(TelemetryFrameHeader) + sizeof(TelemetryEncoders)
+    + sizeof(TelemetryMotors) + sizeof(TelemetryLine) + sizeof(TelemetryBattery) + sizeof(TelemetryServos)
+    + sizeof(TelemetryTasks);
+
+}; // namespace rk
@@ -90,6 +90,10 @@ std::unique_ptr<rbjson::Object> rkArmGetInfo() {
     return gCtx.arm().getInfo();
 }
 
+void rkArmLinkUi(gridui::Arm widget, uint32_t period_ms) {
+    gCtx.arm().linkUi(std::move(widget), period_ms);
+}
+
 float rkBatteryCoef() {
     return Manager::get().battery().fineTuneCoef();
 }
@@ -229,7 +233,9 @@ void rkButtonWaitForRelease(uint8_t id) {
     }
 }
 
-void rkLineCalibrate(float motor_time_coef) {
+// Turns the robot over the line and back, wait(steps) is called for each 20ms step.
+template <typename WaitFn>
+static void driveLineCalibration(float motor_time_coef, WaitFn wait) {
     auto& man = Manager::get();
 
     const auto l = gCtx.motors().idLeft();
@@ -240,33 +246,57 @@ void rkLineCalibrate(float motor_time_coef) {
 
     constexpr int8_t pwr = 40;
 
-    auto cal = gCtx.line().startCalibration();
-
     gCtx.motors().set(-pwr, pwr, 100, 100);
-
-    for (int i = 0; i < 30 * motor_time_coef; ++i) {
-        cal.record();
-        vTaskDelay(pdMS_TO_TICKS(20));
-    }
+    wait(30 * motor_time_coef);
 
     gCtx.motors().set(pwr, -pwr);
-    for (int i = 0; i < 50 * motor_time_coef; ++i) {
-        cal.record();
-        vTaskDelay(pdMS_TO_TICKS(20));
-    }
+    wait(50 * motor_time_coef);
 
     gCtx.motors().set(-pwr, pwr);
-    for (int i = 0; i < 30 * motor_time_coef; ++i) {
-        cal.record();
-        vTaskDelay(pdMS_TO_TICKS(20));
-    }
+    wait(30 * motor_time_coef);
 
     gCtx.motors().set(0, 0, maxleft, maxright);
+}
 
-    cal.save();
+void rkLineCalibrate(float motor_time_coef) {
+    auto& line = gCtx.line();
+
+    // With background sampling, every sample is recorded by the sampling task. If
+    // rkLineCalibrateWhileDriving() is on, its calibrator records them and keeps running.
+    const bool while_driving = line.isAutoCalibrating();
+    if (while_driving || line.startAutoCalibration() == ESP_OK) {
+        driveLineCalibration(motor_time_coef, [](int steps) { vTaskDelay(pdMS_TO_TICKS(20 * steps)); });
+        if (while_driving) {
+            line.applyAutoCalibration();
+        } else {
+            line.stopAutoCalibration(true);
+        }
+    } else {
+        // Otherwise read the sensors every 20ms.
+        auto cal = line.startCalibration();
+        driveLineCalibration(motor_time_coef, [&](int steps) {
+            for (int i = 0; i < steps; ++i) {
+                cal.record();
+                vTaskDelay(pdMS_TO_TICKS(20));
+            }
+        });
+        cal.save();
+    }
     gCtx.saveLineCalibration();
 }
 
+void rkLineCalibrateWhileDriving(bool enable) {
+    auto& line = gCtx.line();
+    if (enable) {
+        if (line.startAutoCalibration() != ESP_OK) {
+            ESP_LOGE(TAG, "rkLineCalibrateWhileDriving needs rkConfig.line_sample_rate_hz to be set!");
+        }
+    } else if (line.isAutoCalibrating()) {
+        line.stopAutoCalibration(true);
+        gCtx.saveLineCalibration();
+    }
+}
+
 void rkLineClearCalibration() {
     LineSensor::CalibrationData cal;
     for (int i = 0; i < Driver::CHANNELS; ++i) {
@@ -284,3 +314,79 @@ uint16_t rkLineGetSensor(uint8_t sensorId) {
 float rkLineGetPosition(bool white_line, uint8_t line_threshold_pct) {
     return gCtx.line().readLine(white_line, float(line_threshold_pct) / 100.f);
 }
+
+bool rkLineFollowStart(const rkLineFollowConfig& cfg) {
+    return gCtx.lineFollower().start(cfg);
+}
+
+void rkLineFollowStop() {
+    gCtx.lineFollower().stop();
+}
+
+bool rkLineFollowIsRunning() {
+    return gCtx.lineFollower().isRunning();
+}
+
+void rkLineFollowSetGains(float kp, float ki, float kd) {
+    gCtx.lineFollower().setGains(kp, ki, kd);
+}
+
+void rkLineFollowSetSpeed(int8_t base_speed) {
+    gCtx.lineFollower().setSpeed(base_speed);
+}
+
+rkLineFollowStats rkLineFollowGetStats(bool reset) {
+    return gCtx.lineFollower().stats(reset);
+}
+
+bool rkLineRecordStart(size_t max_frames) {
+    return gCtx.lineRecorder().start(max_frames);
+}
+
+void rkLineRecordStop() {
+    gCtx.lineRecorder().stop();
+}
+
+void rkLineRecordFrame(int8_t left_motor, int8_t right_motor) {
+    auto& recorder = gCtx.lineRecorder();
+    if (!recorder.isRecording())
+        return;
+
+    uint16_t raw[Driver::CHANNELS];
+    if (gCtx.line().read(raw) == ESP_OK)
+        recorder.record(raw, left_motor, right_motor);
+}
+
+bool rkLineRecordSave(const char* path) {
+    return gCtx.lineRecorder().save(path, gCtx.line());
+}
+
+bool rkLineRecordSend() {
+    auto* prot = gCtx.prot();
+    if (prot == nullptr || !prot->is_possessed()) {
+        ESP_LOGE(TAG, "%s: the app is not connected!", __func__);
+        return false;
+    }
+    return gCtx.lineRecorder().send(*prot, gCtx.line());
+}
+
+bool rkLineEventsStart(bool white_line, uint8_t threshold_pct, uint16_t debounce_ms) {
+    return gCtx.startLineEvents(white_line, float(threshold_pct) / 100.f, debounce_ms);
+}
+
+void rkLineEventsStop() {
+    gCtx.line().stopEventDetection();
+}
+
+bool rkLineEventWait(rkLineEvent& ev, uint32_t timeout_ms) {
+    return gCtx.waitForLineEvent(ev, timeout_ms);
+}
+
+bool rkTelemetryStart(uint16_t channels, uint16_t rate_hz) {
+    static_assert(int(RK_TELEMETRY_TASKS) == int(TELEMETRY_TASKS), "rkTelemetryChannel has to match rk::TelemetryChannel");
+    return gCtx.telemetry().start(gCtx.prot(), channels, rate_hz);
+}
+
+void rkTelemetryStop() {
+    gCtx.telemetry().stop();
+}
@@ -76,7 +76,8 @@ struct rkConfig {
         , motor_polarity_switch_left(false)
         , motor_polarity_switch_right(false)
         , motor_enable_failsafe(false)
-        , arm_bone_trims { 0, 0, 0 } {
+        , arm_bone_trims { 0, 0, 0 }
+        , line_sample_rate_hz(0) {
     }
 
     bool rbcontroller_app_enable; //!< povolit komunikaci s aplikací RBController. Výchozí: `false`
@@ -105,6 +106,10 @@ struct rkConfig {
         //!< Určeno pro korekci nepřesně postavených rukou, kde fyzické postavení ruky
         //!< neodpovídá vypočítanému postavení.
 
+    uint16_t line_sample_rate_hz; //!< Pokud není 0, senzory na čáru se čtou na pozadí s touto frekvencí (např. 2000)
+        //!< a funkce rkLineGetSensor() a rkLineGetPosition() jen vrací poslední naměřené hodnoty,
+        //!< takže nečekají na komunikaci se senzory. Výchozí: `0` (vypnuto)
+
     rkPinsConfig pins; //!< Konfigurace pinů pro periferie, viz rkPinsConfig
 };
 
@@ -260,12 +265,32 @@ float rkArmGetServo(uint8_t id);
  *
  * Tato funkce vrací JSON objekt který obsahuje informace o rozměrech ruky,
  * limitech jejích kloubů a další. Je určena pro předání informací do webového
- * rozhraní v aplikaci RBControl.
+ * rozhraní v aplikaci RBControl, typicky jen jednou při tvorbě widgetu:
+ * `UI.arm(...).info(rkArmGetInfo())`.
+ *
+ * Úhly kloubů se berou z paměti knihovny, funkce tedy nečeká na odpověď serv.
  *
  * \return JSON objekt obsahující informace o ruce.
  */
 std::unique_ptr<rbjson::Object> rkArmGetInfo();
 
+/**
+ * \brief Zobrazovat aktuální polohu ruky v GridUI widgetu Arm.
+ *
+ * Rozměry ruky se do widgetu pošlou jen jednou přes rkArmGetInfo(). Tato funkce
+ * pak každých `period_ms` milisekund zkontroluje úhly kloubů a pošle je do aplikace,
+ * ale jen pokud se změnily. Úhly se berou z paměti knihovny, se servy se kvůli
+ * tomu nekomunikuje.
+ *
+ * Příklad:
+ *
+ *     rkArmLinkUi(UI.arm(1, 1, 10, 8).info(rkArmGetInfo()).finish());
+ *
+ * \param widget widget vytvořený pomocí `UI.arm(...).finish()`
+ * \param period_ms jak často kontrolovat změnu úhlů, v milisekundách. Výchozí: 100
+ */
+void rkArmLinkUi(gridui::Arm widget, uint32_t period_ms = 100);
+
 /**@}*/
 /**
  * \defgroup battery Baterie
@@ -406,11 +431,24 @@ void rkButtonWaitForRelease(uint8_t id);
  * Kalibrační hodnoty se ukládají do paměti, kalibraci je třeba dělat pouze když
  * je ruka přesunuta na jiný podklad.
  *
+ * Pokud je zapnuté rkLineCalibrateWhileDriving(), použije se jeho kalibrace a běží dál.
+ *
  * \param motor_time_coef tento koeficient změní jak dlouho se roboto otáčí, změňte pokud se vaše ruka
  *                        neotočí tak, že senzory projedou všechny nad čárou.
  */
 void rkLineCalibrate(float motor_time_coef = 1.0);
 
+/**
+ * \brief Dolaďovat kalibraci senzorů na čáru za jízdy.
+ *
+ * Funguje jen s nastaveným rkConfig.line_sample_rate_hz. Po zapnutí se každé měření
+ * senzorů zaznamenává do kalibrace, po vypnutí se nová kalibrace použije a uloží do paměti.
+ * Senzory, které za tu dobu neviděly čáru i okolí, si ponechají předchozí kalibraci.
+ *
+ * \param enable true pro zapnutí, false pro vypnutí a uložení kalibrace
+ */
+void rkLineCalibrateWhileDriving(bool enable);
+
 /**
  * \brief Vymazat kalibraci
  *
@@ -438,6 +476,257 @@ uint16_t rkLineGetSensor(uint8_t sensorId);
  */
 float rkLineGetPosition(bool white_line = false, uint8_t line_threshold_pct = 25);
 
+/**
+ * \brief Typ události na čáře, viz rkLineEventWait().
+ */
+enum rkLineEventType {
+    RK_LINE_FOUND, //!< Čára se objevila pod senzory
+    RK_LINE_LOST, //!< Čára utekla ze senzorů do strany
+    RK_LINE_END, //!< Čára skončila, když byla uprostřed senzorů
+    RK_LINE_CROSSING, //!< Křižovatka - všechny senzory jsou na čáře
+    RK_LINE_LEFT_BRANCH, //!< Odbočka doleva
+    RK_LINE_RIGHT_BRANCH, //!< Odbočka doprava
+};
+
+/**
+ * \brief Událost na čáře
+ */
+struct rkLineEvent {
+    rkLineEventType type; //!< Typ události
+    int64_t timestamp_us; //!< Kdy se událost stala, v mikrosekundách od startu (jako esp_timer_get_time())
+};
+
+/**
+ * \brief Začít hledat na čáře křižovatky, odbočky a konce.
+ *
+ * Funguje jen s nastaveným rkConfig.line_sample_rate_hz, protože zpracovává každé měření
+ * senzorů na pozadí. Události si vyzvedávejte funkcí rkLineEventWait().
+ *
+ * \param white_line nastavte na true, pokud sledujete bílou čáru na černém podkladu.
+ * \param threshold_pct od jaké zkalibrované hodnoty v procentech je senzor na čáře. Výchozí: 50%
+ * \param debounce_ms jak dlouho musí stav vydržet, než se ohlásí jako událost. Výchozí: 20ms
+ * \return false, pokud se detekci nepodařilo spustit.
+ */
+bool rkLineEventsStart(bool white_line = false, uint8_t threshold_pct = 50, uint16_t debounce_ms = 20);
+
+/**
+ * \brief Přestat hledat události na čáře.
+ */
+void rkLineEventsStop();
+
+/**
+ * \brief Počkat na další událost na čáře.
+ *
+ * Události se řadí do fronty, takže o žádnou nepřijdete, i když tuto funkci voláte jen občas
+ * (fronta pojme 16 událostí).
+ *
+ *     rkLineEvent ev;
+ *     if (rkLineEventWait(ev, 0) && ev.type == RK_LINE_CROSSING) {
+ *         // právě jsme přejeli křižovatku
+ *     }
+ *
+ * \param ev sem se uloží událost
+ * \param timeout_ms jak dlouho nejvýše čekat. 0 znamená nečekat vůbec.
+ * \return true, pokud nějaká událost přišla.
+ */
+bool rkLineEventWait(rkLineEvent& ev, uint32_t timeout_ms = 0);
+
+/**
+ * \brief Co dělat, když robot při sledování čáry ztratí čáru.
+ */
+enum rkLineLostStrategy {
+    RK_LINE_LOST_STOP, //!< Zastavit motory a čekat, dokud se čára znovu neobjeví
+    RK_LINE_LOST_KEEP, //!< Pokračovat s posledním nastavením motorů
+    RK_LINE_LOST_SEARCH, //!< Točit se na stranu, kde byla čára naposledy vidět
+};
+
+/**
+ * \brief Nastavení sledování čáry pro rkLineFollowStart()
+ */
+struct rkLineFollowConfig {
+    rkLineFollowConfig()
+        : kp(60)
+        , ki(0)
+        , kd(5)
+        , base_speed(50)
+        , period_ms(5)
+        , white_line(false)
+        , line_threshold_pct(25)
+        , lost_strategy(RK_LINE_LOST_SEARCH)
+        , lost_speed(40)
+        , lost_timeout_ms(1000) {
+    }
+
+    float kp; //!< Proporcionální složka regulátoru
+    float ki; //!< Integrační složka regulátoru
+    float kd; //!< Derivační složka regulátoru
+    int8_t base_speed; //!< Rychlost motorů v procentech, když je čára přesně uprostřed
+    uint16_t period_ms; //!< Jak často se má regulátor spouštět, v milisekundách
+    bool white_line; //!< true, pokud sledujete bílou čáru na černém podkladu
+    uint8_t line_threshold_pct; //!< Stejné jako u rkLineGetPosition()
+    rkLineLostStrategy lost_strategy; //!< Co dělat, když se čára ztratí
+    int8_t lost_speed; //!< Rychlost otáčení při hledání čáry (RK_LINE_LOST_SEARCH)
+    uint32_t lost_timeout_ms; //!< Po jak dlouhé době bez čáry se sledování ukončí. 0 znamená nikdy.
+};
+
+/**
+ * \brief Statistiky sledování čáry, viz rkLineFollowGetStats()
+ */
+struct rkLineFollowStats {
+    rkLineFollowStats()
+        : iterations(0)
+        , lost_iterations(0)
+        , period_min_us(0)
+        , period_max_us(0)
+        , period_avg_us(0)
+        , error_avg_abs(0)
+        , error_max_abs(0) {
+    }
+
+    uint32_t iterations; //!< Kolikrát se regulátor spustil
+    uint32_t lost_iterations; //!< Kolikrát z toho nebyla nalezena čára
+    uint32_t period_min_us; //!< Nejkratší naměřená perioda regulátoru v mikrosekundách
+    uint32_t period_max_us; //!< Nejdelší naměřená perioda regulátoru v mikrosekundách
+    uint32_t period_avg_us; //!< Průměrná perioda regulátoru v mikrosekundách
+    float error_avg_abs; //!< Průměrná absolutní odchylka čáry od středu (0 až 1)
+    float error_max_abs; //!< Největší absolutní odchylka čáry od středu (0 až 1)
+};
+
+/**
+ * \brief Začít sledovat čáru na pozadí.
+ *
+ * Spustí PID regulátor ve vlastním tasku, který s pevnou periodou čte pozici čáry
+ * a nastavuje motory. Funkce se vrátí hned, robot jede, dokud nezavoláte rkLineFollowStop(),
+ * nebo dokud není čára ztracená déle než `lost_timeout_ms`.
+ *
+ *     rkLineFollowConfig cfg;
+ *     cfg.base_speed = 40;
+ *     rkLineFollowStart(cfg);
+ *
+ * \param cfg nastavení regulátoru
+ * \return false, pokud už sledování běží nebo se ho nepodařilo spustit.
+ */
+bool rkLineFollowStart(const rkLineFollowConfig& cfg = rkLineFollowConfig());
+
+/**
+ * \brief Ukončit sledování čáry a zastavit motory.
+ */
+void rkLineFollowStop();
+
+/**
+ * \brief Běží teď sledování čáry?
+ */
+bool rkLineFollowIsRunning();
+
+/**
+ * \brief Změnit konstanty regulátoru za jízdy.
+ */
+void rkLineFollowSetGains(float kp, float ki, float kd);
+
+/**
+ * \brief Změnit základní rychlost za jízdy.
+ *
+ * \param base_speed rychlost v procentech od -100 do 100
+ */
+void rkLineFollowSetSpeed(int8_t base_speed);
+
+/**
+ * \brief Statistiky sledování čáry - skutečná perioda regulátoru a odchylka od čáry.
+ *
+ * \param reset pokud je true, statistiky se po přečtení vynulují
+ */
+rkLineFollowStats rkLineFollowGetStats(bool reset = false);
+
+/**
+ * \brief Začít nahrávat data ze senzorů na čáru.
+ *
+ * Nahrávají se nezkalibrované hodnoty ze senzorů a výkony motorů z každého kroku
+ * rkLineFollowStart() a z každého volání rkLineRecordFrame(). Drží se posledních
+ * \p max_frames záznamů, starší se přepisují. Nahrávku lze uložit pomocí rkLineRecordSave()
+ * nebo poslat do aplikace pomocí rkLineRecordSend() a pak ji na počítači přehrát
+ * nástrojem tools/line_replay.cpp.
+ *
+ * \param max_frames kolik posledních záznamů se má držet v paměti, jeden zabere 22 bajtů.
+ * \return false, pokud se nepodařilo nahrávání spustit.
+ */
+bool rkLineRecordStart(size_t max_frames = 2000);
+
+/**
+ * \brief Zastavit nahrávání, nahrané záznamy zůstanou v paměti.
+ */
+void rkLineRecordStop();
+
+/**
+ * \brief Nahrát aktuální hodnoty senzorů spolu s výkony motorů, které jste právě nastavili.
+ *
+ * Použijte, pokud sledujete čáru vlastním kódem místo rkLineFollowStart().
+ */
+void rkLineRecordFrame(int8_t left_motor, int8_t right_motor);
+
+/**
+ * \brief Uložit nahrávku do souboru.
+ *
+ * Výchozí cesta je na SPIFFS, ze kterého čte webový server robota, takže
+ * nahrávku lze stáhnout prohlížečem z adresy http://<ip robota>/linerec.bin.
+ *
+ * \return false, pokud se zápis nepodařil.
+ */
+bool rkLineRecordSave(const char* path = "/spiffs/linerec.bin");
+
+/**
+ * \brief Poslat nahrávku do aplikace přes RBProtocol (příkazy "linerec_start" a "linerec").
+ *
+ * Funkce čeká, dokud není vše odesláno.
+ *
+ * \return false, pokud aplikace není připojená nebo se odeslání nepodařilo.
+ */
+bool rkLineRecordSend();
+
+/**@}*/
+/**
+ * \defgroup telemetry Telemetrie
+ *
+ * Metody pro průběžné odesílání stavu robota do počítače.
+ * @{
+ */
+
+/**
+ * \brief Kanály telemetrie, lze je kombinovat operátorem |.
+ */
+enum rkTelemetryChannel : uint16_t {
+    RK_TELEMETRY_ENCODERS = (1 << 0), //!< Pozice a rychlost enkodérů levého a pravého motoru
+    RK_TELEMETRY_MOTORS = (1 << 1), //!< Poslední nastavené výkony motorů
+    RK_TELEMETRY_LINE = (1 << 2), //!< Nezkalibrované hodnoty ze senzorů na čáru, jen s rkConfig.line_sample_rate_hz
+    RK_TELEMETRY_BATTERY = (1 << 3), //!< Napětí baterie v mV
+    RK_TELEMETRY_SERVOS = (1 << 4), //!< Poslední známé pozice serv ruky
+    RK_TELEMETRY_TASKS = (1 << 5), //!< Volná paměť, počet tasků a počet vynechaných snímků
+
+    RK_TELEMETRY_ALL = 0x3F,
+};
+
+/**
+ * \brief Začít odesílat telemetrii přes RBProtocol.
+ *
+ * S frekvencí \p rate_hz se vybrané kanály uloží do jednoho binárního snímku a ten se
+ * pošle připojené aplikaci i divákům (příkaz "spectate"). Snímky se neposílají znovu,
+ * ztracené poznáte podle mezery v pořadových číslech. Na počítači je převede do CSV
+ * nástroj tools/telemetry_csv.cpp.
+ *
+ * Kanál RK_TELEMETRY_ENCODERS zapne enkodéry motorů. Senzory na čáru telemetrie nezapíná,
+ * posílá jen poslední hodnoty z jejich vzorkování (rkConfig.line_sample_rate_hz). Dokud
+ * je program nepoužívá, nebo když je vzorkování vypnuté, jsou v CSV sloupce line0-7 prázdné.
+ *
+ * \param channels které kanály odesílat, viz rkTelemetryChannel. Výchozí: všechny
+ * \param rate_hz kolikrát za sekundu snímek odeslat, 1 až 1000. Výchozí: 50
+ * \return false, pokud je telemetrie už spuštěná nebo je vypnutá komunikace s aplikací.
+ */
+bool rkTelemetryStart(uint16_t channels = RK_TELEMETRY_ALL, uint16_t rate_hz = 50);
+
+/**
+ * \brief Zastavit odesílání telemetrie.
+ */
+void rkTelemetryStop();
+
 /**@}*/
 
 #endif // LIBRB_H
@@ -0,0 +1,157 @@
+// Replays a line sensor recording made by rkLineRecordStart() through the line
+// position estimators and the line following controller, as fast as possible,
+// so that different algorithms and settings can be compared on identical data.
+//
+// Build on a PC, from the library's root directory:
+//   g++ -std=c++11 -O2 -Isrc -I../Esp32-Mcp3008-LineSensor/src tools/line_replay.cpp
+//       ../Esp32-Mcp3008-LineSensor/src/mcp3008_linemath.cpp -o line_replay
+//
+// Usage:
+//   ./line_replay linerec.bin [--parabolic|--centroid] [--kp N] [--ki N] [--kd N] [--speed N]
+//                 [--threshold PCT] [--csv out.csv]
+//
+// Prints a summary and optionally writes a CSV with the recorded and replayed motor powers.
+
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "mcp3008_linemath.h"
+
+#include "_librk_line_controller.h"
+#include "_librk_line_record.h"
+
+using namespace rk;
+using mcp3008::LineMath;
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s RECORDING [--parabolic|--centroid] [--kp N] [--ki N] [--kd N] [--speed N] "
+                    "[--threshold PCT] [--csv FILE]\n",
+        name);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    float kp = 60, ki = 0, kd = 5;
+    int speed = 50;
+    int threshold_pct = 25;
+    int estimator = -1;
+    const char* csv_path = nullptr;
+
+    for (int i = 2; i < argc; ++i) {
+        const bool has_val = i + 1 < argc;
+        if (strcmp(argv[i], "--parabolic") == 0) {
+            estimator = LineMath::ESTIMATOR_PARABOLIC;
+        } else if (strcmp(argv[i], "--centroid") == 0) {
+            estimator = LineMath::ESTIMATOR_CENTROID;
+        } else if (strcmp(argv[i], "--kp") == 0 && has_val) {
+            kp = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ki") == 0 && has_val) {
+            ki = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--kd") == 0 && has_val) {
+            kd = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--speed") == 0 && has_val) {
+            speed = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threshold") == 0 && has_val) {
+            threshold_pct = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--csv") == 0 && has_val) {
+            csv_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    FILE* f = fopen(argv[1], "rb");
+    if (!f) {
+        fprintf(stderr, "failed to open %s\n", argv[1]);
+        return 1;
+    }
+
+    LineRecordHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != LineRecordHeader::MAGIC
+        || hdr.version != LineRecordHeader::VERSION || hdr.channels > LINE_RECORD_CHANNELS) {
+        fprintf(stderr, "%s is not a line recording this tool understands\n", argv[1]);
+        fclose(f);
+        return 1;
+    }
+
+    std::vector<LineRecordEntry> entries(hdr.count);
+    if (hdr.count != 0 && fread(entries.data(), sizeof(LineRecordEntry), hdr.count, f) != hdr.count) {
+        fprintf(stderr, "%s is truncated\n", argv[1]);
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    if (estimator < 0)
+        estimator = hdr.estimator;
+
+    FILE* csv = nullptr;
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) {
+            fprintf(stderr, "failed to open %s\n", csv_path);
+            return 1;
+        }
+        fprintf(csv, "time_us,position,confidence,rec_left,rec_right,left,right\n");
+    }
+
+    LineController ctrl;
+    ctrl.setGains(kp, ki, kd);
+    ctrl.setSpeed(speed);
+    ctrl.setLostStrategy(LineController::LOST_SEARCH, 40, 0);
+
+    uint32_t lost = 0;
+    double diff_sum = 0;
+    double err_sum = 0;
+    uint32_t prev_time = entries.empty() ? 0 : entries[0].time_us;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& e : entries) {
+        uint16_t vals[LINE_RECORD_CHANNELS];
+        for (int c = 0; c < hdr.channels; ++c)
+            vals[c] = LineMath::calibrateValue(e.raw[c], hdr.cal_min[c], hdr.cal_range[c]);
+
+        float confidence = 0;
+        const float pos = LineMath::estimateLine(LineMath::LineEstimator(estimator), vals, hdr.channels,
+            hdr.white_line, float(threshold_pct) / 100.f, &confidence);
+
+        int8_t left, right;
+        ctrl.step(pos, e.time_us - prev_time, left, right);
+        prev_time = e.time_us;
+
+        if (std::isnan(pos)) {
+            ++lost;
+        } else {
+            err_sum += fabsf(pos);
+        }
+        diff_sum += abs(left - e.left) + abs(right - e.right);
+
+        if (csv) {
+            fprintf(csv, "%u,%f,%f,%d,%d,%d,%d\n", e.time_us, pos, confidence, e.left, e.right, left, right);
+        }
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    if (csv)
+        fclose(csv);
+
+    const double duration_s = entries.empty() ? 0 : (entries.back().time_us - entries.front().time_us) / 1e6;
+    printf("frames: %u over %.2f s, replayed in %.3f ms\n", hdr.count, duration_s, elapsed.count() / 1000.0);
+    printf("estimator: %s, kp %.2f ki %.2f kd %.2f speed %d\n",
+        estimator == LineMath::ESTIMATOR_PARABOLIC ? "parabolic" : "centroid", kp, ki, kd, speed);
+    if (hdr.count != 0) {
+        printf("line lost: %u frames (%.1f%%)\n", lost, 100.0 * lost / hdr.count);
+        printf("mean |position|: %.4f\n", lost == hdr.count ? 0.0 : err_sum / (hdr.count - lost));
+        printf("mean motor power difference vs recording: %.2f\n", diff_sum / (2.0 * hdr.count));
+    }
+    return 0;
+}
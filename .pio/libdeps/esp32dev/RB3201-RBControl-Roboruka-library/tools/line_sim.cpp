@@ -0,0 +1,219 @@
+// Drives a simulated robot around a circular track with rk::LineController
+// and checks that it settles on the line, with the same estimators as the robot.
+//
+// The robot is a differential drive with motors that follow the power with a lag,
+// the sensor is a row of channels in front of the wheels, each reading a blurred
+// black line with noise. The robot starts off the line and turned away from it.
+//
+// Build on a PC, from the library's root directory:
+//   g++ -std=c++11 -O2 -Isrc -I../Esp32-Mcp3008-LineSensor/src tools/line_sim.cpp
+//       ../Esp32-Mcp3008-LineSensor/src/mcp3008_linemath.cpp -o line_sim
+//
+// Usage:
+//   ./line_sim [--radius M] [--offset M] [--angle DEG] [--kp N] [--ki N] [--kd N] [--speed N]
+//              [--period MS] [--duration S] [--parabolic] [--seed N] [--csv out.csv]
+//
+// Returns 1 if the robot loses the line or does not settle on it within the first half of the run.
+
+#include <cmath>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mcp3008_linemath.h"
+
+#include "_librk_line_controller.h"
+
+using namespace rk;
+using mcp3008::LineMath;
+
+static constexpr int CHANNELS = 8;
+static constexpr double SENSOR_SPACING = 0.012; // m between channels
+static constexpr double SENSOR_AHEAD = 0.06; // m from the wheel axle to the sensor row
+static constexpr double LINE_BLUR = 0.012; // m, how far from the line a channel still sees it
+static constexpr double WHEEL_BASE = 0.13; // m
+static constexpr double MAX_WHEEL_SPEED = 0.6; // m/s at power 100
+static constexpr double MOTOR_TAU = 0.05; // s, time constant of the motor response
+static constexpr double SIM_DT = 0.0005; // s, the physics runs faster than the controller
+
+static constexpr double SETTLED_ERROR = 0.01; // m, max distance of the sensor from the line once settled
+
+struct Robot {
+    double x, y, heading;
+    double v_left, v_right;
+};
+
+// The track is a circle around the origin, driven counterclockwise,
+// so the signed distance is positive outside of the circle.
+static double lineDistance(double x, double y, double radius) {
+    return sqrt(x * x + y * y) - radius;
+}
+
+static void readSensor(const Robot& r, double radius, std::mt19937& rng, uint16_t* vals) {
+    std::normal_distribution<double> noise(0, 15);
+    const double cx = r.x + SENSOR_AHEAD * cos(r.heading);
+    const double cy = r.y + SENSOR_AHEAD * sin(r.heading);
+    // Channel 0 is on the left, positive positions mean the line is on the right.
+    const double rx = sin(r.heading);
+    const double ry = -cos(r.heading);
+    for (int i = 0; i < CHANNELS; ++i) {
+        const double off = (i - (CHANNELS - 1) / 2.0) * SENSOR_SPACING;
+        const double d = lineDistance(cx + rx * off, cy + ry * off, radius) / LINE_BLUR;
+        const double val = 80 + 900 * exp(-d * d) + noise(rng);
+        vals[i] = uint16_t(std::min(1023.0, std::max(0.0, val)));
+    }
+}
+
+static void simulate(Robot& r, int8_t left, int8_t right, double dt) {
+    const double alpha = dt / (MOTOR_TAU + dt);
+    r.v_left += (left / 100.0 * MAX_WHEEL_SPEED - r.v_left) * alpha;
+    r.v_right += (right / 100.0 * MAX_WHEEL_SPEED - r.v_right) * alpha;
+
+    const double v = (r.v_left + r.v_right) / 2;
+    const double w = (r.v_right - r.v_left) / WHEEL_BASE;
+    r.x += v * cos(r.heading) * dt;
+    r.y += v * sin(r.heading) * dt;
+    r.heading += w * dt;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--radius M] [--offset M] [--angle DEG] [--kp N] [--ki N] [--kd N] [--speed N]\n"
+                    "          [--period MS] [--duration S] [--parabolic] [--seed N] [--csv FILE]\n",
+        name);
+}
+
+int main(int argc, char** argv) {
+    // Defaults of rkLineFollowConfig
+    float kp = 60, ki = 0, kd = 5;
+    int speed = 50;
+    int period_ms = 5;
+    double radius = 0.5;
+    double offset = 0.02;
+    double angle_deg = 20;
+    double duration = 10;
+    unsigned seed = 1;
+    LineMath::LineEstimator estimator = LineMath::ESTIMATOR_CENTROID;
+    const char* csv_path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_val = i + 1 < argc;
+        if (strcmp(argv[i], "--radius") == 0 && has_val) {
+            radius = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--offset") == 0 && has_val) {
+            offset = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--angle") == 0 && has_val) {
+            angle_deg = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--kp") == 0 && has_val) {
+            kp = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ki") == 0 && has_val) {
+            ki = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--kd") == 0 && has_val) {
+            kd = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--speed") == 0 && has_val) {
+            speed = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--period") == 0 && has_val) {
+            period_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0 && has_val) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && has_val) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--parabolic") == 0) {
+            estimator = LineMath::ESTIMATOR_PARABOLIC;
+        } else if (strcmp(argv[i], "--csv") == 0 && has_val) {
+            csv_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (period_ms <= 0 || radius <= 0 || duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* csv = nullptr;
+    if (csv_path) {
+        csv = fopen(csv_path, "w");
+        if (!csv) {
+            fprintf(stderr, "failed to open %s\n", csv_path);
+            return 1;
+        }
+        fprintf(csv, "time_s,x,y,error_m,position,left,right\n");
+    }
+
+    LineController ctrl;
+    ctrl.setGains(kp, ki, kd);
+    ctrl.setSpeed(speed);
+    ctrl.setLostStrategy(LineController::LOST_SEARCH, 40, 1000000);
+
+    // Start on the positive x axis, heading along the track, shifted outwards and turned away.
+    Robot r = {};
+    r.x = radius + offset;
+    r.heading = M_PI / 2 - angle_deg * M_PI / 180;
+
+    std::mt19937 rng(seed);
+    const double period = period_ms / 1000.0;
+    const int steps = int(duration / period);
+    int lost = 0;
+    double settled_at = -1;
+    double max_error_settled = 0;
+    double error_sq_sum = 0;
+    int error_count = 0;
+
+    for (int step = 0; step < steps; ++step) {
+        const double t = step * period;
+
+        uint16_t vals[CHANNELS];
+        readSensor(r, radius, rng, vals);
+        const float pos = LineMath::estimateLine(estimator, vals, CHANNELS, false, 0.25f);
+
+        int8_t left, right;
+        if (!ctrl.step(pos, step == 0 ? 0 : period_ms * 1000, left, right)) {
+            fprintf(stderr, "the line was lost for too long at %.2f s\n", t);
+            lost = steps;
+            break;
+        }
+        if (std::isnan(pos))
+            ++lost;
+
+        for (double s = 0; s < period; s += SIM_DT)
+            simulate(r, left, right, SIM_DT);
+
+        const double sx = r.x + SENSOR_AHEAD * cos(r.heading);
+        const double sy = r.y + SENSOR_AHEAD * sin(r.heading);
+        const double error = lineDistance(sx, sy, radius);
+        if (fabs(error) > SETTLED_ERROR) {
+            settled_at = -1;
+        } else if (settled_at < 0) {
+            settled_at = t;
+        }
+
+        if (t >= duration / 2) {
+            max_error_settled = std::max(max_error_settled, fabs(error));
+            error_sq_sum += error * error;
+            ++error_count;
+        }
+
+        if (csv) {
+            fprintf(csv, "%.3f,%.4f,%.4f,%.4f,%f,%d,%d\n", t, r.x, r.y, error, pos, left, right);
+        }
+    }
+
+    if (csv)
+        fclose(csv);
+
+    const bool settled = settled_at >= 0 && settled_at <= duration / 2;
+    printf("track radius %.2f m, start %.3f m off, %.0f deg, kp %.2f ki %.2f kd %.2f speed %d period %d ms, %s\n",
+        radius, offset, angle_deg, kp, ki, kd, speed, period_ms,
+        estimator == LineMath::ESTIMATOR_PARABOLIC ? "parabolic" : "centroid");
+    printf("line lost in %d of %d steps\n", lost, steps);
+    if (settled) {
+        printf("settled within %.0f mm after %.2f s, then max error %.1f mm, RMS %.1f mm\n", SETTLED_ERROR * 1000,
+            settled_at, max_error_settled * 1000, sqrt(error_sq_sum / std::max(1, error_count)) * 1000);
+    } else {
+        printf("did not settle within %.0f mm in the first %.1f s\n", SETTLED_ERROR * 1000, duration / 2);
+    }
+    return settled && lost < steps ? 0 : 1;
+}
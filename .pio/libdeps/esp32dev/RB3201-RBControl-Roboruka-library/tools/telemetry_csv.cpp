@@ -0,0 +1,333 @@
+// Receives the telemetry frames sent after rkTelemetryStart() and converts them to CSV.
+// It connects to the robot as a spectator, so the RBController app can stay connected.
+//
+// Build on a PC (Linux or macOS), from the library's root directory:
+//   g++ -std=c++11 -O2 -Isrc tools/telemetry_csv.cpp -o telemetry_csv
+//
+// Usage:
+//   ./telemetry_csv ROBOT_IP [--port N] [--duration S] [--csv out.csv] [--raw capture.bin]
+//   ./telemetry_csv --file capture.bin [--csv out.csv]
+//
+// --raw saves the received frames as they are, one after another, --file converts such capture.
+// Without --csv, the CSV goes to stdout. A summary with the lost frames goes to stderr.
+// client_time_us is the robot's time converted to the clock of the app that possesses it,
+// to line the frames up with the app's logs. It stays empty until the clocks are synchronized.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "_librk_telemetry_frame.h"
+
+using namespace rk;
+
+static constexpr uint8_t BINARY_TAG = 0xc1; // RBPROTOCOL_BINARY_TAG
+static constexpr int DEFAULT_PORT = 42424; // RBPROTOCOL_PORT
+
+static volatile bool gStop = false;
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s ROBOT_IP [--port N] [--duration S] [--csv FILE] [--raw FILE]\n"
+                    "       %s --file FILE [--csv FILE]\n",
+        name, name);
+}
+
+static double nowSec() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t frameSize(uint16_t channels) {
+    size_t size = sizeof(TelemetryFrameHeader);
+    for (int i = 0; i < TELEMETRY_CHANNEL_COUNT; ++i) {
+        if (channels & (1 << i))
+            size += telemetryChannelSize(1 << i);
+    }
+    return size;
+}
+
+class CsvWriter {
+public:
+    CsvWriter(FILE* out)
+        : m_out(out)
+        , m_channels(-1)
+        , m_frames(0)
+        , m_lost(0)
+        , m_bad(0)
+        , m_last_seq(0)
+        , m_last_time(0)
+        , m_time_us(0)
+        , m_skipped(0) {
+    }
+
+    // Returns the size of the frame at data, or 0 if there is none.
+    size_t add(const uint8_t* data, size_t size) {
+        TelemetryFrameHeader hdr;
+        if (size < sizeof(hdr)) {
+            ++m_bad;
+            return 0;
+        }
+        memcpy(&hdr, data, sizeof(hdr));
+        const size_t frame_size = frameSize(hdr.channels);
+        if (hdr.magic != TelemetryFrameHeader::MAGIC || hdr.version != TelemetryFrameHeader::VERSION
+            || frame_size > size) {
+            ++m_bad;
+            return 0;
+        }
+
+        if (m_channels != int(hdr.channels)) {
+            writeHeader(hdr.channels);
+            m_channels = hdr.channels;
+        }
+
+        // time_us wraps around every ~71 minutes.
+        if (m_frames == 0) {
+            m_time_us = hdr.time_us;
+        } else {
+            m_time_us += uint32_t(hdr.time_us - m_last_time);
+            if (hdr.seq > m_last_seq + 1)
+                m_lost += hdr.seq - m_last_seq - 1;
+        }
+        m_last_time = hdr.time_us;
+        m_last_seq = hdr.seq;
+        ++m_frames;
+
+        fprintf(m_out, "%u,%llu,", hdr.seq, (unsigned long long)m_time_us);
+        if (hdr.flags & TELEMETRY_FLAG_CLIENT_TIME)
+            fprintf(m_out, "%lld", (long long)hdr.client_time_us);
+
+        const uint8_t* itr = data + sizeof(hdr);
+        if (hdr.channels & TELEMETRY_ENCODERS) {
+            TelemetryEncoders enc;
+            memcpy(&enc, itr, sizeof(enc));
+            itr += sizeof(enc);
+            fprintf(m_out, ",%d,%d,%.1f,%.1f", enc.count[0], enc.count[1], enc.speed[0], enc.speed[1]);
+        }
+        if (hdr.channels & TELEMETRY_MOTORS) {
+            TelemetryMotors mot;
+            memcpy(&mot, itr, sizeof(mot));
+            itr += sizeof(mot);
+            fprintf(m_out, ",%d,%d", mot.power[0], mot.power[1]);
+        }
+        if (hdr.channels & TELEMETRY_LINE) {
+            TelemetryLine line;
+            memcpy(&line, itr, sizeof(line));
+            itr += sizeof(line);
+            for (int i = 0; i < TELEMETRY_LINE_CHANNELS; ++i) {
+                if (hdr.flags & TELEMETRY_FLAG_LINE_MISSING)
+                    fprintf(m_out, ",");
+                else
+                    fprintf(m_out, ",%u", line.raw[i]);
+            }
+        }
+        if (hdr.channels & TELEMETRY_BATTERY) {
+            TelemetryBattery batt;
+            memcpy(&batt, itr, sizeof(batt));
+            itr += sizeof(batt);
+            fprintf(m_out, ",%u", batt.voltage_mv);
+        }
+        if (hdr.channels & TELEMETRY_SERVOS) {
+            TelemetryServos servos;
+            memcpy(&servos, itr, sizeof(servos));
+            itr += sizeof(servos);
+            for (int i = 0; i < TELEMETRY_SERVOS_COUNT; ++i) {
+                if (servos.pos_decideg[i] == TELEMETRY_SERVO_UNKNOWN)
+                    fprintf(m_out, ",");
+                else
+                    fprintf(m_out, ",%.1f", servos.pos_decideg[i] / 10.f);
+            }
+        }
+        if (hdr.channels & TELEMETRY_TASKS) {
+            TelemetryTasks tasks;
+            memcpy(&tasks, itr, sizeof(tasks));
+            itr += sizeof(tasks);
+            m_skipped = tasks.skipped;
+            fprintf(m_out, ",%u,%u,%u,%u", tasks.free_heap, tasks.min_free_heap, tasks.task_count, tasks.skipped);
+        }
+        fprintf(m_out, "\n");
+        return frame_size;
+    }
+
+    void summary() const {
+        fprintf(stderr, "frames: %u, lost or skipped: %u (%.2f %%), not sent by the robot: %u, invalid: %u\n",
+            m_frames, m_lost, m_frames + m_lost ? 100.0 * m_lost / (m_frames + m_lost) : 0.0, m_skipped, m_bad);
+    }
+
+private:
+    void writeHeader(uint16_t channels) {
+        fprintf(m_out, "seq,time_us,client_time_us");
+        if (channels & TELEMETRY_ENCODERS)
+            fprintf(m_out, ",enc_left,enc_right,enc_speed_left,enc_speed_right");
+        if (channels & TELEMETRY_MOTORS)
+            fprintf(m_out, ",motor_left,motor_right");
+        if (channels & TELEMETRY_LINE) {
+            for (int i = 0; i < TELEMETRY_LINE_CHANNELS; ++i)
+                fprintf(m_out, ",line%d", i);
+        }
+        if (channels & TELEMETRY_BATTERY)
+            fprintf(m_out, ",battery_mv");
+        if (channels & TELEMETRY_SERVOS) {
+            for (int i = 0; i < TELEMETRY_SERVOS_COUNT; ++i)
+                fprintf(m_out, ",servo%d_deg", i);
+        }
+        if (channels & TELEMETRY_TASKS)
+            fprintf(m_out, ",free_heap,min_free_heap,tasks,skipped");
+        fprintf(m_out, "\n");
+    }
+
+    FILE* m_out;
+    int m_channels;
+    uint32_t m_frames;
+    uint32_t m_lost;
+    uint32_t m_bad;
+    uint32_t m_last_seq;
+    uint32_t m_last_time;
+    uint64_t m_time_us;
+    uint32_t m_skipped;
+};
+
+static int convertFile(const char* path, CsvWriter& csv) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + n);
+    fclose(f);
+
+    size_t off = 0;
+    while (off < data.size()) {
+        const size_t used = csv.add(data.data() + off, data.size() - off);
+        if (used == 0) {
+            fprintf(stderr, "invalid frame at offset %u, stopping\n", (unsigned)off);
+            break;
+        }
+        off += used;
+    }
+    return 0;
+}
+
+static int receive(const char* ip, int port, double duration, FILE* raw, CsvWriter& csv) {
+    sockaddr_in robot = {};
+    robot.sin_family = AF_INET;
+    robot.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &robot.sin_addr) != 1) {
+        fprintf(stderr, "invalid address %s\n", ip);
+        return 1;
+    }
+
+    const int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    timeval tv = { 0, 200000 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    static const char spectate[] = "{\"c\":\"spectate\"}";
+    const double end = duration > 0 ? nowSec() + duration : 0;
+    double next_spectate = 0;
+    uint8_t buf[2048];
+    while (!gStop && (end == 0 || nowSec() < end)) {
+        // The robot forgets spectators that go quiet for RBPROTOCOL_SPECTATOR_TIMEOUT_MS.
+        if (nowSec() >= next_spectate) {
+            sendto(sock, spectate, sizeof(spectate) - 1, 0, (sockaddr*)&robot, sizeof(robot));
+            next_spectate = nowSec() + 1.0;
+        }
+
+        const ssize_t n = recv(sock, buf, sizeof(buf), 0);
+        if (n <= 1 || buf[0] != BINARY_TAG)
+            continue;
+        if (raw)
+            fwrite(buf + 1, 1, n - 1, raw);
+        csv.add(buf + 1, n - 1);
+    }
+
+    close(sock);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* ip = nullptr;
+    const char* file_path = nullptr;
+    const char* csv_path = nullptr;
+    const char* raw_path = nullptr;
+    int port = DEFAULT_PORT;
+    double duration = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool has_val = i + 1 < argc;
+        if (strcmp(argv[i], "--file") == 0 && has_val) {
+            file_path = argv[++i];
+        } else if (strcmp(argv[i], "--csv") == 0 && has_val) {
+            csv_path = argv[++i];
+        } else if (strcmp(argv[i], "--raw") == 0 && has_val) {
+            raw_path = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && has_val) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0 && has_val) {
+            duration = atof(argv[++i]);
+        } else if (argv[i][0] != '-' && ip == nullptr) {
+            ip = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if ((ip == nullptr) == (file_path == nullptr)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (csv_path) {
+        out = fopen(csv_path, "w");
+        if (!out) {
+            fprintf(stderr, "failed to open %s\n", csv_path);
+            return 1;
+        }
+    }
+
+    CsvWriter csv(out);
+    int res;
+    if (file_path) {
+        res = convertFile(file_path, csv);
+    } else {
+        FILE* raw = nullptr;
+        if (raw_path && !(raw = fopen(raw_path, "wb"))) {
+            fprintf(stderr, "failed to open %s\n", raw_path);
+            return 1;
+        }
+
+        signal(SIGINT, [](int) { gStop = true; });
+        res = receive(ip, port, duration, raw, csv);
+        if (raw)
+            fclose(raw);
+    }
+
+    csv.summary();
+    if (out != stdout)
+        fclose(out);
+    return res;
+}
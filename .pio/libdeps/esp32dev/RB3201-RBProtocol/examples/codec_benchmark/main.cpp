@@ -0,0 +1,95 @@
+#include <esp_timer.h>
+#include <memory>
+#include <stdio.h>
+#include <string>
+
+#include "rbjson.h"
+
+// Compares the JSON and MessagePack encodings of typical RBProtocol messages.
+// It also runs on Linux, built by host/CMakeLists.txt.
+
+static const int ITERATIONS = 2000;
+
+static bool s_failed = false;
+
+static void benchmark(const char* name, const char* json) {
+    std::string buf(json);
+    std::unique_ptr<rbjson::Object> obj(rbjson::parse(&buf[0], buf.size()));
+    if (!obj) {
+        printf("%s: failed to parse\n", name);
+        s_failed = true;
+        return;
+    }
+
+    const std::string encoded_json = obj->str();
+    const std::string encoded_msgpack = obj->msgpack();
+
+    std::unique_ptr<rbjson::Object> back(rbjson::parseMsgpack(encoded_msgpack.data(), encoded_msgpack.size()));
+    if (!back || !back->equals(*obj)) {
+        printf("%s: MessagePack round-trip mismatch\n", name);
+        s_failed = true;
+        return;
+    }
+
+    size_t total = 0;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        total += obj->str().size();
+    }
+    const int64_t enc_json = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        total += obj->msgpack().size();
+    }
+    const int64_t enc_msgpack = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        buf = encoded_json;
+        delete rbjson::parse(&buf[0], buf.size());
+    }
+    const int64_t dec_json = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        delete rbjson::parseMsgpack(encoded_msgpack.data(), encoded_msgpack.size());
+    }
+    const int64_t dec_msgpack = esp_timer_get_time() - start;
+
+    rbjson::Arena arena;
+    start = esp_timer_get_time();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        buf = encoded_json;
+        delete rbjson::parse(&buf[0], buf.size(), arena);
+    }
+    const int64_t dec_json_arena = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        delete rbjson::parseMsgpack(encoded_msgpack.data(), encoded_msgpack.size(), arena);
+    }
+    const int64_t dec_msgpack_arena = esp_timer_get_time() - start;
+
+    auto per_msg = [](int64_t elapsed_us) { return double(elapsed_us) / ITERATIONS; };
+    printf("%s: size json %u B, msgpack %u B\n", name, unsigned(encoded_json.size()), unsigned(encoded_msgpack.size()));
+    printf("    encode: json %.2f us, msgpack %.2f us per message\n", per_msg(enc_json), per_msg(enc_msgpack));
+    printf("    decode: json %.2f us, msgpack %.2f us per message (%u)\n", per_msg(dec_json), per_msg(dec_msgpack),
+        unsigned(total));
+    printf("    decode with arena: json %.2f us, msgpack %.2f us per message\n", per_msg(dec_json_arena),
+        per_msg(dec_msgpack_arena));
+}
+
+extern "C" void app_main() {
+    benchmark("joy", "{\"c\":\"joy\",\"n\":1234,\"data\":[{\"x\":-32767,\"y\":12000},{\"x\":5,\"y\":-7}]}");
+    benchmark("_gst", "{\"c\":\"_gst\",\"e\":17,\"n\":99,\"3\":{\"angles\":[1.5708,-0.25,3.1]},"
+                      "\"12\":{\"text\":\"Hello\",\"on\":true,\"x\":null}}");
+    benchmark("log", "{\"c\":\"log\",\"e\":5,\"n\":100,\"msg\":\"Tick #42\\n\"}");
+}
+
+#ifndef ESP_PLATFORM
+int main() {
+    app_main();
+    return s_failed ? 1 : 0;
+}
+#endif
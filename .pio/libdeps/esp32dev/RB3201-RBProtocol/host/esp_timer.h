@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int64_t esp_timer_get_time(void); //!< Microseconds since the start of the program
+
+#ifdef __cplusplus
+}
+#endif
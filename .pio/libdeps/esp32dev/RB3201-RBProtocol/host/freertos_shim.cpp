@@ -0,0 +1,131 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+// pthread-based implementation of the FreeRTOS subset declared in host/freertos.
+
+struct HostTask {
+    TaskFunction_t func;
+    void* param;
+};
+
+struct HostQueue {
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::vector<uint8_t> storage;
+    size_t item_size;
+    size_t length;
+    size_t head;
+    size_t count;
+};
+
+static const auto s_start = std::chrono::steady_clock::now();
+static std::atomic<int> s_log_level(ESP_LOG_WARN);
+static thread_local HostTask* s_current_task = nullptr;
+
+static void run_task(HostTask* task) {
+    s_current_task = task;
+    task->func(task->param);
+}
+
+template <typename Predicate>
+static bool wait_for(std::condition_variable& cond, std::unique_lock<std::mutex>& lock, TickType_t ticks, Predicate pred) {
+    if (ticks == portMAX_DELAY) {
+        cond.wait(lock, pred);
+        return true;
+    }
+    return cond.wait_for(lock, std::chrono::milliseconds(ticks), pred);
+}
+
+extern "C" {
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char* /*name*/, uint32_t /*stack_depth*/, void* param,
+    UBaseType_t /*priority*/, TaskHandle_t* handle) {
+    HostTask* task = new HostTask { func, param };
+    std::thread(run_task, task).detach();
+    if (handle != nullptr)
+        *handle = task;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // The thread ends when its function returns, only the handle is freed here.
+    if (task == nullptr || task == s_current_task) {
+        delete s_current_task;
+        s_current_task = nullptr;
+    }
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return TickType_t(esp_timer_get_time() / 1000);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    HostQueue* q = new HostQueue;
+    q->storage.resize(length * item_size);
+    q->item_size = item_size;
+    q->length = length;
+    q->head = 0;
+    q->count = 0;
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!wait_for(q->not_full, lock, wait, [q] { return q->count < q->length; }))
+        return pdFALSE;
+
+    const size_t idx = (q->head + q->count) % q->length;
+    memcpy(&q->storage[idx * q->item_size], item, q->item_size);
+    ++q->count;
+    q->not_empty.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!wait_for(q->not_empty, lock, wait, [q] { return q->count != 0; }))
+        return pdFALSE;
+
+    memcpy(item, &q->storage[q->head * q->item_size], q->item_size);
+    q->head = (q->head + 1) % q->length;
+    --q->count;
+    q->not_full.notify_one();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->count;
+}
+
+int64_t esp_timer_get_time(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_start).count();
+}
+
+void esp_log_level_set(const char* /*tag*/, esp_log_level_t level) {
+    s_log_level = level;
+}
+
+esp_log_level_t esp_log_level_get(void) {
+    return esp_log_level_t(s_log_level.load());
+}
+
+}; // extern "C"
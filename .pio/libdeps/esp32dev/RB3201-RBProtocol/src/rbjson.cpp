@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include <stdio.h>
@@ -45,21 +46,29 @@ static void fct_ostream(char c, void* arg) {
     ((std::ostream*)arg)->put(c);
 }
 
-static Value* parse_value(char* buf, jsmntok_t* tok);
+template <typename T, typename... Args>
+static inline T* create(Arena* arena, Args&&... args) {
+    if (arena)
+        return new (*arena) ArenaValue<T>(*arena, std::forward<Args>(args)...);
+    return new T(std::forward<Args>(args)...);
+}
+
+static Value* parse_value(char* buf, jsmntok_t* tok, Arena* arena);
 
-static Object* parse_object(char* buf, jsmntok_t* obj) {
+static Object* parse_object(char* buf, jsmntok_t* obj, Arena* arena) {
     if (obj->type != JSMN_OBJECT) {
         return NULL;
     }
 
-    Object* res = new Object();
+    Object* res = create<Object>(arena);
+    res->reserve(obj->size);
     jsmntok_t* tok = obj + 1;
     for (int i = 0; i < obj->size; ++i) {
         if (tok->type != JSMN_STRING || tok->size != 1) {
             continue;
         }
 
-        Value* val = parse_value(buf, tok + 1);
+        Value* val = parse_value(buf, tok + 1, arena);
         if (val != NULL) {
             std::string key(buf + tok->start, tok->end - tok->start);
             res->set(std::move(key), val);
@@ -70,15 +79,16 @@ static Object* parse_object(char* buf, jsmntok_t* obj) {
     return res;
 }
 
-static Array* parse_array(char* buf, jsmntok_t* arr) {
+static Array* parse_array(char* buf, jsmntok_t* arr, Arena* arena) {
     if (arr->type != JSMN_ARRAY) {
         return NULL;
     }
 
-    Array* res = new Array();
+    Array* res = create<Array>(arena);
+    res->reserve(arr->size);
     jsmntok_t* tok = arr + 1;
     for (int i = 0; i < arr->size; ++i) {
-        Value* val = parse_value(buf, tok);
+        Value* val = parse_value(buf, tok, arena);
         if (val != NULL) {
             res->push_back(val);
         }
@@ -87,14 +97,14 @@ static Array* parse_array(char* buf, jsmntok_t* arr) {
     return res;
 }
 
-Value* parse_value(char* buf, jsmntok_t* tok) {
+Value* parse_value(char* buf, jsmntok_t* tok, Arena* arena) {
     switch (tok->type) {
     case JSMN_OBJECT:
-        return parse_object(buf, tok);
+        return parse_object(buf, tok, arena);
     case JSMN_ARRAY:
-        return parse_array(buf, tok);
+        return parse_array(buf, tok, arena);
     case JSMN_STRING:
-        return new String(std::string(buf + tok->start, tok->end - tok->start));
+        return create<String>(arena, std::string(buf + tok->start, tok->end - tok->start));
     case JSMN_PRIMITIVE: {
         const char* str = buf + tok->start;
         const int len = tok->end - tok->start;
@@ -104,11 +114,11 @@ Value* parse_value(char* buf, jsmntok_t* tok) {
 
         switch (*str) {
         case 't':
-            return new Bool(true);
+            return create<Bool>(arena, true);
         case 'f':
-            return new Bool(false);
+            return create<Bool>(arena, false);
         case 'n':
-            return new Nil();
+            return create<Nil>(arena);
         default: {
             char buf[32];
             snprintf(buf, sizeof(buf), "%.*s", len, str);
@@ -118,7 +128,7 @@ Value* parse_value(char* buf, jsmntok_t* tok) {
             if (buf == endptr) {
                 return NULL;
             }
-            return new Number(val);
+            return create<Number>(arena, val);
         }
         }
     }
@@ -127,7 +137,7 @@ Value* parse_value(char* buf, jsmntok_t* tok) {
     }
 }
 
-Object* parse(char* buf, size_t size) {
+static Object* parse_document(char* buf, size_t size, Arena* arena) {
     jsmn_parser parser;
     size_t tokens_size = 32;
     jsmntok_t tokens_static[32];
@@ -143,17 +153,103 @@ Object* parse(char* buf, size_t size) {
         } else if (parsed == JSMN_ERROR_NOMEM) {
             tokens_size *= 2;
             if (tokens_size >= 128) {
-                ESP_LOGE(TAG, "failed to parse msg %.*s: too big", size, buf);
+                ESP_LOGE(TAG, "failed to parse msg %.*s: too big", (int)size, buf);
                 return NULL;
             }
             tokens_dynamic.reset(new jsmntok_t[tokens_size]);
             tokens = tokens_dynamic.get();
         } else {
-            ESP_LOGE(TAG, "failed to parse msg %.*s: %d", size, buf, parsed);
+            ESP_LOGE(TAG, "failed to parse msg %.*s: %d", (int)size, buf, parsed);
             return NULL;
         }
     }
-    return parse_object(buf, &tokens[0]);
+    return parse_object(buf, &tokens[0], arena);
+}
+
+Object* parse(char* buf, size_t size) {
+    return parse_document(buf, size, nullptr);
+}
+
+Object* parse(char* buf, size_t size, Arena& arena) {
+    return parse_document(buf, size, &arena);
+}
+
+// Blocks and values are aligned to pointers, that is enough for all the Value types
+// and the members of objects. ArenaValue prefixes the value with its Arena*.
+static constexpr size_t ARENA_ALIGN = sizeof(void*);
+
+static_assert(alignof(Object) <= ARENA_ALIGN && alignof(Array) <= ARENA_ALIGN && alignof(String) <= ARENA_ALIGN
+        && alignof(Number) <= ARENA_ALIGN && alignof(Object::Member) <= ARENA_ALIGN
+        && sizeof(Arena*) % ARENA_ALIGN == 0,
+    "values in the arena would be misaligned");
+
+static inline size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+Arena::Arena(size_t block_size)
+    : m_blocks(nullptr)
+    , m_block_size(block_size)
+    , m_live(0) {
+}
+
+Arena::~Arena() {
+    if (m_live != 0) {
+        ESP_LOGE(TAG, "destroying an arena with %d allocations still in use!", (int)m_live);
+    }
+    freeBlocks();
+}
+
+void* Arena::alloc(size_t size) {
+    size = align_up(size);
+    if (m_blocks == nullptr || m_blocks->size - m_blocks->used < size) {
+        addBlock(std::max(m_block_size, size));
+    }
+
+    char* res = (char*)m_blocks + align_up(sizeof(Block)) + m_blocks->used;
+    m_blocks->used += size;
+    ++m_live;
+    return res;
+}
+
+size_t Arena::capacity() const {
+    size_t res = 0;
+    for (const Block* b = m_blocks; b != nullptr; b = b->next) {
+        res += b->size;
+    }
+    return res;
+}
+
+void Arena::addBlock(size_t size) {
+    Block* b = (Block*)::operator new(align_up(sizeof(Block)) + size);
+    b->next = m_blocks;
+    b->size = size;
+    b->used = 0;
+    m_blocks = b;
+}
+
+void Arena::freeBlocks() {
+    while (m_blocks != nullptr) {
+        Block* next = m_blocks->next;
+        ::operator delete(m_blocks);
+        m_blocks = next;
+    }
+}
+
+// Rewinds after the last allocation is released,
+// replacing the blocks with a single one if the first one was too small.
+void Arena::release() {
+    if (--m_live != 0)
+        return;
+
+    if (m_blocks->next != nullptr) {
+        const size_t size = capacity();
+        freeBlocks();
+        m_block_size = std::max(m_block_size, size);
+        addBlock(m_block_size);
+    } else {
+        m_blocks->used = 0;
+    }
 }
 
 Value::Value(Value::type_t type)
@@ -196,17 +292,45 @@ void Object::swapData(Object& other) {
     m_members.swap(other.m_members);
 }
 
+static inline bool member_less(const Object::Member& member, const std::string& key) {
+    return member.first < key;
+}
+
+Object::Members::iterator Object::lowerBound(const std::string& key) {
+    return std::lower_bound(m_members.begin(), m_members.end(), key, member_less);
+}
+
+// Messages and widget states have a few members, comparing the lengths first is quicker than the binary search.
+static constexpr size_t LINEAR_FIND_MAX = 16;
+
+Object::Members::const_iterator Object::find(const std::string& key) const {
+    if (m_members.size() <= LINEAR_FIND_MAX) {
+        for (auto itr = m_members.cbegin(); itr != m_members.cend(); ++itr) {
+            if (itr->first.size() == key.size() && memcmp(itr->first.data(), key.data(), key.size()) == 0)
+                return itr;
+        }
+        return m_members.cend();
+    }
+
+    const auto itr = std::lower_bound(m_members.cbegin(), m_members.cend(), key, member_less);
+    if (itr == m_members.cend() || itr->first != key)
+        return m_members.cend();
+    return itr;
+}
+
 bool Object::equals(const Value& other) const {
     if (!Value::equals(other))
         return false;
 
+    // Both are sorted by key, so the members have to match one by one.
     const auto& obj = static_cast<const Object&>(other);
     if (m_members.size() != obj.m_members.size())
         return false;
 
-    for (const auto& pair : m_members) {
-        const auto itr = obj.m_members.find(pair.first);
-        if (itr == obj.m_members.end() || !itr->second->equals(*pair.second))
+    for (size_t i = 0; i < m_members.size(); ++i) {
+        const auto& a = m_members[i];
+        const auto& b = obj.m_members[i];
+        if (a.first != b.first || !a.second->equals(*b.second))
             return false;
     }
     return true;
@@ -214,18 +338,19 @@ bool Object::equals(const Value& other) const {
 
 Value* Object::copy() const {
     auto* res = new Object();
+    res->m_members.reserve(m_members.size());
     for (const auto& pair : m_members) {
-        res->m_members[pair.first] = pair.second->copy();
+        res->m_members.emplace_back(pair.first, pair.second->copy());
     }
     return res;
 }
 
 bool Object::contains(const std::string& key) const {
-    return m_members.find(key) != m_members.end();
+    return find(key) != m_members.cend();
 }
 
 Value* Object::get(const std::string& key) const {
-    const auto itr = m_members.find(key);
+    const auto itr = find(key);
     if (itr == m_members.cend())
         return NULL;
     return itr->second;
@@ -284,12 +409,12 @@ bool Object::getBool(const std::string& key, bool def) const {
 }
 
 void Object::set(const std::string& key, Value* value) {
-    auto itr = m_members.find(key);
-    if (itr != m_members.end()) {
+    auto itr = lowerBound(key);
+    if (itr != m_members.end() && itr->first == key) {
         delete itr->second;
         itr->second = value;
     } else {
-        m_members[key] = value;
+        m_members.emplace(itr, key, value);
     }
 }
 
@@ -302,8 +427,8 @@ void Object::set(const std::string& key, double number) {
 }
 
 void Object::remove(const std::string& key) {
-    auto itr = m_members.find(key);
-    if (itr != m_members.end()) {
+    auto itr = lowerBound(key);
+    if (itr != m_members.end() && itr->first == key) {
         delete itr->second;
         m_members.erase(itr);
     }
@@ -1,7 +1,7 @@
 #pragma once
 
-#include <map>
 #include <sstream>
+#include <utility>
 #include <vector>
 
 /**
@@ -10,12 +10,73 @@
 namespace rbjson {
 
 class Object;
+class Arena;
 
 /**
  * \brief Parse a JSON string to an object.
  */
 Object* parse(char* buf, size_t size);
 
+/**
+ * \brief Parse a JSON string to an object with its values allocated from the arena, see Arena.
+ */
+Object* parse(char* buf, size_t size, Arena& arena);
+
+/**
+ * \brief Parse a MessagePack-encoded object, as produced by Value::msgpack().
+ *
+ * If used is not NULL, the object may be followed by more data and its
+ * encoded size is stored into used.
+ */
+Object* parseMsgpack(const char* buf, size_t size, size_t* used = nullptr);
+
+/**
+ * \brief Parse a MessagePack-encoded object with its values allocated from the arena, see Arena.
+ */
+Object* parseMsgpack(const char* buf, size_t size, Arena& arena, size_t* used = nullptr);
+
+/**
+ * \brief Bump allocator for the values of short-lived parsed objects.
+ *
+ * Values parsed with an arena are ArenaValue instances carved out of one block instead
+ * of being allocated one by one, and so are the member and item lists of their objects
+ * and arrays. They are deleted as usual, but that frees nothing. Once everything
+ * allocated from the arena is released, it rewinds and the next parsed object reuses
+ * the same memory. When the block runs out, more blocks are allocated and the first
+ * block grows to fit them all on the next rewind.
+ *
+ * The arena is not thread-safe, its values have to be allocated and deleted from one task,
+ * and it must outlive them. Keys and strings longer than what std::string stores inline
+ * (15 characters with GCC) still use the heap.
+ */
+class Arena {
+public:
+    explicit Arena(size_t block_size = 1024);
+    ~Arena();
+
+    void* alloc(size_t size); //!< Allocate size bytes aligned for any Value, never returns NULL. Live until release() is called.
+    void release(); //!< Release one allocation, the arena rewinds after the last one
+
+    size_t live() const { return m_live; } //!< Number of allocations not yet released
+    size_t capacity() const; //!< Size of all the allocated blocks
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+        size_t used;
+    };
+
+    Arena(const Arena&) = delete;
+
+    void addBlock(size_t size);
+    void freeBlocks();
+
+    Block* m_blocks; //!< The current block, older ones follow
+    size_t m_block_size;
+    size_t m_live;
+};
+
 /**
  * \brief Base JSON value class, not instanceable.
  */
@@ -35,6 +96,8 @@ public:
 
     virtual void serialize(std::ostream& ss) const = 0; //!< Serialize the value to a string
     std::string str() const; //!< Helper that calls serialize() and returns a string
+    void serializeMsgpack(std::ostream& ss) const; //!< Serialize the value in the more compact MessagePack binary format
+    std::string msgpack() const; //!< Helper that calls serializeMsgpack() and returns a string
 
     //!< Get the object type
     type_t getType() const {
@@ -53,16 +116,107 @@ public:
     virtual Value* copy() const = 0;
 
 protected:
+    void useArena(Arena&) {} //!< Called by ArenaValue, values with containers allocate them from the arena
+
     type_t m_type;
 };
 
+/**
+ * \brief Allocator of the containers inside values, from an Arena or from the heap if it has none.
+ *
+ * Copies of a container go to the heap, moved and swapped containers take the allocator with them.
+ */
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(Arena* arena = nullptr)
+        : m_arena(arena) {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        : m_arena(other.arena()) {
+    }
+
+    T* allocate(size_t n) {
+        if (m_arena)
+            return (T*)m_arena->alloc(n * sizeof(T));
+        return (T*)::operator new(n * sizeof(T));
+    }
+
+    void deallocate(T* ptr, size_t) {
+        if (m_arena)
+            m_arena->release();
+        else
+            ::operator delete(ptr);
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+    Arena* arena() const { return m_arena; }
+
+private:
+    Arena* m_arena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() != b.arena();
+}
+
+/**
+ * \brief A value of type T allocated from an Arena, e.g. new (arena) ArenaValue<Number>(arena, 1).
+ *
+ * It is deleted like any other value. Only these values carry the pointer to their arena,
+ * values created with plain new are allocated as usual.
+ */
+template <typename T>
+class ArenaValue final : public T {
+public:
+    template <typename... Args>
+    explicit ArenaValue(Arena& arena, Args&&... args)
+        : T(std::forward<Args>(args)...) {
+        this->useArena(arena);
+    }
+
+    static void* operator new(size_t size, Arena& arena) {
+        Arena** mem = (Arena**)arena.alloc(sizeof(Arena*) + size);
+        *mem = &arena;
+        return mem + 1;
+    }
+
+    static void operator delete(void* ptr) {
+        if (ptr != nullptr)
+            ((Arena**)ptr)[-1]->release();
+    }
+
+    static void operator delete(void*, Arena& arena) {
+        arena.release();
+    }
+};
+
 class Array;
 
 /**
  * \brief A JSON Object
+ *
+ * The members are kept in a vector sorted by key instead of a tree, so the members of small
+ * objects are one allocation and a short scan away. members() iterates in the order of the keys.
  */
 class Object : public Value {
 public:
+    typedef std::pair<std::string, Value*> Member;
+    typedef std::vector<Member, ArenaAllocator<Member>> Members;
+
     static Object* parse(char* buf, size_t size);
 
     Object();
@@ -75,7 +229,7 @@ public:
     void swapData(Object& other);
 
     bool contains(const std::string& key) const;
-    const std::map<std::string, Value*>& members() const { return m_members; }
+    const Members& members() const { return m_members; } //!< Sorted by key
 
     Value* get(const std::string& key) const;
     Object* getObject(const std::string& key) const;
@@ -91,8 +245,62 @@ public:
 
     void remove(const std::string& key);
 
+    void reserve(size_t count) { m_members.reserve(count); } //!< Preallocate space for count members
+
+protected:
+    void useArena(Arena& arena) { m_members = Members(ArenaAllocator<Member>(&arena)); }
+
 private:
-    std::map<std::string, Value*> m_members;
+    Members::iterator lowerBound(const std::string& key);
+    Members::const_iterator find(const std::string& key) const;
+
+    Members m_members;
+};
+
+/**
+ * \brief Reads a few fields of a serialized object without building the object tree.
+ *
+ * Paths are keys separated by dots, numeric parts index into arrays, e.g. "data.0.x".
+ * Only the containers on the way to the requested fields are visited.
+ */
+class FieldScanner {
+public:
+    struct Field {
+        Value::type_t type; //!< STRING, NUMBER or BOOL, NIL if the field was not found
+        float number; //!< Value of NUMBER and BOOL (1 or 0) fields
+        const char* str; //!< Value of STRING fields, points into the scanned buffer and is not null-terminated
+        size_t str_len;
+    };
+
+    FieldScanner() {}
+    explicit FieldScanner(const std::vector<std::string>& paths);
+
+    size_t size() const { return m_paths.size(); } //!< Number of paths, fields passed to scan() must be at least this long
+
+    /**
+     * \brief Scan a JSON object. Returns false if it is not a valid object or it is too big.
+     */
+    bool scan(const char* buf, size_t size, Field* fields) const;
+
+    /**
+     * \brief Scan a MessagePack object. Returns false if it is not a valid object.
+     *
+     * If used is not NULL, the object may be followed by more data and its
+     * encoded size is stored into used.
+     */
+    bool scanMsgpack(const char* buf, size_t size, Field* fields, size_t* used = nullptr) const;
+
+private:
+    struct Component {
+        std::string key;
+        int index; //!< -1 if the key is not a number
+    };
+
+    bool matches(const void* path, int depth, size_t field, bool prefix) const;
+    bool wanted(const void* path, int depth) const;
+    void store(const void* path, int depth, const Field& value, Field* fields) const;
+
+    std::vector<std::vector<Component>> m_paths;
 };
 
 /**
@@ -124,8 +332,15 @@ public:
     }
     void remove(size_t idx);
 
+    void reserve(size_t count) { m_items.reserve(count); } //!< Preallocate space for count items
+
+protected:
+    void useArena(Arena& arena) { m_items = Items(ArenaAllocator<Value*>(&arena)); }
+
 private:
-    std::vector<Value*> m_items;
+    typedef std::vector<Value*, ArenaAllocator<Value*>> Items;
+
+    Items m_items;
 };
 
 /**
@@ -148,7 +363,7 @@ private:
 };
 
 /**
- * \brief A JSON Number. It's a double internally.
+ * \brief A JSON Number. It is stored as a float, so integers above 2^24 lose precision.
  */
 class Number : public Value {
 public:
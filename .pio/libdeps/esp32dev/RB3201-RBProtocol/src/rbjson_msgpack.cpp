@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "rbjson.h"
+
+#define TAG "RbJson"
+
+// A MessagePack (https://msgpack.org) subset, enough to represent any rbjson tree.
+// Numbers are written as the smallest integer type if they are whole,
+// otherwise as float32, because that is what Number stores.
+
+namespace rbjson {
+
+static inline void write_be(std::ostream& out, uint32_t val, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) {
+        out.put(char((val >> (i * 8)) & 0xFF));
+    }
+}
+
+static void write_str(std::ostream& out, const char* str, size_t len) {
+    if (len < 32) {
+        out.put(char(0xa0 | len));
+    } else if (len <= 0xFF) {
+        out.put(char(0xd9));
+        write_be(out, len, 1);
+    } else if (len <= 0xFFFF) {
+        out.put(char(0xda));
+        write_be(out, len, 2);
+    } else {
+        out.put(char(0xdb));
+        write_be(out, len, 4);
+    }
+    out.write(str, len);
+}
+
+static void write_number(std::ostream& out, float val) {
+    float intpart;
+    if (std::isfinite(val) && modff(val, &intpart) == 0.f && val >= -2147483648.f && val < 2147483648.f) {
+        const int32_t i = int32_t(val);
+        if (i >= 0) {
+            if (i < 128) {
+                out.put(char(i));
+            } else if (i <= 0xFF) {
+                out.put(char(0xcc));
+                write_be(out, i, 1);
+            } else if (i <= 0xFFFF) {
+                out.put(char(0xcd));
+                write_be(out, i, 2);
+            } else {
+                out.put(char(0xce));
+                write_be(out, i, 4);
+            }
+        } else if (i >= -32) {
+            out.put(char(i));
+        } else if (i >= -128) {
+            out.put(char(0xd0));
+            write_be(out, uint8_t(i), 1);
+        } else if (i >= -32768) {
+            out.put(char(0xd1));
+            write_be(out, uint16_t(i), 2);
+        } else {
+            out.put(char(0xd2));
+            write_be(out, uint32_t(i), 4);
+        }
+        return;
+    }
+
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    out.put(char(0xca));
+    write_be(out, bits, 4);
+}
+
+static void write_container_header(std::ostream& out, size_t size, uint8_t fix, uint8_t c16, uint8_t c32) {
+    if (size < 16) {
+        out.put(char(fix | size));
+    } else if (size <= 0xFFFF) {
+        out.put(char(c16));
+        write_be(out, size, 2);
+    } else {
+        out.put(char(c32));
+        write_be(out, size, 4);
+    }
+}
+
+static void write_value(std::ostream& out, const Value& val) {
+    switch (val.getType()) {
+    case Value::OBJECT: {
+        const auto& members = static_cast<const Object&>(val).members();
+        write_container_header(out, members.size(), 0x80, 0xde, 0xdf);
+        for (const auto& itr : members) {
+            write_str(out, itr.first.c_str(), itr.first.size());
+            write_value(out, *itr.second);
+        }
+        break;
+    }
+    case Value::ARRAY: {
+        const auto& arr = static_cast<const Array&>(val);
+        write_container_header(out, arr.size(), 0x90, 0xdc, 0xdd);
+        for (size_t i = 0; i < arr.size(); ++i) {
+            write_value(out, *arr.get(i));
+        }
+        break;
+    }
+    case Value::STRING: {
+        const auto& str = static_cast<const String&>(val).get();
+        write_str(out, str.c_str(), str.size());
+        break;
+    }
+    case Value::NUMBER:
+        write_number(out, static_cast<const Number&>(val).get());
+        break;
+    case Value::BOOL:
+        out.put(static_cast<const Bool&>(val).get() ? char(0xc3) : char(0xc2));
+        break;
+    case Value::NIL:
+        out.put(char(0xc0));
+        break;
+    }
+}
+
+void Value::serializeMsgpack(std::ostream& ss) const {
+    write_value(ss, *this);
+}
+
+std::string Value::msgpack() const {
+    std::ostringstream ss;
+    serializeMsgpack(ss);
+    return ss.str();
+}
+
+namespace {
+
+class MsgpackReader {
+public:
+    MsgpackReader(const uint8_t* buf, size_t size, Arena* arena)
+        : m_buf(buf)
+        , m_end(buf + size)
+        , m_arena(arena) {
+    }
+
+    Value* readValue(int depth);
+
+    bool atEnd() const { return m_buf == m_end; }
+    const uint8_t* pos() const { return m_buf; }
+
+private:
+    static constexpr int MAX_DEPTH = 16;
+
+    bool readBe(uint32_t& val, int bytes) {
+        if (m_end - m_buf < bytes)
+            return false;
+        val = 0;
+        for (int i = 0; i < bytes; ++i)
+            val = (val << 8) | *m_buf++;
+        return true;
+    }
+
+    bool readStr(uint8_t tag, std::string& dest) {
+        uint32_t len;
+        if ((tag & 0xe0) == 0xa0) {
+            len = tag & 0x1f;
+        } else if (tag == 0xd9 || tag == 0xda || tag == 0xdb) {
+            if (!readBe(len, 1 << (tag - 0xd9)))
+                return false;
+        } else {
+            return false;
+        }
+
+        if (uint32_t(m_end - m_buf) < len)
+            return false;
+        dest.assign((const char*)m_buf, len);
+        m_buf += len;
+        return true;
+    }
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        if (m_arena)
+            return new (*m_arena) ArenaValue<T>(*m_arena, std::forward<Args>(args)...);
+        return new T(std::forward<Args>(args)...);
+    }
+
+    Object* readMap(uint32_t size, int depth);
+    Array* readArray(uint32_t size, int depth);
+
+    const uint8_t* m_buf;
+    const uint8_t* m_end;
+    Arena* m_arena;
+};
+
+Object* MsgpackReader::readMap(uint32_t size, int depth) {
+    std::unique_ptr<Object> res(create<Object>());
+    res->reserve(std::min(size, uint32_t(m_end - m_buf) / 2));
+    std::string key;
+    for (uint32_t i = 0; i < size; ++i) {
+        if (atEnd() || !readStr(*m_buf++, key))
+            return nullptr;
+        Value* val = readValue(depth + 1);
+        if (val == nullptr)
+            return nullptr;
+        res->set(key, val);
+    }
+    return res.release();
+}
+
+Array* MsgpackReader::readArray(uint32_t size, int depth) {
+    std::unique_ptr<Array> res(create<Array>());
+    res->reserve(std::min(size, uint32_t(m_end - m_buf)));
+    for (uint32_t i = 0; i < size; ++i) {
+        Value* val = readValue(depth + 1);
+        if (val == nullptr)
+            return nullptr;
+        res->push_back(val);
+    }
+    return res.release();
+}
+
+Value* MsgpackReader::readValue(int depth) {
+    if (atEnd() || depth > MAX_DEPTH)
+        return nullptr;
+
+    const uint8_t tag = *m_buf++;
+    uint32_t val;
+
+    if (tag < 0x80)
+        return create<Number>(tag);
+    if (tag >= 0xe0)
+        return create<Number>(int8_t(tag));
+    if ((tag & 0xf0) == 0x80)
+        return readMap(tag & 0x0f, depth);
+    if ((tag & 0xf0) == 0x90)
+        return readArray(tag & 0x0f, depth);
+    if ((tag & 0xe0) == 0xa0 || tag == 0xd9 || tag == 0xda || tag == 0xdb) {
+        std::string str;
+        if (!readStr(tag, str))
+            return nullptr;
+        return create<String>(std::move(str));
+    }
+
+    switch (tag) {
+    case 0xc0:
+        return create<Nil>();
+    case 0xc2:
+        return create<Bool>(false);
+    case 0xc3:
+        return create<Bool>(true);
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+        if (!readBe(val, 1 << (tag - 0xcc)))
+            return nullptr;
+        return create<Number>(val);
+    case 0xd0:
+        if (!readBe(val, 1))
+            return nullptr;
+        return create<Number>(int8_t(val));
+    case 0xd1:
+        if (!readBe(val, 2))
+            return nullptr;
+        return create<Number>(int16_t(val));
+    case 0xd2:
+        if (!readBe(val, 4))
+            return nullptr;
+        return create<Number>(int32_t(val));
+    case 0xca: {
+        if (!readBe(val, 4))
+            return nullptr;
+        float f;
+        memcpy(&f, &val, sizeof(f));
+        return create<Number>(f);
+    }
+    case 0xcb: {
+        uint32_t hi, lo;
+        if (!readBe(hi, 4) || !readBe(lo, 4))
+            return nullptr;
+        const uint64_t bits = (uint64_t(hi) << 32) | lo;
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return create<Number>(d);
+    }
+    case 0xcf:
+    case 0xd3: {
+        uint32_t hi, lo;
+        if (!readBe(hi, 4) || !readBe(lo, 4))
+            return nullptr;
+        const uint64_t bits = (uint64_t(hi) << 32) | lo;
+        return create<Number>(tag == 0xcf ? double(bits) : double(int64_t(bits)));
+    }
+    case 0xdc:
+    case 0xdd:
+        if (!readBe(val, tag == 0xdc ? 2 : 4))
+            return nullptr;
+        return readArray(val, depth);
+    case 0xde:
+    case 0xdf:
+        if (!readBe(val, tag == 0xde ? 2 : 4))
+            return nullptr;
+        return readMap(val, depth);
+    default:
+        return nullptr;
+    }
+}
+
+}; // anonymous namespace
+
+static Object* parse_msgpack(const char* buf, size_t size, size_t* used, Arena* arena) {
+    MsgpackReader reader((const uint8_t*)buf, size, arena);
+    std::unique_ptr<Value> val(reader.readValue(0));
+    if (!val || val->getType() != Value::OBJECT || (used == nullptr && !reader.atEnd())) {
+        ESP_LOGE(TAG, "failed to parse msgpack message of %d bytes", (int)size);
+        return nullptr;
+    }
+    if (used != nullptr)
+        *used = reader.pos() - (const uint8_t*)buf;
+    return static_cast<Object*>(val.release());
+}
+
+Object* parseMsgpack(const char* buf, size_t size, size_t* used) {
+    return parse_msgpack(buf, size, used, nullptr);
+}
+
+Object* parseMsgpack(const char* buf, size_t size, Arena& arena, size_t* used) {
+    return parse_msgpack(buf, size, used, &arena);
+}
+
+};
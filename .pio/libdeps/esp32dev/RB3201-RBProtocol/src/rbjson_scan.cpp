@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsmn.h"
+#include "rbjson.h"
+
+// FieldScanner walks the JSON tokens or the MessagePack bytes depth-first,
+// keeping the path to the current value, and only descends into containers
+// that are a prefix of some of the requested paths.
+
+namespace rbjson {
+
+namespace {
+
+static constexpr int MAX_DEPTH = 8;
+static constexpr int MAX_TOKENS = 48;
+
+struct PathItem {
+    const char* key; //!< nullptr for array items
+    size_t key_len;
+    int index;
+};
+
+float parse_float(const char* str, size_t len, bool& ok) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*s", (int)len, str);
+
+    char* endptr;
+    const float val = strtof(buf, &endptr);
+    ok = endptr != buf;
+    return val;
+}
+
+};
+
+FieldScanner::FieldScanner(const std::vector<std::string>& paths) {
+    m_paths.reserve(paths.size());
+    for (const auto& path : paths) {
+        std::vector<Component> comps;
+        size_t start = 0;
+        while (true) {
+            const size_t dot = path.find('.', start);
+            Component c;
+            c.key = path.substr(start, dot == std::string::npos ? std::string::npos : dot - start);
+            char* endptr;
+            const long idx = strtol(c.key.c_str(), &endptr, 10);
+            c.index = (!c.key.empty() && *endptr == '\0' && idx >= 0) ? int(idx) : -1;
+            comps.emplace_back(std::move(c));
+
+            if (dot == std::string::npos)
+                break;
+            start = dot + 1;
+        }
+        m_paths.emplace_back(std::move(comps));
+    }
+}
+
+bool FieldScanner::matches(const void* path_ptr, int depth, size_t field, bool prefix) const {
+    const PathItem* path = (const PathItem*)path_ptr;
+    const auto& comps = m_paths[field];
+    if (prefix ? comps.size() <= size_t(depth) : comps.size() != size_t(depth))
+        return false;
+
+    for (int i = 0; i < depth; ++i) {
+        const auto& c = comps[i];
+        if (path[i].key == nullptr) {
+            if (c.index != path[i].index)
+                return false;
+        } else if (c.key.size() != path[i].key_len || memcmp(c.key.data(), path[i].key, path[i].key_len) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FieldScanner::wanted(const void* path, int depth) const {
+    for (size_t i = 0; i < m_paths.size(); ++i) {
+        if (matches(path, depth, i, true))
+            return true;
+    }
+    return false;
+}
+
+void FieldScanner::store(const void* path, int depth, const Field& value, Field* fields) const {
+    for (size_t i = 0; i < m_paths.size(); ++i) {
+        if (matches(path, depth, i, false))
+            fields[i] = value;
+    }
+}
+
+static int skip_tokens(const jsmntok_t* tok) {
+    const jsmntok_t* itr = tok + 1;
+    for (int i = 0; i < tok->size; ++i) {
+        itr += skip_tokens(itr);
+    }
+    return itr - tok;
+}
+
+bool FieldScanner::scan(const char* buf, size_t size, Field* fields) const {
+    for (size_t i = 0; i < m_paths.size(); ++i) {
+        fields[i].type = Value::NIL;
+    }
+
+    jsmn_parser parser;
+    jsmntok_t tokens[MAX_TOKENS];
+    jsmn_init(&parser);
+    const int count = jsmn_parse(&parser, buf, size, tokens, MAX_TOKENS);
+    if (count <= 0 || tokens[0].type != JSMN_OBJECT)
+        return false;
+
+    // Iterative walk with an explicit stack of the containers being visited.
+    struct Level {
+        const jsmntok_t* container;
+        const jsmntok_t* next;
+        int remaining;
+        int index;
+    };
+    Level levels[MAX_DEPTH + 1];
+    PathItem path[MAX_DEPTH];
+    int depth = 0;
+    levels[0] = { &tokens[0], &tokens[1], tokens[0].size, 0 };
+
+    while (true) {
+        Level& lvl = levels[depth];
+        if (lvl.remaining-- == 0) {
+            if (depth == 0)
+                return true;
+            --depth;
+            continue;
+        }
+
+        const jsmntok_t* val = lvl.next;
+        if (lvl.container->type == JSMN_OBJECT) {
+            path[depth] = { buf + val->start, size_t(val->end - val->start), -1 };
+            ++val;
+        } else {
+            path[depth] = { nullptr, 0, lvl.index++ };
+        }
+
+        if (val - tokens >= count)
+            return false;
+        lvl.next = val + skip_tokens(val);
+
+        const int val_depth = depth + 1;
+        switch (val->type) {
+        case JSMN_OBJECT:
+        case JSMN_ARRAY:
+            if (val_depth < MAX_DEPTH && wanted(path, val_depth)) {
+                levels[val_depth] = { val, val + 1, val->size, 0 };
+                depth = val_depth;
+            }
+            break;
+        case JSMN_STRING: {
+            Field f = { Value::STRING, 0.f, buf + val->start, size_t(val->end - val->start) };
+            store(path, val_depth, f, fields);
+            break;
+        }
+        case JSMN_PRIMITIVE: {
+            const char* str = buf + val->start;
+            const size_t len = val->end - val->start;
+            Field f = { Value::NUMBER, 0.f, nullptr, 0 };
+            if (len == 0 || *str == 'n') {
+                break;
+            } else if (*str == 't' || *str == 'f') {
+                f.type = Value::BOOL;
+                f.number = *str == 't' ? 1.f : 0.f;
+            } else {
+                bool ok;
+                f.number = parse_float(str, len, ok);
+                if (!ok)
+                    break;
+            }
+            store(path, val_depth, f, fields);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+namespace {
+
+class MsgpackCursor {
+public:
+    MsgpackCursor(const uint8_t* buf, size_t size)
+        : m_buf(buf)
+        , m_end(buf + size) {
+    }
+
+    const uint8_t* pos() const { return m_buf; }
+    void seek(const uint8_t* pos) { m_buf = pos; }
+
+    bool readBe(uint32_t& val, int bytes) {
+        if (m_end - m_buf < bytes)
+            return false;
+        val = 0;
+        for (int i = 0; i < bytes; ++i) {
+            val = (val << 8) | *m_buf++;
+        }
+        return true;
+    }
+
+    bool skip(size_t bytes) {
+        if (size_t(m_end - m_buf) < bytes)
+            return false;
+        m_buf += bytes;
+        return true;
+    }
+
+    // Reads the header of the next value. Containers report their item count in len,
+    // strings their data in str/len, scalars are fully read into number.
+    bool readHeader(Value::type_t& type, uint32_t& len, const char*& str, float& number) {
+        if (m_buf >= m_end)
+            return false;
+
+        const uint8_t tag = *m_buf++;
+        uint32_t tmp;
+        if (tag <= 0x7f || tag >= 0xe0) {
+            type = Value::NUMBER;
+            number = tag <= 0x7f ? float(tag) : float(int8_t(tag));
+            return true;
+        } else if ((tag & 0xF0) == 0x80 || (tag & 0xF0) == 0x90) {
+            type = (tag & 0xF0) == 0x80 ? Value::OBJECT : Value::ARRAY;
+            len = tag & 0x0F;
+            return true;
+        } else if ((tag & 0xE0) == 0xa0) {
+            len = tag & 0x1F;
+            return readStr(type, len, str);
+        }
+
+        switch (tag) {
+        case 0xc0:
+            type = Value::NIL;
+            return true;
+        case 0xc2:
+        case 0xc3:
+            type = Value::BOOL;
+            number = tag == 0xc3 ? 1.f : 0.f;
+            return true;
+        case 0xca:
+            if (!readBe(tmp, 4))
+                return false;
+            type = Value::NUMBER;
+            memcpy(&number, &tmp, sizeof(number));
+            return true;
+        case 0xcb: {
+            uint32_t hi, lo;
+            if (!readBe(hi, 4) || !readBe(lo, 4))
+                return false;
+            const uint64_t bits = (uint64_t(hi) << 32) | lo;
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            type = Value::NUMBER;
+            number = float(d);
+            return true;
+        }
+        case 0xcc:
+        case 0xcd:
+        case 0xce:
+            if (!readBe(tmp, 1 << (tag - 0xcc)))
+                return false;
+            type = Value::NUMBER;
+            number = float(tmp);
+            return true;
+        case 0xd0:
+            if (!readBe(tmp, 1))
+                return false;
+            type = Value::NUMBER;
+            number = float(int8_t(tmp));
+            return true;
+        case 0xd1:
+            if (!readBe(tmp, 2))
+                return false;
+            type = Value::NUMBER;
+            number = float(int16_t(tmp));
+            return true;
+        case 0xd2:
+            if (!readBe(tmp, 4))
+                return false;
+            type = Value::NUMBER;
+            number = float(int32_t(tmp));
+            return true;
+        case 0xcf:
+        case 0xd3: {
+            uint32_t hi, lo;
+            if (!readBe(hi, 4) || !readBe(lo, 4))
+                return false;
+            const uint64_t val = (uint64_t(hi) << 32) | lo;
+            type = Value::NUMBER;
+            number = tag == 0xcf ? float(val) : float(int64_t(val));
+            return true;
+        }
+        case 0xd9:
+        case 0xda:
+        case 0xdb:
+            if (!readBe(len, 1 << (tag - 0xd9)))
+                return false;
+            return readStr(type, len, str);
+        case 0xdc:
+        case 0xdd:
+            if (!readBe(len, tag == 0xdc ? 2 : 4))
+                return false;
+            type = Value::ARRAY;
+            return true;
+        case 0xde:
+        case 0xdf:
+            if (!readBe(len, tag == 0xde ? 2 : 4))
+                return false;
+            type = Value::OBJECT;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool skipValue(int depth) {
+        Value::type_t type;
+        uint32_t len;
+        const char* str;
+        float number;
+        if (depth > MAX_DEPTH * 2 || !readHeader(type, len, str, number))
+            return false;
+        if (type == Value::OBJECT)
+            len *= 2;
+        else if (type != Value::ARRAY)
+            return true;
+        for (uint32_t i = 0; i < len; ++i) {
+            if (!skipValue(depth + 1))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    bool readStr(Value::type_t& type, uint32_t len, const char*& str) {
+        type = Value::STRING;
+        str = (const char*)m_buf;
+        return skip(len);
+    }
+
+    const uint8_t* m_buf;
+    const uint8_t* const m_end;
+};
+
+};
+
+bool FieldScanner::scanMsgpack(const char* buf, size_t size, Field* fields, size_t* used) const {
+    for (size_t i = 0; i < m_paths.size(); ++i) {
+        fields[i].type = Value::NIL;
+    }
+
+    MsgpackCursor cur((const uint8_t*)buf, size);
+
+    struct Level {
+        Value::type_t type;
+        uint32_t remaining;
+        int index;
+    };
+    Level levels[MAX_DEPTH + 1];
+    PathItem path[MAX_DEPTH];
+    int depth = 0;
+
+    Field f;
+    uint32_t len;
+    if (!cur.readHeader(f.type, len, f.str, f.number) || f.type != Value::OBJECT)
+        return false;
+    levels[0] = { Value::OBJECT, len, 0 };
+
+    while (true) {
+        Level& lvl = levels[depth];
+        if (lvl.remaining == 0) {
+            if (depth == 0)
+                break;
+            --depth;
+            continue;
+        }
+        --lvl.remaining;
+
+        if (lvl.type == Value::OBJECT) {
+            if (!cur.readHeader(f.type, len, f.str, f.number) || f.type != Value::STRING)
+                return false;
+            path[depth] = { f.str, len, -1 };
+        } else {
+            path[depth] = { nullptr, 0, lvl.index++ };
+        }
+
+        const int val_depth = depth + 1;
+        const uint8_t* val_start = cur.pos();
+        if (!cur.readHeader(f.type, len, f.str, f.number))
+            return false;
+
+        switch (f.type) {
+        case Value::OBJECT:
+        case Value::ARRAY:
+            if (val_depth < MAX_DEPTH && wanted(path, val_depth)) {
+                levels[val_depth] = { f.type, len, 0 };
+                depth = val_depth;
+            } else {
+                cur.seek(val_start);
+                if (!cur.skipValue(0))
+                    return false;
+            }
+            break;
+        case Value::STRING:
+            f.str_len = len;
+            store(path, val_depth, f, fields);
+            break;
+        case Value::NUMBER:
+        case Value::BOOL:
+            store(path, val_depth, f, fields);
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (used != nullptr)
+        *used = cur.pos() - (const uint8_t*)buf;
+    return used != nullptr || cur.pos() == (const uint8_t*)buf + size;
+}
+
+};
@@ -1,11 +1,14 @@
+#include <algorithm>
 #include <errno.h>
 #include <memory>
 #include <stdarg.h>
 #include <stdio.h>
+#include <streambuf>
 #include <string.h>
 #include <sys/time.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
@@ -20,12 +23,79 @@ static const char* TAG = "RbProtocol";
 
 #define MS_TO_TICKS(ms) ((portTICK_PERIOD_MS <= ms) ? (ms / portTICK_PERIOD_MS) : 1)
 
-#define MUST_ARRIVE_TIMER_PERIOD MS_TO_TICKS(100)
 #define MUST_ARRIVE_ATTEMPTS 15
+#define MUST_ARRIVE_RTO_INITIAL_US 100000
+#define MUST_ARRIVE_RTO_MIN_US 20000
+#define MUST_ARRIVE_RTO_MAX_US 500000
+
+#define COUNTER_WIDTH_JSON 11 // strlen("-2147483648")
+#define COUNTER_WIDTH_MSGPACK 5 // int32
+#define COUNTER_HEADER_MAX (5 + COUNTER_WIDTH_JSON + 1) // {"n":<counter>,
+
+#define SEND_DRAIN_MAX 32 // Packets sent before the send task does its periodic work
+
+#define LOG_PACKET_SIZE 384 // Max length of the text sent in one "log" packet, so that it usually fits into a send slot
+
+#define RECV_DRAIN_MAX 8
+
+#define SYNC_DRIFT_INTERVAL_US 10000000 // Min time between the samples the drift is computed from
+
+#define SPECTATOR_BURST std::max(RBPROTOCOL_SPECTATOR_RATE / 4, RBPROTOCOL_BATCH_SIZE)
+
+// Fields every hot command is scanned for, followed by the fields of all the hot commands.
+#define HOT_FIELD_CMD 0
+#define HOT_FIELD_COUNTER 1
+#define HOT_FIELD_MUSTARRIVE_E 2
+#define HOT_FIELD_MUSTARRIVE_F 3
+#define HOT_FIELD_TIME 4
+#define HOT_FIELD_TIME_HIGH 5
+#define HOT_FIELDS_BASE 6
+
+// Times of the client's clock are sent in two fields, see set_clock_sync_period().
+#define CLIENT_TIME_HIGH_MS 1048576 // 2^20
 
 namespace rb {
 
-Protocol::Protocol(const char* owner, const char* name, const char* description, Protocol::callback_t callback) {
+namespace {
+
+// Serializes straight into a send slot. It refuses to grow, the stream goes bad instead.
+class SlotStreamBuf : public std::streambuf {
+public:
+    SlotStreamBuf(char* buf, size_t size) { setp(buf, buf + size); }
+
+    size_t size() const { return pptr() - pbase(); }
+};
+
+int64_t client_time_from(double low_ms, double high) {
+    return int64_t(high) * CLIENT_TIME_HIGH_MS * 1000 + int64_t(low_ms * 1000);
+}
+
+int64_t client_time_from(const Object* pkt, const char* low_key, const char* high_key) {
+    return client_time_from(pkt->getDouble(low_key), pkt->getDouble(high_key));
+}
+
+void set_client_time(Object* pkt, const char* low_key, const char* high_key, int64_t us) {
+    const int64_t unit = int64_t(CLIENT_TIME_HIGH_MS) * 1000;
+    int64_t high = us / unit;
+    if (us % unit < 0)
+        --high;
+    pkt->set(low_key, double(us - high * unit) / 1000);
+    if (high != 0)
+        pkt->set(high_key, double(high));
+}
+
+void init_sockaddr(struct sockaddr_in& addr) {
+    memset(&addr, 0, sizeof(addr));
+#ifndef __linux__ // lwIP and BSDs, not the host build on Linux
+    addr.sin_len = sizeof(struct sockaddr_in);
+#endif
+    addr.sin_family = AF_INET;
+}
+
+};
+
+Protocol::Protocol(const char* owner, const char* name, const char* description, Protocol::callback_t callback)
+    : m_recv_arena(RBPROTOCOL_RECV_ARENA_SIZE) {
     m_owner = owner;
     m_name = name;
     m_desc = description;
@@ -33,22 +103,91 @@ Protocol::Protocol(const char* owner, const char* name, const char* description,
 
     m_task_send = nullptr;
     m_task_recv = nullptr;
+    m_tasks_running = 0;
 
     m_socket = -1;
 
-    m_sendQueue = xQueueCreate(32, sizeof(QueueItem));
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        m_send_lanes[i] = xQueueCreate(RBPROTOCOL_SEND_QUEUE_SIZE, sizeof(QueueItem));
+        m_lane_queue_max[i] = 0;
+    }
+    m_send_wake = xQueueCreate(1, sizeof(uint8_t));
+    m_state_streak = 0;
+
+    m_send_pool = new char[RBPROTOCOL_SEND_SLOTS * RBPROTOCOL_SEND_SLOT_SIZE];
+    m_send_free = xQueueCreate(RBPROTOCOL_SEND_SLOTS, sizeof(int16_t));
+    for (int16_t i = 0; i < RBPROTOCOL_SEND_SLOTS; ++i) {
+        xQueueSend(m_send_free, &i, 0);
+    }
 
     m_read_counter = 0;
     m_write_counter = 0;
 
     m_mustarrive_e = 0;
     m_mustarrive_f = 0xFFFFFFFF;
+    for (auto& ma : m_mustarrive_ring) {
+        ma.id = UINT32_MAX;
+        ma.prev_id = UINT32_MAX;
+        ma.used = false;
+        ma.dropped = false;
+        ma.prev_dropped = false;
+    }
+    memset(&m_mustarrive_stats, 0, sizeof(m_mustarrive_stats));
+    m_mustarrive_stats.rto_us = MUST_ARRIVE_RTO_INITIAL_US;
+    m_rttvar_us = 0;
+
+    m_msgpack = false;
+    m_batching = false;
+
+    m_rx_packets = 0;
+    m_rx_lost = 0;
+    m_rx_coalesced = 0;
+    m_rx_stale = 0;
+    m_client_delay_min_ms = INT64_MAX;
+    m_tx_packets = 0;
+    m_tx_dropped = 0;
+    m_send_queue_max = 0;
+    m_link_stats_period_ms = 0;
+    m_clock_sync_period_ms = 0;
+    m_log_head = 0;
+    m_log_count = 0;
+    m_log_first_us = 0;
+    m_log_refill_us = 0;
+    m_log_tokens = RBPROTOCOL_LOG_LINES;
+    m_log_suppressed = 0;
+    m_log_suppressed_us = 0;
+    m_log_suppressed_total = 0;
+    for (auto& id : m_log_inflight) {
+        id = UINT32_MAX;
+    }
+    m_log_lost = 0;
+    m_sync_id = 0;
+    m_latency.reserve(RBPROTOCOL_LATENCY_COMMANDS);
+    reset_clock_sync();
 
     memset(&m_possessed_addr, 0, sizeof(SockAddr));
+    memset(m_spectators, 0, sizeof(m_spectators));
+    m_spectator_count = 0;
 }
 
 Protocol::~Protocol() {
     stop();
+
+    // The tasks may still be finishing their last iteration and using the queues.
+    for (int i = 0; i < 100 && m_tasks_running.load() != 0; ++i) {
+        vTaskDelay(MS_TO_TICKS(10));
+    }
+    if (m_tasks_running.load() != 0) {
+        ESP_LOGE(TAG, "the tasks did not stop, leaking the send queues");
+        return;
+    }
+
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        vQueueDelete(m_send_lanes[i]);
+    }
+    vQueueDelete(m_send_wake);
+    vQueueDelete(m_send_free);
+    delete[] m_send_pool;
 }
 
 void Protocol::start(uint16_t port) {
@@ -84,7 +223,9 @@ void Protocol::start(uint16_t port) {
         return;
     }
 
-    xTaskCreate(&Protocol::send_task_trampoline, "rbctrl_send", 2048, this, 9, &m_task_send);
+    m_tasks_running += 2;
+    // The send task builds and serializes the _lat, _link and _sync messages and flushes the log, give it room.
+    xTaskCreate(&Protocol::send_task_trampoline, "rbctrl_send", 4096, this, 9, &m_task_send);
     xTaskCreate(&Protocol::recv_task_trampoline, "rbctrl_recv", 4096, this, 10, &m_task_recv);
 }
 
@@ -94,10 +235,17 @@ void Protocol::stop() {
         return;
     }
 
-    QueueItem it = { 0 };
-    xQueueSend(m_sendQueue, &it, portMAX_DELAY);
+    QueueItem it = {};
+    it.lane = LANE_CONTROL;
+    xQueueSend(m_send_lanes[LANE_CONTROL], &it, portMAX_DELAY);
+    const uint8_t wake = 0;
+    xQueueSend(m_send_wake, &wake, 0);
 
     if (m_socket != -1) {
+#ifdef __linux__
+        // Closing the socket does not wake up the blocked recvfrom on Linux.
+        shutdown(m_socket, SHUT_RDWR);
+#endif
         close(m_socket);
         m_socket = -1;
     }
@@ -121,18 +269,405 @@ bool Protocol::get_possessed_addr(Protocol::SockAddr& addr) {
     return true;
 }
 
-bool Protocol::is_mustarrive_complete(uint32_t id) const {
+size_t Protocol::spectator_stats(SpectatorStats* out, size_t max) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t count = 0;
+    for (const auto& sp : m_spectators) {
+        if (sp.addr.port != 0 && count < max)
+            out[count++] = sp.stats;
+    }
+    return count;
+}
+
+void Protocol::add_spectator(const SockAddr& addr) {
+    const int64_t now = esp_timer_get_time();
+    bool ok = false;
+
+    m_mutex.lock();
+    if (m_possessed_addr.ip.s_addr != addr.ip.s_addr || m_possessed_addr.port != addr.port) {
+        Spectator* sp = nullptr;
+        Spectator* free_sp = nullptr;
+        for (auto& itr : m_spectators) {
+            if (itr.addr.port == addr.port && itr.addr.ip.s_addr == addr.ip.s_addr) {
+                sp = &itr;
+                break;
+            } else if (itr.addr.port == 0 && free_sp == nullptr) {
+                free_sp = &itr;
+            }
+        }
+
+        if (sp == nullptr && free_sp != nullptr) {
+            sp = free_sp;
+            memset(sp, 0, sizeof(Spectator));
+            sp->addr = addr;
+            sp->refill_us = now;
+            sp->tokens = SPECTATOR_BURST;
+            sp->stats.ip = addr.ip.s_addr;
+            sp->stats.port = addr.port;
+            ++m_spectator_count;
+            ESP_LOGI(TAG, "new spectator, %u in total", m_spectator_count.load());
+        }
+
+        if (sp != nullptr) {
+            sp->last_seen_us = now;
+            ok = true;
+        }
+    }
+    m_mutex.unlock();
+
+    Object res;
+    res.set("c", "spectate");
+    res.set("ok", new Bool(ok));
+    res.set("enc", m_msgpack.load() ? "msgpack" : "json");
+    res.set("batch", new Bool(m_batching.load()));
+
+    const auto str = res.str();
+    send(addr, str.c_str(), str.size(), LANE_CONTROL);
+}
+
+// Returns true if addr is a spectator, and keeps it alive.
+bool Protocol::touch_spectator(const SockAddr& addr) {
+    if (m_spectator_count.load() == 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& sp : m_spectators) {
+        if (sp.addr.port == addr.port && sp.addr.ip.s_addr == addr.ip.s_addr) {
+            sp.last_seen_us = esp_timer_get_time();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Protocol::remove_spectator(const SockAddr& addr) {
+    if (m_spectator_count.load() == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& sp : m_spectators) {
+        if (sp.addr.port == addr.port && sp.addr.ip.s_addr == addr.ip.s_addr) {
+            sp.addr.port = 0;
+            --m_spectator_count;
+        }
+    }
+}
+
+bool Protocol::add_hot_command(const char* cmd, const std::vector<std::string>& fields, hot_callback_t callback,
+    hot_filter_t filter) {
+    size_t total = fields.size();
+    for (const auto& hot : m_hot_commands) {
+        if (hot.cmd != cmd)
+            total += hot.fields.size();
+    }
+    if (total > RBPROTOCOL_HOT_FIELDS) {
+        ESP_LOGE(TAG, "too many hot command fields, the max is %d", RBPROTOCOL_HOT_FIELDS);
+        return false;
+    }
+
+    m_hot_commands.erase(std::remove_if(m_hot_commands.begin(), m_hot_commands.end(),
+                             [cmd](const HotCommand& hot) { return hot.cmd == cmd; }),
+        m_hot_commands.end());
+    m_hot_commands.push_back(HotCommand { cmd, fields, 0, callback, filter });
+
+    std::vector<std::string> paths = { "c", "n", "e", "f", "t", "th" };
+    for (auto& hot : m_hot_commands) {
+        hot.first = paths.size();
+        paths.insert(paths.end(), hot.fields.begin(), hot.fields.end());
+    }
+    m_hot_scanner = FieldScanner(paths);
+    return true;
+}
+
+bool Protocol::set_joy_callback(joy_callback_t callback) {
+    std::vector<std::string> fields;
+    for (int i = 0; i < RBPROTOCOL_JOY_AXES; ++i) {
+        fields.push_back("data." + std::to_string(i) + ".x");
+        fields.push_back("data." + std::to_string(i) + ".y");
+    }
+
+    return add_hot_command("joy", fields, [callback](const HotValues& values) {
+        JoyState joy;
+        joy.axes = 0;
+        for (int i = 0; i < RBPROTOCOL_JOY_AXES; ++i) {
+            if (!values.has(i * 2) && !values.has(i * 2 + 1))
+                break;
+            joy.x[i] = std::max(RBPROTOCOL_AXIS_MIN, std::min(RBPROTOCOL_AXIS_MAX, int(values.values[i * 2])));
+            joy.y[i] = std::max(RBPROTOCOL_AXIS_MIN, std::min(RBPROTOCOL_AXIS_MAX, int(values.values[i * 2 + 1])));
+            joy.axes = i + 1;
+        }
+        callback(joy);
+    });
+}
+
+void Protocol::set_latest_wins(const char* cmd, uint32_t max_age_ms) {
+    LatestWins* lw = find_latest_wins(cmd, strlen(cmd));
+    if (lw == nullptr) {
+        m_latest_wins.emplace_back();
+        lw = &m_latest_wins.back();
+        lw->cmd = cmd;
+        lw->hot = nullptr;
+    }
+    lw->max_age_ms = max_age_ms;
+}
+
+Protocol::MustArriveState Protocol::mustarrive_state(uint32_t id) const {
     if (id == UINT32_MAX)
-        return true;
+        return MUSTARRIVE_DROPPED;
     std::lock_guard<std::mutex> l(m_mustarrive_mutex);
-    for (const auto& it : m_mustarrive_queue) {
-        if (it.id == id)
-            return false;
+    const auto& ma = m_mustarrive_ring[id % RBPROTOCOL_MUSTARRIVE_SLOTS];
+    if (ma.id == id) {
+        if (ma.used)
+            return MUSTARRIVE_PENDING;
+        return ma.dropped ? MUSTARRIVE_DROPPED : MUSTARRIVE_DELIVERED;
     }
+    if (ma.prev_id == id && !ma.prev_dropped)
+        return MUSTARRIVE_DELIVERED;
+    return MUSTARRIVE_DROPPED;
+}
+
+Protocol::MustArriveStats Protocol::mustarrive_stats() const {
+    std::lock_guard<std::mutex> l(m_mustarrive_mutex);
+    return m_mustarrive_stats;
+}
+
+Protocol::LinkStats Protocol::link_stats() const {
+    LinkStats st;
+    st.mustarrive = mustarrive_stats();
+    st.rx_packets = m_rx_packets.load();
+    st.rx_lost = m_rx_lost.load();
+    st.rx_coalesced = m_rx_coalesced.load();
+    st.rx_stale = m_rx_stale.load();
+    st.tx_packets = m_tx_packets.load();
+    st.tx_dropped = m_tx_dropped.load();
+    st.send_queue = 0;
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        st.lane_queue[i] = uxQueueMessagesWaiting(m_send_lanes[i]);
+        st.lane_queue_max[i] = m_lane_queue_max[i].load();
+        st.send_queue += st.lane_queue[i];
+    }
+    st.send_queue_max = m_send_queue_max.load();
+    st.log_suppressed = m_log_suppressed_total.load();
+    return st;
+}
+
+Protocol::ClockSync Protocol::clock_sync() const {
+    std::lock_guard<std::mutex> lock(m_clock_mutex);
+    return m_clock;
+}
+
+bool Protocol::client_time_us(int64_t local_us, int64_t& client_us) const {
+    std::lock_guard<std::mutex> lock(m_clock_mutex);
+    if (!m_clock.synced)
+        return false;
+    client_us = local_us + m_clock.offset_us + int64_t(double(m_clock.drift_ppm) * (local_us - m_clock_ref_us) / 1000000);
     return true;
 }
 
-uint32_t Protocol::send_mustarrive(const char* cmd, Object* params) {
+size_t Protocol::command_latency(CommandLatency* out, size_t max) const {
+    std::lock_guard<std::mutex> lock(m_clock_mutex);
+    const size_t count = std::min(max, m_latency.size());
+    std::copy(m_latency.begin(), m_latency.begin() + count, out);
+    return count;
+}
+
+void Protocol::reset_clock_sync() {
+    std::lock_guard<std::mutex> lock(m_clock_mutex);
+    memset(&m_clock, 0, sizeof(m_clock));
+    m_clock_ref_us = 0;
+    m_drift_ref_us = 0;
+    m_drift_ref_offset_us = 0;
+    m_drift_samples = 0;
+    for (auto& sent : m_sync_sent_us) {
+        sent = 0;
+    }
+    m_latency.clear();
+}
+
+void Protocol::send_sync(int socket_fd) {
+    SockAddr addr;
+    if (!get_possessed_addr(addr))
+        return;
+
+    m_mutex.lock();
+    const int n = m_write_counter++;
+    m_mutex.unlock();
+
+    m_clock_mutex.lock();
+    const uint32_t id = m_sync_id++;
+    m_clock_mutex.unlock();
+
+    Object pkt;
+    pkt.set("c", "_sync");
+    pkt.set("n", n);
+    pkt.set("id", id);
+    const auto data = encode(pkt);
+
+    struct sockaddr_in send_addr;
+    init_sockaddr(send_addr);
+    send_addr.sin_port = addr.port;
+    send_addr.sin_addr = addr.ip;
+
+    // Sent right away instead of through the queue, so that nothing delays it after the timestamp.
+    m_clock_mutex.lock();
+    m_sync_sent_us[id % 4] = esp_timer_get_time();
+    m_clock_mutex.unlock();
+
+    if (::sendto(socket_fd, data.data(), data.size(), 0, (struct sockaddr*)&send_addr, sizeof(struct sockaddr_in)) < 0) {
+        ESP_LOGE(TAG, "error in sendto: %d %s!", errno, strerror(errno));
+    }
+}
+
+void Protocol::handle_sync(Object* pkt) {
+    const int64_t t4 = esp_timer_get_time();
+    if (!pkt->contains("t2") || !pkt->contains("t3"))
+        return;
+
+    const uint32_t id = pkt->getInt("id");
+    const int64_t t2 = client_time_from(pkt, "t2", "t2h");
+    const int64_t t3 = client_time_from(pkt, "t3", "t3h");
+
+    std::lock_guard<std::mutex> lock(m_clock_mutex);
+    const int64_t t1 = m_sync_sent_us[id % 4];
+    if (t1 == 0 || id >= m_sync_id || m_sync_id - id > 4)
+        return;
+    m_sync_sent_us[id % 4] = 0;
+
+    SyncSample& sample = m_sync_samples[m_clock.samples % 8];
+    sample.delay_us = std::max(int64_t(0), (t4 - t1) - (t3 - t2));
+    sample.offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+    sample.local_us = t4;
+    ++m_clock.samples;
+
+    // The answer with the shortest round-trip has the least asymmetric delay.
+    const SyncSample* best = &m_sync_samples[0];
+    for (size_t i = 1; i < std::min<size_t>(m_clock.samples, 8); ++i) {
+        if (m_sync_samples[i].delay_us < best->delay_us)
+            best = &m_sync_samples[i];
+    }
+
+    m_clock.synced = true;
+    m_clock.offset_us = best->offset_us;
+    m_clock.delay_us = best->delay_us;
+    m_clock_ref_us = best->local_us;
+
+    if (m_drift_ref_us == 0 || best->local_us - m_drift_ref_us >= SYNC_DRIFT_INTERVAL_US) {
+        if (m_drift_ref_us != 0) {
+            const float ppm = float(best->offset_us - m_drift_ref_offset_us) * 1000000.f / float(best->local_us - m_drift_ref_us);
+            m_clock.drift_ppm = m_drift_samples++ == 0 ? ppm : m_clock.drift_ppm + (ppm - m_clock.drift_ppm) / 4;
+        }
+        m_drift_ref_us = best->local_us;
+        m_drift_ref_offset_us = best->offset_us;
+    }
+}
+
+void Protocol::stamp_time(Object* pkt) {
+    int64_t client_us;
+    if (m_clock_sync_period_ms.load() != 0 && client_time_us(esp_timer_get_time(), client_us))
+        set_client_time(pkt, "t", "th", client_us);
+}
+
+void Protocol::record_latency(const char* cmd, size_t len, int64_t client_us) {
+    if (m_clock_sync_period_ms.load() == 0)
+        return;
+
+    int64_t now;
+    if (!client_time_us(esp_timer_get_time(), now))
+        return;
+    const uint32_t latency = uint32_t(std::max(int64_t(0), now - client_us));
+
+    len = std::min(len, sizeof(CommandLatency::cmd) - 1);
+
+    std::lock_guard<std::mutex> lock(m_clock_mutex);
+    CommandLatency* lat = nullptr;
+    for (auto& itr : m_latency) {
+        if (strlen(itr.cmd) == len && memcmp(itr.cmd, cmd, len) == 0) {
+            lat = &itr;
+            break;
+        }
+    }
+
+    if (lat == nullptr) {
+        if (m_latency.size() >= RBPROTOCOL_LATENCY_COMMANDS)
+            return;
+        m_latency.emplace_back();
+        lat = &m_latency.back();
+        memset(lat, 0, sizeof(CommandLatency));
+        memcpy(lat->cmd, cmd, len);
+    }
+
+    size_t bucket = 0;
+    while (bucket < RBPROTOCOL_LATENCY_BUCKETS - 1 && latency >= (1000u << bucket)) {
+        ++bucket;
+    }
+    ++lat->buckets[bucket];
+    ++lat->count;
+    lat->sum_us += latency;
+    lat->max_us = std::max(lat->max_us, latency);
+}
+
+void Protocol::send_latency() {
+    // Built right from m_latency, instead of copying all of it onto the send task's stack.
+    Object pkt;
+    {
+        std::lock_guard<std::mutex> lock(m_clock_mutex);
+        if (m_latency.empty())
+            return;
+
+        Object* cmds = new Object();
+        for (const auto& lat : m_latency) {
+            Object* cmd = new Object();
+            cmd->set("n", lat.count);
+            cmd->set("avg", lat.sum_us / 1000.0 / lat.count);
+            cmd->set("max", lat.max_us / 1000.0);
+            Array* hist = new Array();
+            hist->reserve(RBPROTOCOL_LATENCY_BUCKETS);
+            for (size_t b = 0; b < RBPROTOCOL_LATENCY_BUCKETS; ++b) {
+                hist->push_back(new Number(lat.buckets[b]));
+            }
+            cmd->set("hist", hist);
+            cmds->set(lat.cmd, cmd);
+        }
+        pkt.set("cmds", cmds);
+    }
+    send("_lat", &pkt, LANE_BULK);
+}
+
+void Protocol::send_link_stats(LinkStats& prev) {
+    const auto st = link_stats();
+    const uint32_t rx = st.rx_packets - prev.rx_packets;
+    const uint32_t lost = st.rx_lost - prev.rx_lost;
+
+    Object pkt;
+    pkt.set("rtt", st.mustarrive.srtt_us / 1000);
+    pkt.set("rto", st.mustarrive.rto_us / 1000);
+    pkt.set("rx", st.rx_packets);
+    pkt.set("rx_lost", st.rx_lost);
+    pkt.set("rx_coalesced", st.rx_coalesced);
+    pkt.set("rx_stale", st.rx_stale);
+    pkt.set("tx", st.tx_packets);
+    pkt.set("tx_dropped", st.tx_dropped);
+    pkt.set("retransmits", st.mustarrive.retransmits);
+    pkt.set("ma_drops", st.mustarrive.drops);
+    pkt.set("queue", st.send_queue);
+    pkt.set("queue_max", st.send_queue_max);
+    Array* lanes = new Array();
+    Array* lanes_max = new Array();
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        lanes->push_back(new Number(st.lane_queue[i]));
+        lanes_max->push_back(new Number(st.lane_queue_max[i]));
+    }
+    pkt.set("lanes", lanes);
+    pkt.set("lanes_max", lanes_max);
+    pkt.set("log_suppressed", st.log_suppressed);
+    pkt.set("loss", rx + lost != 0 ? 100.0 * lost / (rx + lost) : 0.0);
+    send("_link", &pkt, LANE_BULK);
+    send_latency();
+
+    prev = st;
+}
+
+uint32_t Protocol::send_mustarrive(const char* cmd, Object* params, SendLane lane) {
     SockAddr addr;
     if (!get_possessed_addr(addr)) {
         ESP_LOGW(TAG, "can't send, the device was not possessed yet.");
@@ -140,37 +675,168 @@ uint32_t Protocol::send_mustarrive(const char* cmd, Object* params) {
         return UINT32_MAX;
     }
 
-    if (params == NULL) {
-        params = new Object();
-    }
-
-    params->set("c", cmd);
-
-    MustArrive mr;
-    mr.pkt = params;
-    mr.attempts = 0;
+    std::unique_ptr<Object> pkt(params != NULL ? params : new Object());
+    pkt->set("c", cmd);
+    stamp_time(pkt.get());
 
     m_mustarrive_mutex.lock();
     const uint32_t id = m_mustarrive_e++;
-    mr.id = id;
-    params->set("e", mr.id);
-    m_mustarrive_queue.emplace_back(mr);
-    send(addr, params);
+    pkt->set("e", id);
+
+    auto& ma = m_mustarrive_ring[id % RBPROTOCOL_MUSTARRIVE_SLOTS];
+    if (ma.used) {
+        ESP_LOGW(TAG, "too many unacknowledged must-arrive packets, dropping %u", ma.id);
+        ++m_mustarrive_stats.drops;
+        release_mustarrive_locked(ma, true);
+    }
+
+    encode_mustarrive(ma, pkt.get());
+    ma.prev_id = ma.id;
+    ma.prev_dropped = ma.dropped;
+    ma.id = id;
+    ma.dropped = false;
+    ma.attempts = 0;
+    ma.used = true;
+    ma.sent_us = esp_timer_get_time();
+    ma.next_us = ma.sent_us + m_mustarrive_stats.rto_us;
+    ++m_mustarrive_stats.pending;
+    ++m_mustarrive_stats.sent;
+
+    // The send task writes the counter. If there is no free send slot right now,
+    // the retransmission takes care of it.
+    send(addr, ma.data.data(), ma.data.size(), lane, true, ma.counter_pos);
     m_mustarrive_mutex.unlock();
 
     return id;
 }
 
-void Protocol::send(const char* cmd, Object* obj) {
+size_t Protocol::counter_header(char* dst, size_t members, bool msgpack, size_t& skip, size_t& counter_pos) {
+    // Writes the start of a map with the "n" member first and space reserved for the counter,
+    // so that it can be written in the serialized data right before it is sent, see patch_counter().
+    // It replaces the first skip bytes of the serialized map without "n".
+    if (!msgpack) {
+        memcpy(dst, "{\"n\":", 5);
+        counter_pos = 5;
+        memset(dst + 5, ' ', COUNTER_WIDTH_JSON);
+        size_t len = 5 + COUNTER_WIDTH_JSON;
+        if (members != 0)
+            dst[len++] = ',';
+        skip = 1;
+        return len;
+    }
+
+    size_t len = 0;
+    const size_t total = members + 1;
+    skip = members < 16 ? 1 : (members <= 0xFFFF ? 3 : 5);
+    if (total < 16) {
+        dst[len++] = char(0x80 | total);
+    } else if (total <= 0xFFFF) {
+        dst[len++] = char(0xde);
+        dst[len++] = char(total >> 8);
+        dst[len++] = char(total);
+    } else {
+        dst[len++] = char(0xdf);
+        for (int i = 3; i >= 0; --i)
+            dst[len++] = char(total >> (i * 8));
+    }
+    memcpy(dst + len, "\xa1n", 2);
+    len += 2;
+    counter_pos = len;
+    memset(dst + len, 0, COUNTER_WIDTH_MSGPACK);
+    return len + COUNTER_WIDTH_MSGPACK;
+}
+
+void Protocol::encode_mustarrive(MustArrive& ma, Object* pkt) const {
+    pkt->remove("n");
+    const std::string body = encode(*pkt);
+
+    char header[COUNTER_HEADER_MAX];
+    size_t skip, counter_pos;
+    ma.msgpack = m_msgpack.load();
+    const size_t header_len = counter_header(header, pkt->members().size(), ma.msgpack, skip, counter_pos);
+    ma.data.assign(header, header_len);
+    ma.data.append(body, skip, std::string::npos);
+    ma.counter_pos = counter_pos;
+}
+
+size_t Protocol::patch_counter(char* buf, size_t counter_pos, bool msgpack, int32_t counter) {
+    // The counter is written at the end of the space reserved by counter_header() and the part
+    // of the header in front of it is moved next to it, so the rest of the data stays in place.
+    // The packet then starts the returned number of bytes later in buf.
+    char tmp[COUNTER_WIDTH_JSON + 1];
+    size_t len;
+    size_t width;
+    if (msgpack) {
+        const uint32_t val = uint32_t(counter);
+        width = COUNTER_WIDTH_MSGPACK;
+        if (counter >= 0 && counter < 0x80) {
+            tmp[0] = char(val);
+            len = 1;
+        } else if (counter >= 0 && counter <= 0xFF) {
+            tmp[0] = char(0xcc);
+            tmp[1] = char(val);
+            len = 2;
+        } else if (counter >= 0 && counter <= 0xFFFF) {
+            tmp[0] = char(0xcd);
+            tmp[1] = char(val >> 8);
+            tmp[2] = char(val);
+            len = 3;
+        } else {
+            tmp[0] = char(counter >= 0 ? 0xce : 0xd2);
+            for (int i = 0; i < 4; ++i)
+                tmp[1 + i] = char(val >> ((3 - i) * 8));
+            len = 5;
+        }
+    } else {
+        width = COUNTER_WIDTH_JSON;
+        len = snprintf(tmp, sizeof(tmp), "%d", counter);
+    }
+
+    const size_t shift = width - len;
+    memcpy(buf + counter_pos + shift, tmp, len);
+    memmove(buf + shift, buf, counter_pos);
+    return shift;
+}
+
+void Protocol::release_mustarrive_locked(MustArrive& ma, bool dropped) {
+    ma.used = false;
+    ma.dropped = dropped;
+    ma.data.clear();
+    --m_mustarrive_stats.pending;
+}
+
+void Protocol::update_rtt_locked(int64_t sample_us) {
+    // RFC 6298
+    auto& st = m_mustarrive_stats;
+    if (st.srtt_us == 0) {
+        st.srtt_us = sample_us;
+        m_rttvar_us = sample_us / 2;
+    } else {
+        const int32_t err = int32_t(sample_us) - int32_t(st.srtt_us);
+        m_rttvar_us += ((err < 0 ? -err : err) - m_rttvar_us) / 4;
+        st.srtt_us += err / 8;
+    }
+    const int32_t rto = st.srtt_us + 4 * m_rttvar_us;
+    st.rto_us = std::min<int32_t>(MUST_ARRIVE_RTO_MAX_US, std::max<int32_t>(MUST_ARRIVE_RTO_MIN_US, rto));
+}
+
+bool Protocol::send(const char* cmd, Object* obj, SendLane lane) {
     SockAddr addr;
     if (!get_possessed_addr(addr)) {
         ESP_LOGW(TAG, "can't send, the device was not possessed yet.");
-        return;
+        return false;
     }
-    send(addr, cmd, obj);
+
+    std::unique_ptr<Object> autoptr;
+    if (obj == NULL) {
+        obj = new Object();
+        autoptr.reset(obj);
+    }
+    stamp_time(obj);
+    return send(addr, cmd, obj, lane, true);
 }
 
-void Protocol::send(const SockAddr& addr, const char* cmd, Object* obj) {
+bool Protocol::send(const SockAddr& addr, const char* cmd, Object* obj, SendLane lane, bool broadcast) {
     std::unique_ptr<Object> autoptr;
     if (obj == NULL) {
         obj = new Object();
@@ -178,36 +844,190 @@ void Protocol::send(const SockAddr& addr, const char* cmd, Object* obj) {
     }
 
     obj->set("c", new String(cmd));
-    send(addr, obj);
+    return send(addr, obj, lane, broadcast);
 }
 
-void Protocol::send(const SockAddr& addr, Object* obj) {
-    m_mutex.lock();
-    const int n = m_write_counter++;
-    m_mutex.unlock();
+bool Protocol::send(const SockAddr& addr, Object* obj, SendLane lane, bool broadcast) {
+    // The counter is written by the send task, so that the packets which overtake
+    // others in a higher priority lane still have increasing counters.
+    obj->remove("n");
+
+    const bool msgpack = m_msgpack.load();
+    char header[COUNTER_HEADER_MAX];
+    size_t skip, counter_pos;
+    const size_t header_len = counter_header(header, obj->members().size(), msgpack, skip, counter_pos);
+    const size_t offset = header_len - skip;
+
+    QueueItem it;
+    it.addr = addr;
+    it.lane = lane;
+    it.broadcast = broadcast;
+    it.counter_pos = counter_pos;
+    if (!acquire_slot(it)) {
+        return false;
+    }
+
+    SlotStreamBuf slot_buf(it.buf + offset, RBPROTOCOL_SEND_SLOT_SIZE - offset);
+    std::ostream ss(&slot_buf);
+    if (msgpack) {
+        obj->serializeMsgpack(ss);
+    } else {
+        obj->serialize(ss);
+    }
 
-    obj->set("n", new Number(n));
-    const auto str = obj->str();
-    send(addr, str.c_str(), str.size());
+    if (!ss.good()) {
+        // Does not fit into a slot, fall back to a heap-allocated buffer.
+        release_slot(it);
+        std::string str(header, header_len);
+        str.append(encode(*obj), skip, std::string::npos);
+        return send(addr, str.c_str(), str.size(), lane, broadcast, counter_pos);
+    }
+
+    memcpy(it.buf, header, header_len);
+    it.size = offset + slot_buf.size();
+    return enqueue(it);
 }
 
-void Protocol::send(const SockAddr& addr, const char* buf) {
-    send(addr, buf, strlen(buf));
+bool Protocol::send_binary(const void* data, size_t size) {
+    SockAddr addr;
+    if (!get_possessed_addr(addr))
+        return false;
+
+    if (size + 1 > RBPROTOCOL_SEND_SLOT_SIZE) {
+        ESP_LOGE(TAG, "binary data of %d bytes does not fit into a send slot!", (int)size);
+        return false;
+    }
+
+    QueueItem it;
+    it.addr = addr;
+    it.lane = LANE_STATE;
+    it.broadcast = true;
+    it.counter_pos = -1;
+    if (!acquire_slot(it))
+        return false;
+
+    it.buf[0] = char(RBPROTOCOL_BINARY_TAG);
+    memcpy(it.buf + 1, data, size);
+    it.size = size + 1;
+    return enqueue(it);
+}
+
+std::string Protocol::encode(const rbjson::Object& obj) const {
+    if (m_msgpack.load())
+        return obj.msgpack();
+    return obj.str();
 }
 
-void Protocol::send(const SockAddr& addr, const char* buf, size_t size) {
+bool Protocol::send(const SockAddr& addr, const char* buf, size_t size, SendLane lane, bool broadcast, int counter_pos) {
     if (size == 0)
-        return;
+        return false;
 
     QueueItem it;
     it.addr = addr;
-    it.buf = new char[size];
+    it.lane = lane;
+    it.broadcast = broadcast;
+    it.counter_pos = counter_pos;
+    if (size <= RBPROTOCOL_SEND_SLOT_SIZE) {
+        if (!acquire_slot(it))
+            return false;
+    } else {
+        it.buf = new char[size];
+        it.slot = -1;
+        it.offset = 0;
+    }
+
     it.size = size;
     memcpy(it.buf, buf, size);
+    return enqueue(it);
+}
+
+bool Protocol::acquire_slot(QueueItem& it) {
+    if (xQueueReceive(m_send_free, &it.slot, 0) != pdTRUE) {
+        ++m_tx_dropped;
+        ESP_LOGE(TAG, "failed to send - all send slots are in use!");
+        return false;
+    }
+    it.buf = m_send_pool + it.slot * RBPROTOCOL_SEND_SLOT_SIZE;
+    it.offset = 0;
+    return true;
+}
+
+void Protocol::release_slot(const QueueItem& it) {
+    if (it.slot < 0) {
+        delete[] (it.buf - it.offset);
+    } else {
+        xQueueSend(m_send_free, &it.slot, 0);
+    }
+}
+
+static void update_max(std::atomic<uint32_t>& max, uint32_t val) {
+    uint32_t cur = max.load();
+    while (val > cur && !max.compare_exchange_weak(cur, val)) {
+    }
+}
+
+bool Protocol::enqueue(QueueItem& it) {
+    if (xQueueSend(m_send_lanes[it.lane], &it, 0) != pdTRUE) {
+        ++m_tx_dropped;
+        ESP_LOGE(TAG, "failed to send - queue %d full!", it.lane);
+        release_slot(it);
+        return false;
+    }
+
+    const uint8_t wake = 0;
+    xQueueSend(m_send_wake, &wake, 0);
 
-    if (xQueueSend(m_sendQueue, &it, pdMS_TO_TICKS(200)) != pdTRUE) {
-        ESP_LOGE(TAG, "failed to send - queue full!");
-        delete[] it.buf;
+    ++m_tx_packets;
+    uint32_t total = 0;
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        const uint32_t depth = uxQueueMessagesWaiting(m_send_lanes[i]);
+        if (i == it.lane)
+            update_max(m_lane_queue_max[i], depth);
+        total += depth;
+    }
+    update_max(m_send_queue_max, total);
+    return true;
+}
+
+bool Protocol::dequeue(QueueItem& it, TickType_t wait) {
+    const TickType_t deadline = xTaskGetTickCount() + wait;
+    while (true) {
+        // LANE_CONTROL goes first, LANE_BULK gets a turn after RBPROTOCOL_STATE_WEIGHT packets from LANE_STATE.
+        bool found = xQueueReceive(m_send_lanes[LANE_CONTROL], &it, 0) == pdTRUE;
+        if (!found) {
+            const bool bulk_first = m_state_streak >= RBPROTOCOL_STATE_WEIGHT;
+            const SendLane order[2] = { bulk_first ? LANE_BULK : LANE_STATE, bulk_first ? LANE_STATE : LANE_BULK };
+            for (const auto lane : order) {
+                if (xQueueReceive(m_send_lanes[lane], &it, 0) != pdTRUE)
+                    continue;
+                found = true;
+                if (lane == LANE_BULK || uxQueueMessagesWaiting(m_send_lanes[LANE_BULK]) == 0)
+                    m_state_streak = 0;
+                else
+                    ++m_state_streak;
+                break;
+            }
+        }
+
+        if (found) {
+            if (it.buf != nullptr && it.counter_pos >= 0) {
+                m_mutex.lock();
+                const int n = m_write_counter++;
+                m_mutex.unlock();
+                it.offset = patch_counter(it.buf, it.counter_pos, it.buf[0] != '{', n);
+                it.buf += it.offset;
+                it.size -= it.offset;
+                it.counter_pos = -1;
+            }
+            return true;
+        }
+
+        // Something is always queued before m_send_wake is filled, so nothing is missed between the checks.
+        const TickType_t now = xTaskGetTickCount();
+        if (now >= deadline)
+            return false;
+        uint8_t wake;
+        xQueueReceive(m_send_wake, &wake, deadline - now);
     }
 }
 
@@ -223,20 +1043,130 @@ void Protocol::send_log(const char* fmt, va_list args) {
     std::unique_ptr<char[]> dyn_buf;
     char* used_buf = static_buf;
 
-    int fmt_len = vsnprintf(static_buf, sizeof(static_buf), fmt, args);
-    if (fmt_len >= sizeof(static_buf)) {
+    // args can only be used once, the second pass needs its own copy.
+    va_list args_copy;
+    va_copy(args_copy, args);
+    const int fmt_len = vsnprintf(static_buf, sizeof(static_buf), fmt, args);
+    if (fmt_len >= int(sizeof(static_buf))) {
         dyn_buf.reset(new char[fmt_len + 1]);
         used_buf = dyn_buf.get();
-        vsnprintf(dyn_buf.get(), fmt_len + 1, fmt, args);
+        vsnprintf(dyn_buf.get(), fmt_len + 1, fmt, args_copy);
     }
+    va_end(args_copy);
 
-    send_log(std::string(used_buf));
+    if (fmt_len > 0)
+        queue_log(used_buf, fmt_len);
 }
 
 void Protocol::send_log(const std::string& str) {
+    queue_log(str.c_str(), str.size());
+}
+
+void Protocol::queue_log(const char* text, size_t len) {
+    if (len == 0 || !is_possessed())
+        return;
+
+    // Longer messages are cut to what the ring can hold.
+    len = std::min(len, size_t(RBPROTOCOL_LOG_LINES * RBPROTOCOL_LOG_LINE_SIZE));
+    const size_t chunks = (len + RBPROTOCOL_LOG_LINE_SIZE - 1) / RBPROTOCOL_LOG_LINE_SIZE;
+
+    std::lock_guard<std::mutex> l(m_log_mutex);
+
+    const int64_t now = esp_timer_get_time();
+    m_log_tokens = std::min(float(RBPROTOCOL_LOG_LINES), m_log_tokens + float(now - m_log_refill_us) * RBPROTOCOL_LOG_RATE / 1000000.f);
+    m_log_refill_us = now;
+
+    char note[48];
+    const int note_len = m_log_suppressed == 0 ? 0 : snprintf(note, sizeof(note), "[%u log messages suppressed]\n", m_log_suppressed);
+    if (m_log_tokens < 1.f || m_log_count + chunks + (note_len != 0 ? 1 : 0) > RBPROTOCOL_LOG_LINES) {
+        ++m_log_suppressed;
+        ++m_log_suppressed_total;
+        m_log_suppressed_us = now;
+        return;
+    }
+    m_log_tokens -= 1.f;
+
+    if (note_len != 0) {
+        push_log_locked(note, note_len);
+        m_log_suppressed = 0;
+    }
+
+    for (size_t off = 0; off < len; off += RBPROTOCOL_LOG_LINE_SIZE) {
+        push_log_locked(text + off, std::min(len - off, size_t(RBPROTOCOL_LOG_LINE_SIZE)));
+    }
+}
+
+void Protocol::push_log_locked(const char* text, size_t len) {
+    if (m_log_count == 0)
+        m_log_first_us = esp_timer_get_time();
+
+    auto& line = m_log_ring[(m_log_head + m_log_count) % RBPROTOCOL_LOG_LINES];
+    line.len = len;
+    memcpy(line.text, text, len);
+    ++m_log_count;
+}
+
+void Protocol::flush_log() {
+    // Called only from the send task, which is the only user of m_log_inflight.
+    uint32_t* inflight = nullptr;
+    for (auto& id : m_log_inflight) {
+        if (id != UINT32_MAX) {
+            const auto state = mustarrive_state(id);
+            if (state == MUSTARRIVE_PENDING)
+                continue;
+            if (state == MUSTARRIVE_DROPPED)
+                ++m_log_lost;
+            id = UINT32_MAX;
+        }
+        inflight = &id;
+    }
+    if (inflight == nullptr)
+        return;
+
+    std::string msg;
+    {
+        std::lock_guard<std::mutex> l(m_log_mutex);
+        const int64_t now = esp_timer_get_time();
+
+        // While messages are still being suppressed, the note goes in front of the next accepted one.
+        const bool note = m_log_suppressed != 0 && now - m_log_suppressed_us >= RBPROTOCOL_LOG_FLUSH_MS * 1000;
+        if (m_log_count == 0 && !note && m_log_lost == 0)
+            return;
+
+        // Wait a bit for more messages, unless there are enough of them already.
+        if (m_log_count < RBPROTOCOL_LOG_LINES / 2 && m_log_count != 0
+            && now - m_log_first_us < RBPROTOCOL_LOG_FLUSH_MS * 1000) {
+            return;
+        }
+
+        msg.reserve(LOG_PACKET_SIZE);
+        if (m_log_lost != 0) {
+            char lost[48];
+            msg.append(lost, snprintf(lost, sizeof(lost), "[%u log packets lost]\n", m_log_lost));
+            m_log_lost = 0;
+        }
+        while (m_log_count != 0) {
+            const auto& line = m_log_ring[m_log_head];
+            if (!msg.empty() && msg.size() + line.len > LOG_PACKET_SIZE)
+                break;
+            msg.append(line.text, line.len);
+            m_log_head = (m_log_head + 1) % RBPROTOCOL_LOG_LINES;
+            --m_log_count;
+        }
+        m_log_first_us = now;
+
+        if (m_log_count == 0 && note) {
+            char note[48];
+            msg.append(note, snprintf(note, sizeof(note), "[%u log messages suppressed]\n", m_log_suppressed));
+            m_log_suppressed = 0;
+        }
+    }
+
     Object* pkt = new Object();
-    pkt->set("msg", str);
-    send_mustarrive("log", pkt);
+    pkt->set("msg", msg);
+    const uint32_t id = send_mustarrive("log", pkt, LANE_BULK);
+    if (id != UINT32_MAX)
+        *inflight = id;
 }
 
 void Protocol::send_task_trampoline(void* ctrl) {
@@ -244,24 +1174,29 @@ void Protocol::send_task_trampoline(void* ctrl) {
 }
 
 void Protocol::send_task() {
-    TickType_t mustarrive_next;
     QueueItem it;
-    struct sockaddr_in send_addr = {
-        .sin_len = sizeof(struct sockaddr_in),
-        .sin_family = AF_INET,
-        .sin_port = 0,
-        .sin_addr = { 0 },
-        .sin_zero = { 0 },
-    };
+    bool has_item = false;
+    struct sockaddr_in send_addr;
+    init_sockaddr(send_addr);
 
     m_mutex.lock();
     const int socket_fd = m_socket;
     m_mutex.unlock();
 
-    mustarrive_next = xTaskGetTickCount() + MUST_ARRIVE_TIMER_PERIOD;
+    std::unique_ptr<char[]> batch(new char[RBPROTOCOL_BATCH_SIZE]);
+
+    LinkStats link_prev = link_stats();
+    int64_t link_next = 0;
+    int64_t sync_next = 0;
 
     while (true) {
-        for (size_t i = 0; xQueueReceive(m_sendQueue, &it, MS_TO_TICKS(10)) == pdTRUE && i < 16; ++i) {
+        for (size_t i = 0; i < SEND_DRAIN_MAX || has_item; ++i) {
+            // Wait only for the first packet, then send what is queued without blocking.
+            // An item left over from a batch already has its counter, it must go before anything else.
+            if (!has_item && !dequeue(it, i == 0 ? MS_TO_TICKS(10) : 0))
+                break;
+            has_item = false;
+
             if (it.buf == nullptr) {
                 goto exit;
             }
@@ -269,65 +1204,214 @@ void Protocol::send_task() {
             send_addr.sin_port = it.addr.port;
             send_addr.sin_addr = it.addr.ip;
 
-            int res = ::sendto(socket_fd, it.buf, it.size, 0, (struct sockaddr*)&send_addr, sizeof(struct sockaddr_in));
+            const bool broadcast = it.broadcast && m_spectator_count.load() != 0;
+            const bool batched = m_batching.load() && it.size < RBPROTOCOL_BATCH_SIZE / 2
+                && uint8_t(it.buf[0]) != RBPROTOCOL_BINARY_TAG;
+            size_t size = it.size;
+            const char* data = batched ? fill_batch(batch.get(), it, has_item, size) : it.buf;
+
+            int res = ::sendto(socket_fd, data, size, 0, (struct sockaddr*)&send_addr, sizeof(struct sockaddr_in));
             if (res < 0) {
                 ESP_LOGE(TAG, "error in sendto: %d %s!", errno, strerror(errno));
             }
-            delete[] it.buf;
-        }
 
-        if (xTaskGetTickCount() >= mustarrive_next) {
-            m_mustarrive_mutex.lock();
-            if (m_mustarrive_queue.size() != 0) {
-                resend_mustarrive_locked();
+            // The possessor always goes first, then the same bytes go to the spectators.
+            if (broadcast) {
+                send_spectators(socket_fd, data, size);
+            }
+
+            if (!batched) {
+                release_slot(it);
             }
-            m_mustarrive_mutex.unlock();
-            mustarrive_next = xTaskGetTickCount() + MUST_ARRIVE_TIMER_PERIOD;
+        }
+
+        m_mustarrive_mutex.lock();
+        if (m_mustarrive_stats.pending != 0) {
+            resend_mustarrive_locked();
+        }
+        m_mustarrive_mutex.unlock();
+
+        flush_log();
+
+        const uint32_t link_period = m_link_stats_period_ms.load();
+        if (link_period != 0 && esp_timer_get_time() >= link_next) {
+            link_next = esp_timer_get_time() + int64_t(link_period) * 1000;
+            if (is_possessed())
+                send_link_stats(link_prev);
+        }
+
+        const uint32_t sync_period = m_clock_sync_period_ms.load();
+        if (sync_period != 0 && esp_timer_get_time() >= sync_next) {
+            sync_next = esp_timer_get_time() + int64_t(sync_period) * 1000;
+            send_sync(socket_fd);
         }
     }
 
 exit:
+    --m_tasks_running;
     vTaskDelete(nullptr);
 }
 
+const char* Protocol::fill_batch(char* batch, QueueItem& it, bool& has_next, size_t& size) {
+    // Packs it and the packets for the same address that are queued within
+    // the batch window into one array. If the next packet can't be added,
+    // it is left in it and has_next is set.
+    // The MessagePack array header is written in front of the data once the count is known.
+    static constexpr size_t HEADER = 3;
+    char* const start = batch + HEADER;
+    char* wr = start;
+    size_t count = 0;
+
+    const SockAddr addr = it.addr;
+    const bool broadcast = it.broadcast;
+    const bool json = it.buf[0] == '{';
+    const TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(RBPROTOCOL_BATCH_WINDOW_MS);
+
+    while (true) {
+        if (json)
+            *wr++ = count == 0 ? '[' : ',';
+        memcpy(wr, it.buf, it.size);
+        wr += it.size;
+        ++count;
+        release_slot(it);
+
+        const TickType_t now = xTaskGetTickCount();
+        if (now > deadline || !dequeue(it, deadline - now))
+            break;
+
+        if (it.buf == nullptr || it.addr.ip.s_addr != addr.ip.s_addr || it.addr.port != addr.port
+            || it.broadcast != broadcast || uint8_t(it.buf[0]) == RBPROTOCOL_BINARY_TAG
+            || (it.buf[0] == '{') != json || size_t(wr - start) + it.size + 2 > RBPROTOCOL_BATCH_SIZE - HEADER) {
+            has_next = true;
+            break;
+        }
+    }
+
+    if (count == 1) {
+        // Nothing to batch it with, send it as it was.
+        size = wr - start - (json ? 1 : 0);
+        return json ? start + 1 : start;
+    }
+
+    if (json) {
+        *wr++ = ']';
+        size = wr - start;
+        return start;
+    }
+
+    char* data = start;
+    if (count < 16) {
+        *(--data) = char(0x90 | count);
+    } else {
+        *(--data) = char(count);
+        *(--data) = char(count >> 8);
+        *(--data) = char(0xdc);
+    }
+    size = wr - data;
+    return data;
+}
+
+void Protocol::send_spectators(int socket_fd, const char* data, size_t size) {
+    // Each spectator has a byte budget refilled at RBPROTOCOL_SPECTATOR_RATE, and the sends
+    // do not block, so that a slow spectator can't hold up the possessor's packets.
+    Spectator* targets[RBPROTOCOL_MAX_SPECTATORS];
+    SockAddr addrs[RBPROTOCOL_MAX_SPECTATORS];
+    size_t count = 0;
+    const int64_t now = esp_timer_get_time();
+
+    m_mutex.lock();
+    for (auto& sp : m_spectators) {
+        if (sp.addr.port == 0)
+            continue;
+
+        if (now - sp.last_seen_us > int64_t(RBPROTOCOL_SPECTATOR_TIMEOUT_MS) * 1000) {
+            ESP_LOGI(TAG, "spectator timed out");
+            sp.addr.port = 0;
+            --m_spectator_count;
+            continue;
+        }
+
+        const int64_t refill = (now - sp.refill_us) * RBPROTOCOL_SPECTATOR_RATE / 1000000;
+        if (refill > 0) {
+            sp.tokens = std::min<int64_t>(SPECTATOR_BURST, sp.tokens + refill);
+            sp.refill_us = now;
+        }
+
+        if (sp.tokens < int32_t(size)) {
+            ++sp.stats.tx_dropped;
+            continue;
+        }
+        sp.tokens -= size;
+        ++sp.stats.tx_packets;
+        sp.stats.tx_bytes += size;
+        targets[count] = &sp;
+        addrs[count++] = sp.addr;
+    }
+    m_mutex.unlock();
+
+    struct sockaddr_in send_addr;
+    init_sockaddr(send_addr);
+    for (size_t i = 0; i < count; ++i) {
+        send_addr.sin_port = addrs[i].port;
+        send_addr.sin_addr = addrs[i].ip;
+        if (::sendto(socket_fd, data, size, MSG_DONTWAIT, (struct sockaddr*)&send_addr, sizeof(struct sockaddr_in)) < 0) {
+            m_mutex.lock();
+            if (targets[i]->addr.port == addrs[i].port && targets[i]->addr.ip.s_addr == addrs[i].ip.s_addr) {
+                --targets[i]->stats.tx_packets;
+                targets[i]->stats.tx_bytes -= size;
+                ++targets[i]->stats.tx_dropped;
+            }
+            m_mutex.unlock();
+        }
+    }
+}
+
 void Protocol::resend_mustarrive_locked() {
     bool possesed;
-    struct sockaddr_in send_addr = {
-        .sin_len = sizeof(struct sockaddr_in),
-        .sin_family = AF_INET,
-        .sin_port = 0,
-        .sin_addr = { 0 },
-        .sin_zero = { 0 },
-    };
+    struct sockaddr_in send_addr;
+    init_sockaddr(send_addr);
     {
         SockAddr addr;
         possesed = get_possessed_addr(addr);
-        send_addr.sin_port = addr.port;
-        send_addr.sin_addr = addr.ip;
+        if (possesed) {
+            send_addr.sin_port = addr.port;
+            send_addr.sin_addr = addr.ip;
+        }
     }
 
-    for (auto itr = m_mustarrive_queue.begin(); itr != m_mustarrive_queue.end();) {
+    const int64_t now = esp_timer_get_time();
+    for (auto& ma : m_mustarrive_ring) {
+        if (!ma.used || ma.next_us > now)
+            continue;
+
+        if (ma.attempts >= MUST_ARRIVE_ATTEMPTS) {
+            ++m_mustarrive_stats.drops;
+            release_mustarrive_locked(ma, true);
+            continue;
+        }
+
         if (possesed) {
             m_mutex.lock();
             const int n = m_write_counter++;
             m_mutex.unlock();
 
-            (*itr).pkt->set("n", n);
-
-            const auto str = (*itr).pkt->str();
+            char* data = &ma.data[0];
+            const size_t shift = patch_counter(data, ma.counter_pos, ma.msgpack, n);
 
-            int res = ::sendto(m_socket, str.c_str(), str.size(), 0, (struct sockaddr*)&send_addr, sizeof(struct sockaddr_in));
+            int res = ::sendto(m_socket, data + shift, ma.data.size() - shift, 0, (struct sockaddr*)&send_addr, sizeof(struct sockaddr_in));
             if (res < 0) {
                 ESP_LOGE(TAG, "error in sendto: %d %s!", errno, strerror(errno));
             }
-        }
 
-        if ((*itr).attempts != -1 && ++(*itr).attempts >= MUST_ARRIVE_ATTEMPTS) {
-            delete (*itr).pkt;
-            itr = m_mustarrive_queue.erase(itr);
-        } else {
-            ++itr;
+            // Move the header back in front of the reserved space for the next retransmission.
+            memmove(data, data + shift, ma.counter_pos);
+            ++m_mustarrive_stats.retransmits;
         }
+
+        // Exponential backoff for each unacknowledged attempt.
+        ++ma.attempts;
+        const int64_t timeout = int64_t(m_mustarrive_stats.rto_us) << std::min(int(ma.attempts), 5);
+        ma.next_us = now + std::min(timeout, int64_t(MUST_ARRIVE_RTO_MAX_US));
     }
 }
 
@@ -342,59 +1426,209 @@ void Protocol::recv_task() {
 
     struct sockaddr_in addr;
     socklen_t addr_len;
-    size_t buf_size = 64;
-    char* buf = (char*)malloc(buf_size);
+    // One extra byte to recognize datagrams which did not fit and were truncated.
+    char* buf = (char*)malloc(RBPROTOCOL_MAX_PACKET_SIZE + 1);
     ssize_t res;
 
     while (true) {
-        while (true) {
-            res = recvfrom(socket_fd, buf, buf_size, MSG_PEEK, NULL, NULL);
+        // Block for the first datagram, then process everything else that is already
+        // queued in the socket before going back to sleep. lwIP has no recvmmsg,
+        // so the queue is drained with non-blocking recvfrom calls.
+        for (size_t i = 0; i < RECV_DRAIN_MAX; ++i) {
+            addr_len = sizeof(struct sockaddr_in);
+            res = recvfrom(socket_fd, buf, RBPROTOCOL_MAX_PACKET_SIZE + 1, i == 0 ? 0 : MSG_DONTWAIT,
+                (struct sockaddr*)&addr, &addr_len);
             if (res < 0) {
                 const auto err = errno;
+                if (i != 0 && (err == EAGAIN || err == EWOULDBLOCK))
+                    break;
                 ESP_LOGE(TAG, "error in recvfrom: %d %s!", err, strerror(err));
                 if (err == EBADF)
                     goto exit;
                 vTaskDelay(MS_TO_TICKS(10));
+                break;
+            }
+
+            if (res > RBPROTOCOL_MAX_PACKET_SIZE) {
+                ESP_LOGE(TAG, "dropping packet bigger than %d bytes", RBPROTOCOL_MAX_PACKET_SIZE);
                 continue;
             }
 
-            if (res < buf_size)
-                break;
-            buf_size += 16;
-            buf = (char*)realloc(buf, buf_size);
+            SockAddr sa = {
+                .ip = addr.sin_addr,
+                .port = addr.sin_port,
+            };
+            handle_datagram(sa, buf, res);
         }
+        deliver_latest_wins();
+    }
 
-        addr_len = sizeof(struct sockaddr_in);
-        const auto pop_res = recvfrom(socket_fd, buf, 0, 0, (struct sockaddr*)&addr, &addr_len);
-        if (pop_res < 0) {
-            const auto err = errno;
-            ESP_LOGE(TAG, "error in recvfrom: %d %s!", err, strerror(err));
-            if (err == EBADF)
-                goto exit;
-            vTaskDelay(MS_TO_TICKS(10));
-            continue;
+exit:
+    free(buf);
+    --m_tasks_running;
+    vTaskDelete(nullptr);
+}
+
+void Protocol::handle_datagram(const SockAddr& addr, char* buf, size_t size) {
+    if (size == 0)
+        return;
+
+    const uint8_t first = buf[0];
+    if (first == RBPROTOCOL_BINARY_TAG) {
+        // Binary data is only sent by the device.
+        return;
+    } else if (first == '[') {
+        // A batch of JSON messages, find the top-level objects without parsing them.
+        int depth = 0;
+        bool in_string = false;
+        char* msg = nullptr;
+        for (size_t i = 1; i < size; ++i) {
+            const char c = buf[i];
+            if (in_string) {
+                if (c == '\\')
+                    ++i;
+                else if (c == '"')
+                    in_string = false;
+                continue;
+            }
+
+            switch (c) {
+            case '"':
+                in_string = true;
+                break;
+            case '{':
+            case '[':
+                if (depth++ == 0)
+                    msg = buf + i;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0)
+                    return;
+                if (--depth == 0 && !handle_hot(addr, msg, buf + i + 1 - msg, false))
+                    handle_parsed(addr, parse(msg, buf + i + 1 - msg, m_recv_arena));
+                break;
+            }
+        }
+    } else if ((first & 0xF0) == 0x90 || first == 0xdc || first == 0xdd) {
+        // A batch of MessagePack messages
+        size_t count;
+        size_t pos;
+        if (first == 0xdc && size >= 3) {
+            count = (uint8_t(buf[1]) << 8) | uint8_t(buf[2]);
+            pos = 3;
+        } else if (first == 0xdd && size >= 5) {
+            count = (uint32_t(uint8_t(buf[1])) << 24) | (uint8_t(buf[2]) << 16) | (uint8_t(buf[3]) << 8) | uint8_t(buf[4]);
+            pos = 5;
+        } else {
+            count = first & 0x0F;
+            pos = 1;
         }
 
-        {
-            std::unique_ptr<Object> pkt(parse(buf, res));
-            if (!pkt) {
-                ESP_LOGE(TAG, "failed to parse the packet's json");
-            } else {
-                SockAddr sa = {
-                    .ip = addr.sin_addr,
-                    .port = addr.sin_port,
-                };
-                handle_msg(sa, pkt.get());
+        for (size_t i = 0; i < count && pos < size; ++i) {
+            size_t used = 0;
+            if (!handle_hot(addr, buf + pos, size - pos, true, &used)) {
+                Object* pkt = parseMsgpack(buf + pos, size - pos, m_recv_arena, &used);
+                if (pkt == nullptr) {
+                    ESP_LOGE(TAG, "failed to parse the packet");
+                    return;
+                }
+                handle_parsed(addr, pkt);
             }
+            pos += used;
+        }
+    } else if (first == '{') {
+        if (!handle_hot(addr, buf, size, false))
+            handle_parsed(addr, parse(buf, size, m_recv_arena));
+    } else {
+        if (!handle_hot(addr, buf, size, true))
+            handle_parsed(addr, parseMsgpack(buf, size, m_recv_arena));
+    }
+}
+
+// Returns false if the message was not a hot command that can skip the rbjson tree,
+// it must then go through handle_msg.
+bool Protocol::handle_hot(const SockAddr& addr, const char* buf, size_t size, bool msgpack, size_t* used) {
+    if (m_hot_commands.empty())
+        return false;
+
+    FieldScanner::Field fields[HOT_FIELDS_BASE + RBPROTOCOL_HOT_FIELDS];
+    const bool ok = msgpack ? m_hot_scanner.scanMsgpack(buf, size, fields, used)
+                            : m_hot_scanner.scan(buf, size, fields);
+    if (!ok || fields[HOT_FIELD_CMD].type != Value::STRING || fields[HOT_FIELD_COUNTER].type != Value::NUMBER
+        || fields[HOT_FIELD_MUSTARRIVE_E].type != Value::NIL || fields[HOT_FIELD_MUSTARRIVE_F].type != Value::NIL) {
+        return false;
+    }
+
+    const auto& cmd = fields[HOT_FIELD_CMD];
+    const HotCommand* hot = nullptr;
+    for (const auto& itr : m_hot_commands) {
+        if (itr.cmd.size() == cmd.str_len && memcmp(itr.cmd.data(), cmd.str, cmd.str_len) == 0) {
+            hot = &itr;
+            break;
         }
     }
+    if (hot == nullptr)
+        return false;
 
-exit:
-    free(buf);
-    vTaskDelete(nullptr);
+    m_mutex.lock();
+    const bool possessor = m_possessed_addr.port != 0 && m_possessed_addr.ip.s_addr == addr.ip.s_addr
+        && m_possessed_addr.port == addr.port;
+    m_mutex.unlock();
+    if (!possessor)
+        return false;
+
+    HotValues values;
+    values.present = 0;
+    for (size_t i = 0; i < hot->fields.size(); ++i) {
+        const auto& f = fields[hot->first + i];
+        if (f.type == Value::NUMBER || f.type == Value::BOOL) {
+            values.values[i] = f.number;
+            values.present |= 1 << i;
+        }
+    }
+    if (hot->filter && !hot->filter(values))
+        return false;
+
+    ++m_rx_packets;
+    if (!accept_counter(int(fields[HOT_FIELD_COUNTER].number)))
+        return true;
+
+    const bool has_time = fields[HOT_FIELD_TIME].type == Value::NUMBER;
+    const auto& time_high = fields[HOT_FIELD_TIME_HIGH];
+    const int64_t time_us = has_time
+        ? client_time_from(fields[HOT_FIELD_TIME].number, time_high.type == Value::NUMBER ? time_high.number : 0)
+        : 0;
+    if (has_time)
+        record_latency(cmd.str, cmd.str_len, time_us);
+
+    LatestWins* lw = find_latest_wins(cmd.str, cmd.str_len);
+    if (lw == nullptr) {
+        hot->callback(values);
+        return true;
+    }
+
+    if (is_stale(*lw, has_time, time_us))
+        return true;
+    if (lw->pkt || lw->hot != nullptr)
+        ++m_rx_coalesced;
+    lw->pkt.reset();
+    lw->hot = hot;
+    lw->hot_values = values;
+    return true;
 }
 
-void Protocol::handle_msg(const SockAddr& addr, rbjson::Object* pkt) {
+void Protocol::handle_parsed(const SockAddr& addr, rbjson::Object* pkt) {
+    std::unique_ptr<Object> autoptr(pkt);
+    if (!pkt) {
+        ESP_LOGE(TAG, "failed to parse the packet");
+        return;
+    }
+    ++m_rx_packets;
+    handle_msg(addr, autoptr);
+}
+
+void Protocol::handle_msg(const SockAddr& addr, std::unique_ptr<rbjson::Object>& pkt) {
     const auto cmd = pkt->getString("c");
 
     if (cmd == "discover") {
@@ -405,26 +1639,26 @@ void Protocol::handle_msg(const SockAddr& addr, rbjson::Object* pkt) {
         res->set("desc", m_desc);
 
         const auto str = res->str();
-        send(addr, str.c_str(), str.size());
+        send(addr, str.c_str(), str.size(), LANE_CONTROL);
+        return;
+    }
+
+    if (cmd == "spectate") {
+        add_spectator(addr);
         return;
     }
 
+    // Spectators have no control rights.
+    if (cmd != "possess" && touch_spectator(addr))
+        return;
+
     if (!pkt->contains("n")) {
         ESP_LOGE(TAG, "packet does not have counter!");
         return;
     }
 
-    const int counter = pkt->getInt("n");
-    if (counter == -1) {
-        m_read_counter = 0;
-        m_mutex.lock();
-        m_write_counter = 0;
-        m_mutex.unlock();
-    } else if (counter < m_read_counter && m_read_counter - counter < 25) {
+    if (!accept_counter(pkt->getInt("n")))
         return;
-    } else {
-        m_read_counter = counter;
-    }
 
     if (m_possessed_addr.port == 0 || cmd == "possess") {
         m_mutex.lock();
@@ -437,11 +1671,19 @@ void Protocol::handle_msg(const SockAddr& addr, rbjson::Object* pkt) {
         m_read_counter = -1;
         m_mutex.unlock();
 
+        m_client_delay_min_ms = INT64_MAX;
+        remove_spectator(addr);
+        reset_clock_sync();
+
+        // The client opts into the binary encoding and batching for everything we send from now on.
+        m_msgpack = pkt->getString("enc") == "msgpack";
+        m_batching = pkt->getBool("batch");
+
         m_mustarrive_mutex.lock();
-        for (auto it : m_mustarrive_queue) {
-            delete it.pkt;
+        for (auto& ma : m_mustarrive_ring) {
+            if (ma.used)
+                release_mustarrive_locked(ma, true);
         }
-        m_mustarrive_queue.clear();
         m_mustarrive_mutex.unlock();
     }
 
@@ -450,10 +1692,10 @@ void Protocol::handle_msg(const SockAddr& addr, rbjson::Object* pkt) {
             std::unique_ptr<Object> resp(new Object);
             resp->set("c", cmd);
             resp->set("f", pkt->getInt("f"));
-            send(addr, resp.get());
+            send(addr, resp.get(), LANE_CONTROL);
         }
 
-        int f = pkt->getInt("f");
+        const uint32_t f = pkt->getInt("f");
         if (f <= m_mustarrive_f && m_mustarrive_f != 0xFFFFFFFF) {
             return;
         } else {
@@ -462,12 +1704,12 @@ void Protocol::handle_msg(const SockAddr& addr, rbjson::Object* pkt) {
     } else if (pkt->contains("e")) {
         uint32_t e = pkt->getInt("e");
         m_mustarrive_mutex.lock();
-        for (auto itr = m_mustarrive_queue.begin(); itr != m_mustarrive_queue.end(); ++itr) {
-            if ((*itr).id == e) {
-                delete (*itr).pkt;
-                m_mustarrive_queue.erase(itr);
-                break;
-            }
+        auto& ma = m_mustarrive_ring[e % RBPROTOCOL_MUSTARRIVE_SLOTS];
+        if (ma.used && ma.id == e) {
+            // Karn's algorithm: ACKs of retransmitted packets are ambiguous.
+            if (ma.attempts == 0)
+                update_rtt_locked(esp_timer_get_time() - ma.sent_us);
+            release_mustarrive_locked(ma, false);
         }
         m_mustarrive_mutex.unlock();
         return;
@@ -478,9 +1720,88 @@ void Protocol::handle_msg(const SockAddr& addr, rbjson::Object* pkt) {
         send_log("The device %s has been possessed!\n", m_name);
     }
 
+    if (cmd == "_sync") {
+        handle_sync(pkt.get());
+        return;
+    }
+
+    const Value* time = pkt->get("t");
+    const bool has_time = time != nullptr && time->getType() == Value::NUMBER;
+    const int64_t time_us = has_time ? client_time_from(pkt.get(), "t", "th") : 0;
+    if (has_time)
+        record_latency(cmd.c_str(), cmd.size(), time_us);
+
+    LatestWins* lw = pkt->contains("f") ? nullptr : find_latest_wins(cmd.c_str(), cmd.size());
+    if (lw != nullptr) {
+        if (is_stale(*lw, has_time, time_us))
+            return;
+        if (lw->pkt || lw->hot != nullptr)
+            ++m_rx_coalesced;
+        lw->hot = nullptr;
+        lw->pkt = std::move(pkt);
+        return;
+    }
+
     if (m_callback != NULL) {
-        m_callback(cmd, pkt);
+        m_callback(cmd, pkt.get());
     }
 }
 
+Protocol::LatestWins* Protocol::find_latest_wins(const char* cmd, size_t len) {
+    for (auto& lw : m_latest_wins) {
+        if (lw.cmd.size() == len && memcmp(lw.cmd.data(), cmd, len) == 0)
+            return &lw;
+    }
+    return nullptr;
+}
+
+// The client's clock is not synchronized with ours, so the delay is only known relative
+// to the fastest message seen so far, which is taken as the minimal one-way delay.
+bool Protocol::is_stale(const LatestWins& lw, bool has_time, int64_t time_us) {
+    if (!has_time)
+        return false;
+
+    const int64_t delay = (esp_timer_get_time() - time_us) / 1000;
+    if (delay < m_client_delay_min_ms)
+        m_client_delay_min_ms = delay;
+
+    if (lw.max_age_ms == 0 || delay - m_client_delay_min_ms <= lw.max_age_ms)
+        return false;
+    ++m_rx_stale;
+    return true;
+}
+
+// Called after the receive task processes all the queued datagrams.
+void Protocol::deliver_latest_wins() {
+    for (auto& lw : m_latest_wins) {
+        if (lw.pkt) {
+            std::unique_ptr<Object> pkt(std::move(lw.pkt));
+            if (m_callback != NULL)
+                m_callback(lw.cmd, pkt.get());
+        } else if (lw.hot != nullptr) {
+            const HotCommand* hot = lw.hot;
+            lw.hot = nullptr;
+            hot->callback(lw.hot_values);
+        }
+    }
+}
+
+// Returns false for old packets that arrived out of order and should be dropped.
+bool Protocol::accept_counter(int counter) {
+    if (counter == -1) {
+        m_read_counter = 0;
+        m_mutex.lock();
+        m_write_counter = 0;
+        m_mutex.unlock();
+    } else if (counter < m_read_counter && m_read_counter - counter < 25) {
+        return false;
+    } else {
+        if (m_read_counter >= 0 && counter > m_read_counter + 1 && counter - m_read_counter < 1000) {
+            m_rx_lost += counter - m_read_counter - 1;
+        }
+        m_read_counter = counter;
+    }
+    return true;
+}
+
 }; // namespace rb
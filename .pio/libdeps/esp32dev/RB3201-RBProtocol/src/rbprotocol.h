@@ -1,7 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <freertos/FreeRTOS.h>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <stdarg.h>
 #include <string>
@@ -16,6 +18,88 @@ namespace rb {
 
 #define RBPROTOCOL_PORT 42424 //!< The default RBProtocol port
 
+#ifndef RBPROTOCOL_MAX_PACKET_SIZE
+#define RBPROTOCOL_MAX_PACKET_SIZE 2048 //!< Bigger incoming packets are dropped
+#endif
+
+#ifndef RBPROTOCOL_SEND_SLOTS
+#define RBPROTOCOL_SEND_SLOTS 16 //!< Number of preallocated buffers for outgoing packets
+#endif
+
+#ifndef RBPROTOCOL_SEND_SLOT_SIZE
+#define RBPROTOCOL_SEND_SLOT_SIZE 512 //!< Size of one outgoing packet buffer, bigger packets are heap-allocated
+#endif
+
+#ifndef RBPROTOCOL_SEND_QUEUE_SIZE
+#define RBPROTOCOL_SEND_QUEUE_SIZE 32 //!< Max number of packets waiting in each send lane
+#endif
+
+#ifndef RBPROTOCOL_STATE_WEIGHT
+#define RBPROTOCOL_STATE_WEIGHT 4 //!< Packets sent from the state lane for each one from the bulk lane, when both are waiting
+#endif
+
+#ifndef RBPROTOCOL_BATCH_SIZE
+#define RBPROTOCOL_BATCH_SIZE 1400 //!< Max size of a datagram with several batched packets
+#endif
+
+#ifndef RBPROTOCOL_BATCH_WINDOW_MS
+#define RBPROTOCOL_BATCH_WINDOW_MS 5 //!< How long can a packet wait for others to be batched with it
+#endif
+
+#ifndef RBPROTOCOL_MUSTARRIVE_SLOTS
+#define RBPROTOCOL_MUSTARRIVE_SLOTS 32 //!< Max number of unacknowledged must-arrive packets, must be a power of two
+#endif
+
+#ifndef RBPROTOCOL_MAX_SPECTATORS
+#define RBPROTOCOL_MAX_SPECTATORS 4 //!< Max number of clients watching without control rights
+#endif
+
+#ifndef RBPROTOCOL_SPECTATOR_TIMEOUT_MS
+#define RBPROTOCOL_SPECTATOR_TIMEOUT_MS 5000 //!< Spectators which send nothing for this long are removed
+#endif
+
+#ifndef RBPROTOCOL_SPECTATOR_RATE
+#define RBPROTOCOL_SPECTATOR_RATE 32768 //!< Max bytes per second sent to one spectator, the rest is dropped
+#endif
+
+#ifndef RBPROTOCOL_LOG_LINES
+#define RBPROTOCOL_LOG_LINES 16 //!< Number of log chunks waiting to be sent, see send_log()
+#endif
+
+#ifndef RBPROTOCOL_LOG_LINE_SIZE
+#define RBPROTOCOL_LOG_LINE_SIZE 128 //!< Size of one log chunk, longer messages take several, max 255
+#endif
+
+#ifndef RBPROTOCOL_LOG_RATE
+#define RBPROTOCOL_LOG_RATE 50 //!< Max log messages per second, the rest is reported as suppressed
+#endif
+
+#ifndef RBPROTOCOL_LOG_FLUSH_MS
+#define RBPROTOCOL_LOG_FLUSH_MS 20 //!< How long can a log message wait for others to be sent with it
+#endif
+
+#ifndef RBPROTOCOL_LOG_INFLIGHT
+#define RBPROTOCOL_LOG_INFLIGHT 2 //!< Max number of unacknowledged log packets
+#endif
+
+#ifndef RBPROTOCOL_RECV_ARENA_SIZE
+#define RBPROTOCOL_RECV_ARENA_SIZE 1024 //!< Initial size of the arena received messages are parsed into, it grows when needed
+#endif
+
+#ifndef RBPROTOCOL_HOT_FIELDS
+#define RBPROTOCOL_HOT_FIELDS 16 //!< Max number of fields of all the commands registered with add_hot_command()
+#endif
+
+#ifndef RBPROTOCOL_LATENCY_COMMANDS
+#define RBPROTOCOL_LATENCY_COMMANDS 8 //!< Max number of commands with a latency histogram
+#endif
+
+#define RBPROTOCOL_LATENCY_BUCKETS 10 //!< Latency histogram bucket i counts latencies below 2^i ms, the last one the rest
+
+#define RBPROTOCOL_JOY_AXES 4 //!< Max number of joysticks decoded by set_joy_callback()
+
+#define RBPROTOCOL_BINARY_TAG 0xc1 //!< First byte of binary datagrams, MessagePack never uses it
+
 #define RBPROTOCOL_AXIS_MIN (-32767) //!< Minimal value of axes in "joy" command
 #define RBPROTOCOL_AXIS_MAX (32767) //!< Maximal value of axes in "joy" command
 
@@ -28,6 +112,118 @@ class Protocol {
 public:
     typedef std::function<void(const std::string& cmd, rbjson::Object* pkt)> callback_t;
 
+    /**
+     * \brief Priority lanes of the send queue.
+     *
+     * The send task always empties LANE_CONTROL first. When both of the other lanes
+     * have packets waiting, it sends RBPROTOCOL_STATE_WEIGHT packets from LANE_STATE
+     * for each one from LANE_BULK, so a burst of logs can't delay the state updates
+     * and the logs still get through.
+     */
+    enum SendLane : uint8_t {
+        LANE_CONTROL = 0, //!< Acknowledgements and replies to the client's requests
+        LANE_STATE, //!< The default for send() and send_mustarrive(), e.g. GridUI state
+        LANE_BULK, //!< send_log(), link stats and other data that can wait
+
+        LANE_COUNT,
+    };
+
+    /**
+     * \brief What happened to a must-arrive packet, see mustarrive_state().
+     */
+    enum MustArriveState : uint8_t {
+        MUSTARRIVE_PENDING = 0, //!< Not acknowledged yet, still being retransmitted
+        MUSTARRIVE_DELIVERED, //!< Acknowledged by the client
+        MUSTARRIVE_DROPPED, //!< Given up on without the ACK, or it was never sent
+    };
+
+    /**
+     * \brief Fields decoded from a hot command, see add_hot_command().
+     */
+    struct HotValues {
+        uint32_t present; //!< Bit i is set if the field i was found in the packet
+        float values[RBPROTOCOL_HOT_FIELDS]; //!< Number and bool fields, in the order passed to add_hot_command()
+
+        bool has(size_t i) const { return present & (1 << i); }
+    };
+
+    typedef std::function<void(const HotValues& values)> hot_callback_t;
+    typedef std::function<bool(const HotValues& values)> hot_filter_t;
+
+    /**
+     * \brief State of the joysticks from the "joy" command, see set_joy_callback().
+     */
+    struct JoyState {
+        uint8_t axes; //!< Number of joysticks in the packet
+        int16_t x[RBPROTOCOL_JOY_AXES];
+        int16_t y[RBPROTOCOL_JOY_AXES];
+    };
+
+    typedef std::function<void(const JoyState& joy)> joy_callback_t;
+
+    /**
+     * \brief Counters of the must-arrive packets, see mustarrive_stats().
+     */
+    struct MustArriveStats {
+        uint32_t pending; //!< Packets waiting for the ACK
+        uint32_t sent; //!< Packets passed to send_mustarrive() since start
+        uint32_t retransmits; //!< Number of retransmissions
+        uint32_t drops; //!< Packets given up on without the ACK
+        uint32_t srtt_us; //!< Smoothed round-trip time
+        uint32_t rto_us; //!< Current retransmission timeout, before the per-packet backoff
+    };
+
+    /**
+     * \brief Link quality counters, see link_stats().
+     */
+    struct LinkStats {
+        MustArriveStats mustarrive;
+        uint32_t rx_packets; //!< Received messages
+        uint32_t rx_lost; //!< Messages missing in the sequence of the client's counter
+        uint32_t rx_coalesced; //!< Latest-wins messages replaced by a newer one before delivery
+        uint32_t rx_stale; //!< Latest-wins messages dropped because they were older than their age limit
+        uint32_t tx_packets; //!< Packets queued for sending
+        uint32_t tx_dropped; //!< Packets not sent because all the send slots were in use
+        uint16_t send_queue; //!< Packets currently waiting in all the send lanes
+        uint16_t send_queue_max; //!< Max number of packets seen in all the send lanes together
+        uint16_t lane_queue[LANE_COUNT]; //!< Packets currently waiting in each lane, indexed by SendLane
+        uint16_t lane_queue_max[LANE_COUNT]; //!< Max number of packets seen in each lane
+        uint32_t log_suppressed; //!< send_log() messages dropped by the rate limit or because the log buffer was full
+    };
+
+    /**
+     * \brief Send counters of one spectator, see spectator_stats().
+     */
+    struct SpectatorStats {
+        uint32_t ip; //!< IPv4 address in network byte order
+        uint16_t port; //!< Port in network byte order
+        uint32_t tx_packets; //!< Datagrams sent to the spectator
+        uint32_t tx_bytes;
+        uint32_t tx_dropped; //!< Datagrams skipped because the spectator was over its rate limit or sendto failed
+    };
+
+    /**
+     * \brief State of the clock synchronization with the possessing client, see clock_sync().
+     */
+    struct ClockSync {
+        bool synced; //!< False until the client answers the first "_sync"
+        int64_t offset_us; //!< Client time minus esp_timer_get_time(), as of the best sample
+        float drift_ppm; //!< How much faster the client's clock runs
+        uint32_t delay_us; //!< Round-trip time of the best sample, the offset error is at most half of it
+        uint32_t samples; //!< Answers received since the possess
+    };
+
+    /**
+     * \brief End-to-end latency of one received command, see command_latency().
+     */
+    struct CommandLatency {
+        char cmd[16];
+        uint32_t count;
+        uint32_t max_us;
+        uint64_t sum_us;
+        uint32_t buckets[RBPROTOCOL_LATENCY_BUCKETS];
+    };
+
     /**
      * The onPacketReceivedCallback is called when a packet arrives.
      * It runs on a separate task, only single packet is processed at a time.
@@ -41,37 +237,236 @@ public:
     /**
      * \brief Send command cmd with params, without making sure it arrives.
      *
+     * The packet is also sent to the spectators.
      * If you pass the params object, you are responsible for its deletion.
+     *
+     * \return false if the packet was not sent, either because the device is not possessed
+     *         or because all the send buffers are in use. It never blocks, the caller
+     *         can skip or retry the update later, see also send_slots_free().
      */
-    void send(const char* cmd, rbjson::Object* params = NULL);
+    bool send(const char* cmd, rbjson::Object* params = NULL, SendLane lane = LANE_STATE);
 
     /**
      * \brief Send command cmd with params and make sure it arrives.
      *
      * If you pass the params object, it has to be heap-allocated and
      * RbProtocol becomes its owner - you MUST NOT delete it.
+     * Spectators get only the first transmission, it is not retransmitted to them.
      * 
-     * \return id of the mustarrive packet, you can use it in is_mustarrive_complete.
+     * \return id of the mustarrive packet, you can use it in mustarrive_state() and is_mustarrive_complete().
      *         Returns UINT32_MAX if the sending failed.
      */
-    uint32_t send_mustarrive(const char* cmd, rbjson::Object* params = NULL);
+    uint32_t send_mustarrive(const char* cmd, rbjson::Object* params = NULL, SendLane lane = LANE_STATE);
 
-    void send_log(const char* fmt, ...); //!< Send a message to the android app
+    /**
+     * \brief Send binary data, e.g. a telemetry frame, without making sure it arrives.
+     *
+     * The datagram is RBPROTOCOL_BINARY_TAG followed by data, it is never batched
+     * with other packets and the spectators get it too. Like send(), it never blocks
+     * and goes through LANE_STATE.
+     *
+     * \return false if the device is not possessed, all the send buffers are in use
+     *         or the data does not fit into RBPROTOCOL_SEND_SLOT_SIZE.
+     */
+    bool send_binary(const void* data, size_t size);
+
+    /**
+     * \brief Send a message to the android app.
+     *
+     * The message is copied into a ring of RBPROTOCOL_LOG_LINES chunks of RBPROTOCOL_LOG_LINE_SIZE
+     * bytes and the send task sends the queued messages together in one must-arrive "log" packet
+     * through LANE_BULK, at most RBPROTOCOL_LOG_INFLIGHT unacknowledged at a time. Messages over
+     * RBPROTOCOL_LOG_RATE per second or that don't fit into the ring are dropped and the app gets
+     * "[N log messages suppressed]" instead. Messages logged while the device is not possessed
+     * are dropped too.
+     */
+    void send_log(const char* fmt, ...);
     void send_log(const char* fmt, va_list args); //!< Send a message to the android app
     void send_log(const std::string& str); //!< Send a message to the android app
 
     bool is_possessed() const; //!< Returns true of the device is possessed (somebody connected to it)
 
-    bool is_mustarrive_complete(uint32_t id) const;
+    /**
+     * \brief Fills out with the counters of up to max spectators, returns their count.
+     *
+     * Other clients can watch the possessed device by sending "spectate"
+     * instead of "possess", and repeating it at least every RBPROTOCOL_SPECTATOR_TIMEOUT_MS.
+     * The device answers with {"c": "spectate", "ok": bool, "enc": "json" or "msgpack", "batch": bool},
+     * the spectators receive the packets in the encoding and batching chosen by the possessor.
+     * Packets from spectators other than "spectate", "discover" and "possess" are ignored.
+     */
+    size_t spectator_stats(SpectatorStats* out, size_t max) const;
+
+    /**
+     * \brief Returns true if the client asked for the MessagePack encoding.
+     *
+     * The client opts in by sending "enc": "msgpack" in its "possess" message,
+     * all the messages sent to it are then MessagePack-encoded instead of JSON.
+     * Received messages may use either encoding.
+     */
+    bool is_msgpack() const { return m_msgpack.load(); }
+
+    /**
+     * \brief Returns true if the client accepts batched packets.
+     *
+     * The client opts in by sending "batch": true in its "possess" message.
+     * The send task then packs packets queued within RBPROTOCOL_BATCH_WINDOW_MS
+     * into a single datagram, a JSON or MessagePack array of the messages.
+     * Received batches are always unpacked.
+     */
+    bool is_batching() const { return m_batching.load(); }
+
+    /**
+     * \brief Returns whether the must-arrive packet id was delivered, dropped or is still pending.
+     *
+     * Packets are dropped after MUST_ARRIVE_ATTEMPTS retransmissions, when more than
+     * RBPROTOCOL_MUSTARRIVE_SLOTS of them are waiting for the ACK or when another client possesses the device.
+     * The outcome is remembered until the packet's slot in the ring is reused twice,
+     * older ids are reported as MUSTARRIVE_DROPPED, because it is no longer known.
+     */
+    MustArriveState mustarrive_state(uint32_t id) const;
+
+    /**
+     * \brief Returns true when the must-arrive packet id is no longer pending,
+     *        either delivered or dropped. Use mustarrive_state() to tell these apart.
+     */
+    bool is_mustarrive_complete(uint32_t id) const { return mustarrive_state(id) != MUSTARRIVE_PENDING; }
+
+    /**
+     * \brief Decode command cmd without building the rbjson::Object tree.
+     *
+     * Only the listed number or bool fields are read, paths are keys separated
+     * by dots with numeric parts indexing arrays, e.g. "data.0.x". The callback
+     * runs on the receive task instead of the main callback. Packets that are
+     * must-arrive or do not come from the possessing client still go through
+     * the main callback.
+     *
+     * If filter is set, it is called with the values first, and the packets
+     * it returns false for go through the main callback too. That allows taking
+     * only some of the messages of a shared command, e.g. GridUI's "_gev".
+     *
+     * Call it before start(), it is not synchronized with the receive task.
+     *
+     * \return false if there are more than RBPROTOCOL_HOT_FIELDS fields in all the hot commands.
+     */
+    bool add_hot_command(const char* cmd, const std::vector<std::string>& fields, hot_callback_t callback,
+        hot_filter_t filter = nullptr);
+
+    /**
+     * \brief Decode the "joy" command on the fast path, see add_hot_command().
+     *
+     * Call it before start().
+     */
+    bool set_joy_callback(joy_callback_t callback);
+
+    /**
+     * \brief Deliver only the newest of the queued cmd messages.
+     *
+     * Messages of cmd which arrive together, e.g. a burst of joystick updates
+     * after a WiFi outage, are delivered only once, with the newest one, after
+     * the other messages received at the same time. Must-arrive messages are
+     * always delivered.
+     *
+     * If max_age_ms is not 0 and the message has a "t" field with the client's
+     * time in ms (and "th", see set_clock_sync_period()), it is dropped when it is delayed by more than max_age_ms
+     * compared to the least delayed message seen since the possess.
+     *
+     * Call it before start(), it also applies to commands from add_hot_command().
+     */
+    void set_latest_wins(const char* cmd, uint32_t max_age_ms = 0);
+
+    MustArriveStats mustarrive_stats() const; //!< Returns the must-arrive packet counters
+
+    LinkStats link_stats() const; //!< Returns the link quality counters, they are never reset
+
+    /**
+     * \brief Send the link stats to the client every period_ms, 0 disables it.
+     *
+     * The "_link" message has these fields: rtt and rto in ms, rx, rx_lost, rx_coalesced, rx_stale,
+     * tx, tx_dropped, retransmits, ma_drops (must-arrive packets given up on), queue, queue_max,
+     * lanes and lanes_max (arrays with the depths of each SendLane) and loss, the percentage
+     * of lost received messages since the previous "_link" message.
+     */
+    void set_link_stats_period(uint32_t period_ms) { m_link_stats_period_ms = period_ms; }
+
+    /**
+     * \brief Synchronize the clock with the client every period_ms, 0 disables it.
+     *
+     * The send task sends {"c": "_sync", "id": id} and the client answers with
+     * {"c": "_sync", "id": id, "t2": receive time, "t3": send time}, times in ms
+     * of the client's clock. The offset comes from the answer with
+     * the shortest round-trip among the last few, like in NTP.
+     *
+     * While synchronized, the packets sent to the client carry "t", the client's
+     * time in ms when they were sent. Received commands with "t", the client's
+     * time of sending, are added to the latency histograms, see command_latency(),
+     * and published as "_lat" along with "_link".
+     *
+     * RBProtocol numbers are 32-bit floats, so each time is split in two fields:
+     * "t" is the time modulo 2^20 ms, with a fraction, and "th" the number of whole 2^20 ms
+     * periods ("t2h" and "t3h" for "t2" and "t3"). A missing "th" counts as 0.
+     */
+    void set_clock_sync_period(uint32_t period_ms) { m_clock_sync_period_ms = period_ms; }
+
+    ClockSync clock_sync() const; //!< Returns the clock synchronization state
+
+    /**
+     * \brief Converts local_us from esp_timer_get_time() to the client's time in us.
+     *
+     * \return false if the clock is not synchronized yet
+     */
+    bool client_time_us(int64_t local_us, int64_t& client_us) const;
+
+    /**
+     * \brief Fills out with the latency histograms of up to max commands, returns their count.
+     */
+    size_t command_latency(CommandLatency* out, size_t max) const;
+
+    /**
+     * \brief Returns the number of free send buffers.
+     *
+     * When it is zero, send() fails until send task transmits some of the queued packets.
+     */
+    size_t send_slots_free() const { return uxQueueMessagesWaiting(m_send_free); }
 
     TaskHandle_t getTaskSend() const { return m_task_send; }
     TaskHandle_t getTaskRecv() const { return m_task_recv; }
 
 private:
     struct MustArrive {
-        rbjson::Object* pkt;
+        std::string data; //!< The serialized packet, only the counter is patched before each send
         uint32_t id;
-        int16_t attempts;
+        uint32_t prev_id; //!< The packet that used the slot before id
+        uint16_t counter_pos;
+        uint8_t attempts;
+        bool used;
+        bool msgpack;
+        bool dropped; //!< Outcome of id once it is not used anymore
+        bool prev_dropped; //!< Outcome of prev_id
+        int64_t sent_us; //!< Time of the first transmission
+        int64_t next_us; //!< Time of the next retransmission
+    };
+
+    struct HotCommand {
+        std::string cmd;
+        std::vector<std::string> fields;
+        size_t first; //!< Index of the first field in m_hot_scanner
+        hot_callback_t callback;
+        hot_filter_t filter;
+    };
+
+    struct LatestWins {
+        std::string cmd;
+        uint32_t max_age_ms;
+        std::unique_ptr<rbjson::Object> pkt; //!< The pending message from the main path
+        const HotCommand* hot; //!< The pending message from the hot path, values are in hot_values
+        HotValues hot_values;
+    };
+
+    struct SyncSample {
+        int64_t offset_us;
+        int64_t delay_us;
+        int64_t local_us; //!< When the answer arrived
     };
 
     struct SockAddr {
@@ -83,6 +478,24 @@ private:
         SockAddr addr;
         char* buf;
         uint16_t size;
+        int16_t slot; //!< Index of the send slot or -1 if buf is heap-allocated
+        int16_t counter_pos; //!< Where the send task writes the packet counter, -1 if there is none
+        uint8_t offset; //!< How far the send task moved buf when it wrote the counter
+        uint8_t lane; //!< SendLane
+        bool broadcast; //!< Send to the spectators too
+    };
+
+    struct LogLine {
+        uint8_t len;
+        char text[RBPROTOCOL_LOG_LINE_SIZE];
+    };
+
+    struct Spectator {
+        SockAddr addr; //!< port is 0 if the entry is free
+        int64_t last_seen_us;
+        int64_t refill_us; //!< Last time tokens were refilled
+        int32_t tokens; //!< Bytes that can be sent to the spectator right now
+        SpectatorStats stats;
     };
 
     bool get_possessed_addr(SockAddr& addr);
@@ -90,16 +503,53 @@ private:
     static void send_task_trampoline(void* ctrl);
     void send_task();
     void resend_mustarrive_locked();
+    void encode_mustarrive(MustArrive& ma, rbjson::Object* pkt) const;
+    static size_t counter_header(char* dst, size_t members, bool msgpack, size_t& skip, size_t& counter_pos);
+    static size_t patch_counter(char* buf, size_t counter_pos, bool msgpack, int32_t counter);
+    void release_mustarrive_locked(MustArrive& ma, bool dropped);
+    void update_rtt_locked(int64_t sample_us);
 
     static void recv_task_trampoline(void* ctrl);
     void recv_task();
 
-    void send(const SockAddr& addr, const char* command, rbjson::Object* obj);
-    void send(const SockAddr& addr, rbjson::Object* obj);
-    void send(const SockAddr& addr, const char* buf);
-    void send(const SockAddr& addr, const char* buf, size_t size);
+    bool send(const SockAddr& addr, const char* command, rbjson::Object* obj, SendLane lane, bool broadcast = false);
+    bool send(const SockAddr& addr, rbjson::Object* obj, SendLane lane, bool broadcast = false);
+    bool send(const SockAddr& addr, const char* buf, size_t size, SendLane lane, bool broadcast = false, int counter_pos = -1);
+    void send_spectators(int socket_fd, const char* data, size_t size);
+
+    bool acquire_slot(QueueItem& it);
+    void release_slot(const QueueItem& it);
+    bool enqueue(QueueItem& it);
+    bool dequeue(QueueItem& it, TickType_t wait);
+
+    const char* fill_batch(char* batch, QueueItem& it, bool& has_next, size_t& size);
+
+    void queue_log(const char* text, size_t len);
+    void push_log_locked(const char* text, size_t len);
+    void flush_log();
+
+    void send_link_stats(LinkStats& prev);
+    void send_latency();
 
-    void handle_msg(const SockAddr& addr, rbjson::Object* pkt);
+    void send_sync(int socket_fd);
+    void handle_sync(rbjson::Object* pkt);
+    void reset_clock_sync();
+    void stamp_time(rbjson::Object* pkt);
+    void record_latency(const char* cmd, size_t len, int64_t client_us);
+
+    void handle_datagram(const SockAddr& addr, char* buf, size_t size);
+    bool handle_hot(const SockAddr& addr, const char* buf, size_t size, bool msgpack, size_t* used = nullptr);
+    void handle_parsed(const SockAddr& addr, rbjson::Object* pkt);
+    void handle_msg(const SockAddr& addr, std::unique_ptr<rbjson::Object>& pkt);
+    bool accept_counter(int counter);
+    void add_spectator(const SockAddr& addr);
+    bool touch_spectator(const SockAddr& addr);
+    void remove_spectator(const SockAddr& addr);
+    LatestWins* find_latest_wins(const char* cmd, size_t len);
+    bool is_stale(const LatestWins& lw, bool has_time, int64_t time_us);
+    void deliver_latest_wins();
+
+    std::string encode(const rbjson::Object& obj) const;
 
     const char* m_owner;
     const char* m_name;
@@ -107,19 +557,75 @@ private:
 
     callback_t m_callback;
 
+    std::vector<HotCommand> m_hot_commands;
+    rbjson::FieldScanner m_hot_scanner;
+
+    // Received messages are parsed into it by the receive task, it has to outlive m_latest_wins.
+    rbjson::Arena m_recv_arena;
+
+    std::vector<LatestWins> m_latest_wins;
+    int64_t m_client_delay_min_ms;
+
     TaskHandle_t m_task_send;
     TaskHandle_t m_task_recv;
+    std::atomic<uint8_t> m_tasks_running; //!< Decremented by each task as the last thing before it ends
 
     int m_socket;
     int32_t m_read_counter;
     int32_t m_write_counter;
     SockAddr m_possessed_addr;
-    QueueHandle_t m_sendQueue;
+    Spectator m_spectators[RBPROTOCOL_MAX_SPECTATORS];
+    std::atomic<uint32_t> m_spectator_count;
+    QueueHandle_t m_send_lanes[LANE_COUNT];
+    QueueHandle_t m_send_wake; //!< Holds an item when something was queued since the send task last looked
+    uint8_t m_state_streak; //!< Packets sent from LANE_STATE while LANE_BULK was waiting
+    QueueHandle_t m_send_free;
+    char* m_send_pool;
     mutable std::mutex m_mutex;
 
+    std::atomic<bool> m_msgpack;
+    std::atomic<bool> m_batching;
+
+    std::atomic<uint32_t> m_rx_packets;
+    std::atomic<uint32_t> m_rx_lost;
+    std::atomic<uint32_t> m_rx_coalesced;
+    std::atomic<uint32_t> m_rx_stale;
+    std::atomic<uint32_t> m_tx_packets;
+    std::atomic<uint32_t> m_tx_dropped;
+    std::atomic<uint32_t> m_send_queue_max;
+    std::atomic<uint32_t> m_lane_queue_max[LANE_COUNT];
+    std::atomic<uint32_t> m_link_stats_period_ms;
+    std::atomic<uint32_t> m_clock_sync_period_ms;
+
+    LogLine m_log_ring[RBPROTOCOL_LOG_LINES];
+    uint16_t m_log_head;
+    uint16_t m_log_count;
+    int64_t m_log_first_us; //!< When the oldest queued chunk was added
+    int64_t m_log_refill_us;
+    float m_log_tokens; //!< Messages that can be logged right now
+    uint32_t m_log_suppressed; //!< Messages dropped since the last "suppressed" note
+    int64_t m_log_suppressed_us; //!< When the last message was dropped
+    std::atomic<uint32_t> m_log_suppressed_total;
+    uint32_t m_log_inflight[RBPROTOCOL_LOG_INFLIGHT]; //!< Must-arrive ids of the log packets, only used by the send task
+    uint32_t m_log_lost; //!< Log packets dropped since the last "lost" note, only used by the send task
+    std::mutex m_log_mutex;
+
+    ClockSync m_clock;
+    int64_t m_clock_ref_us; //!< Local time the offset applies to, the drift is extrapolated from it
+    int64_t m_drift_ref_us;
+    int64_t m_drift_ref_offset_us;
+    uint32_t m_drift_samples;
+    uint32_t m_sync_id;
+    int64_t m_sync_sent_us[4]; //!< Send times of the last "_sync" requests, indexed by id
+    SyncSample m_sync_samples[8];
+    std::vector<CommandLatency> m_latency;
+    mutable std::mutex m_clock_mutex;
+
     uint32_t m_mustarrive_e;
     uint32_t m_mustarrive_f;
-    std::vector<MustArrive> m_mustarrive_queue;
+    MustArrive m_mustarrive_ring[RBPROTOCOL_MUSTARRIVE_SLOTS];
+    MustArriveStats m_mustarrive_stats;
+    int32_t m_rttvar_us;
     mutable std::mutex m_mustarrive_mutex;
 };
 
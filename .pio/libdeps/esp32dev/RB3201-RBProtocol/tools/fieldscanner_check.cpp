@@ -0,0 +1,152 @@
+/*
+ * Checks rbjson::FieldScanner against the values in the rbjson::Object tree,
+ * on the same message encoded as JSON and as MessagePack.
+ *
+ * Covers nested paths, array indexes, missing fields, fields of the wrong type
+ * and truncated or concatenated MessagePack objects.
+ *
+ * Build from the library directory with host/CMakeLists.txt:
+ *
+ *   cmake -S host -B build && cmake --build build -j
+ *
+ * Usage: fieldscanner_check
+ *
+ * Returns 1 if any of the checks fails.
+ */
+
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "rbjson.h"
+
+using rbjson::FieldScanner;
+using rbjson::Value;
+
+static int gFailures = 0;
+
+#define CHECK(cond, ...)                                  \
+    do {                                                  \
+        if (!(cond)) {                                    \
+            printf("FAILED %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                          \
+            printf("\n");                                 \
+            ++gFailures;                                  \
+        }                                                 \
+    } while (0)
+
+struct Expected {
+    const char* path;
+    Value::type_t type;
+    float number;
+    const char* str;
+};
+
+static const char MESSAGE[] = "{\"c\":\"_gev\",\"n\":42,\"id\":3,\"ev\":\"pos\","
+                              "\"st\":{\"jx\":-28000,\"jy\":12.5,\"on\":true,\"name\":\"left stick\"},"
+                              "\"data\":[{\"x\":1,\"y\":2},{\"x\":-3,\"y\":4.25}],"
+                              "\"deep\":{\"a\":{\"b\":{\"c\":7}}},\"off\":false,\"nil\":null}";
+
+static const Expected EXPECTED[] = {
+    { "c", Value::STRING, 0, "_gev" },
+    { "n", Value::NUMBER, 42, nullptr },
+    { "st.jx", Value::NUMBER, -28000, nullptr },
+    { "st.jy", Value::NUMBER, 12.5f, nullptr },
+    { "st.on", Value::BOOL, 1, nullptr },
+    { "st.name", Value::STRING, 0, "left stick" },
+    { "data.0.x", Value::NUMBER, 1, nullptr },
+    { "data.1.x", Value::NUMBER, -3, nullptr },
+    { "data.1.y", Value::NUMBER, 4.25f, nullptr },
+    { "deep.a.b.c", Value::NUMBER, 7, nullptr },
+    { "off", Value::BOOL, 0, nullptr },
+    // Missing, or not a number, bool or string.
+    { "st.jz", Value::NIL, 0, nullptr },
+    { "st.j", Value::NIL, 0, nullptr },
+    { "data.2.x", Value::NIL, 0, nullptr },
+    { "data.x", Value::NIL, 0, nullptr },
+    { "deep.a.b", Value::NIL, 0, nullptr },
+    { "deep.a.b.c.d", Value::NIL, 0, nullptr },
+    { "nil", Value::NIL, 0, nullptr },
+    { "missing", Value::NIL, 0, nullptr },
+};
+
+static const size_t EXPECTED_COUNT = sizeof(EXPECTED) / sizeof(EXPECTED[0]);
+
+static void checkFields(const char* codec, const FieldScanner::Field* fields) {
+    for (size_t i = 0; i < EXPECTED_COUNT; ++i) {
+        const auto& exp = EXPECTED[i];
+        const auto& f = fields[i];
+        CHECK(f.type == exp.type, "%s %s: type %d, expected %d", codec, exp.path, f.type, exp.type);
+        if (f.type != exp.type)
+            continue;
+
+        if (exp.type == Value::NUMBER || exp.type == Value::BOOL) {
+            CHECK(fabsf(f.number - exp.number) < 1e-6f, "%s %s: %f, expected %f", codec, exp.path, f.number,
+                exp.number);
+        } else if (exp.type == Value::STRING) {
+            CHECK(f.str_len == strlen(exp.str) && memcmp(f.str, exp.str, f.str_len) == 0,
+                "%s %s: \"%.*s\", expected \"%s\"", codec, exp.path, (int)f.str_len, f.str, exp.str);
+        }
+    }
+}
+
+int main() {
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < EXPECTED_COUNT; ++i)
+        paths.push_back(EXPECTED[i].path);
+    const FieldScanner scanner(paths);
+    CHECK(scanner.size() == EXPECTED_COUNT, "size %u", (unsigned)scanner.size());
+
+    std::vector<FieldScanner::Field> fields(EXPECTED_COUNT);
+
+    // JSON
+    CHECK(scanner.scan(MESSAGE, sizeof(MESSAGE) - 1, fields.data()), "failed to scan the JSON message");
+    checkFields("json", fields.data());
+
+    static const char* const invalid_json[] = { "", "[1,2]", "{\"c\":", "{\"c\":\"x\"", "\"c\"" };
+    for (const char* json : invalid_json) {
+        CHECK(!scanner.scan(json, strlen(json), fields.data()), "scanned invalid JSON '%s'", json);
+    }
+
+    // MessagePack, encoded from the parsed tree.
+    std::vector<char> buf(MESSAGE, MESSAGE + sizeof(MESSAGE));
+    std::unique_ptr<rbjson::Object> obj(rbjson::parse(buf.data(), sizeof(MESSAGE) - 1));
+    CHECK(obj != nullptr, "failed to parse the message");
+    if (obj == nullptr)
+        return 1;
+    const std::string mp = obj->msgpack();
+
+    size_t used = 0;
+    CHECK(scanner.scanMsgpack(mp.data(), mp.size(), fields.data(), &used), "failed to scan the MessagePack message");
+    CHECK(used == mp.size(), "used %u of %u bytes", (unsigned)used, (unsigned)mp.size());
+    checkFields("msgpack", fields.data());
+
+    // Each truncated prefix must be rejected, with and without the used pointer.
+    for (size_t len = 0; len < mp.size(); ++len) {
+        CHECK(!scanner.scanMsgpack(mp.data(), len, fields.data()), "scanned MessagePack cut to %u of %u bytes",
+            (unsigned)len, (unsigned)mp.size());
+        CHECK(!scanner.scanMsgpack(mp.data(), len, fields.data(), &used),
+            "scanned MessagePack cut to %u of %u bytes with used", (unsigned)len, (unsigned)mp.size());
+    }
+
+    // Two objects back to back: only the first one is scanned, unless used is NULL.
+    const std::string two = mp + mp;
+    CHECK(scanner.scanMsgpack(two.data(), two.size(), fields.data(), &used) && used == mp.size(),
+        "concatenated MessagePack: used %u, expected %u", (unsigned)used, (unsigned)mp.size());
+    checkFields("msgpack concatenated", fields.data());
+    CHECK(!scanner.scanMsgpack(two.data(), two.size(), fields.data()), "scanned trailing data without used");
+
+    // Not an object at the top level.
+    static const char not_object[] = { char(0x92), 0x01, 0x02 };
+    CHECK(!scanner.scanMsgpack(not_object, sizeof(not_object), fields.data()), "scanned a MessagePack array");
+
+    if (gFailures != 0) {
+        printf("%d checks failed\n", gFailures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * Benchmark of rbjson parsing and objects, running on Linux.
+ *
+ * Parses typical received messages many times, with the values allocated one by one
+ * from the heap and from an rbjson::Arena, and reports the time and the number of heap
+ * allocations per parsed message, including deleting it. Then it measures the member
+ * lookups, building an object with set() and serializing it. The allocations are counted
+ * by replacing the global operator new.
+ *
+ * Build from the library directory with host/CMakeLists.txt:
+ *
+ *   cmake -S host -B build && cmake --build build -j
+ *
+ * Usage: rbjson_bench [--iterations n]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "rbjson.h"
+
+static std::atomic<uint64_t> gAllocs(0);
+
+void* operator new(size_t size) {
+    ++gAllocs;
+    void* res = malloc(size ? size : 1);
+    if (res == nullptr)
+        throw std::bad_alloc();
+    return res;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+struct Sample {
+    const char* name;
+    const char* json;
+};
+
+static const Sample SAMPLES[] = {
+    { "joy", "{\"c\":\"joy\",\"n\":1234,\"t\":56789,\"data\":[{\"x\":-12000,\"y\":32767},{\"x\":0,\"y\":0}]}" },
+    { "gridui", "{\"c\":\"_gev\",\"n\":77,\"id\":3,\"ev\":\"changed\",\"st\":{\"value\":0.25,\"checked\":true,"
+                "\"color\":\"#FF00FF\",\"text\":\"A label long enough to not fit into the string itself\"}}" },
+    { "ack", "{\"c\":\"_ack\",\"n\":4321,\"e\":17}" },
+};
+
+// Keys of a GridUI widget state, the biggest objects the library usually handles.
+static const char* const STATE_KEYS[] = {
+    "x", "y", "w", "h", "uuid", "tab", "css", "text", "fontSize", "color", "background", "align", "valign", "prefix",
+};
+
+struct Result {
+    double ns;
+    double allocs;
+};
+
+// The best of a few rounds, to filter out the other processes on the machine.
+static const int ROUNDS = 5;
+
+template <typename Fn>
+static Result measure(int iterations, Fn fn) {
+    const int per_round = std::max(1, iterations / ROUNDS);
+    Result best = { 0, 0 };
+    for (int r = 0; r < ROUNDS; ++r) {
+        const uint64_t allocs_start = gAllocs;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < per_round; ++i) {
+            fn();
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const double ns = std::chrono::duration<double, std::nano>(end - start).count() / per_round;
+        if (r == 0 || ns < best.ns) {
+            best.ns = ns;
+            best.allocs = double(gAllocs - allocs_start) / per_round;
+        }
+    }
+    return best;
+}
+
+template <typename Parse>
+static Result measureParse(int iterations, Parse parse) {
+    return measure(iterations, [&]() {
+        rbjson::Object* obj = parse();
+        if (obj == nullptr) {
+            fprintf(stderr, "failed to parse\n");
+            exit(1);
+        }
+        delete obj;
+    });
+}
+
+static void print(const char* sample, const char* codec, const Result& heap, const Result& arena) {
+    printf("%-8s %-8s %10.0f %8.1f %10.0f %8.1f %7.2fx\n", sample, codec, heap.ns, heap.allocs, arena.ns, arena.allocs,
+        heap.ns / arena.ns);
+}
+
+int main(int argc, char** argv) {
+    int iterations = 200000;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--iterations n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%-8s %-8s %10s %8s %10s %8s %8s\n", "message", "codec", "heap ns", "allocs", "arena ns", "allocs", "speedup");
+
+    rbjson::Arena arena;
+    for (const auto& sample : SAMPLES) {
+        const size_t len = strlen(sample.json);
+        // jsmn does not modify the buffer, so it can be parsed over and over.
+        std::vector<char> json(sample.json, sample.json + len);
+
+        const auto json_heap = measureParse(iterations, [&]() { return rbjson::parse(json.data(), len); });
+        const auto json_arena = measureParse(iterations, [&]() { return rbjson::parse(json.data(), len, arena); });
+        print(sample.name, "json", json_heap, json_arena);
+
+        std::unique_ptr<rbjson::Object> obj(rbjson::parse(json.data(), len));
+        const std::string mp = obj->msgpack();
+
+        const auto mp_heap = measureParse(iterations, [&]() { return rbjson::parseMsgpack(mp.data(), mp.size()); });
+        const auto mp_arena
+            = measureParse(iterations, [&]() { return rbjson::parseMsgpack(mp.data(), mp.size(), arena); });
+        print(sample.name, "msgpack", mp_heap, mp_arena);
+    }
+
+    printf("arena capacity: %u bytes, live values: %u\n\n", (unsigned)arena.capacity(), (unsigned)arena.live());
+
+    printf("%-32s %10s %8s\n", "object", "ns", "allocs");
+
+    std::vector<char> msg(SAMPLES[1].json, SAMPLES[1].json + strlen(SAMPLES[1].json));
+    std::unique_ptr<rbjson::Object> pkt(rbjson::parse(msg.data(), msg.size()));
+    volatile int64_t sink = 0;
+    auto res = measure(iterations, [&]() {
+        sink += pkt->getString("c").size();
+        sink += pkt->getInt("n", -1);
+        sink += pkt->getInt("e", -1);
+        sink += pkt->getInt("id");
+        sink += pkt->getObject("st") != nullptr;
+    });
+    printf("%-32s %10.1f %8.1f\n", "lookup, 5 keys of a message", res.ns / 5, res.allocs / 5);
+
+    const size_t state_size = sizeof(STATE_KEYS) / sizeof(STATE_KEYS[0]);
+    rbjson::Object state;
+    for (size_t i = 0; i < state_size; ++i) {
+        state.set(STATE_KEYS[i], double(i));
+    }
+    const std::string state_keys[] = { "uuid", "valign", "x", "missing" };
+    res = measure(iterations, [&]() {
+        for (const auto& key : state_keys) {
+            sink += state.getInt(key);
+        }
+    });
+    printf("%-32s %10.1f %8.1f\n", "lookup, 4 keys of a state", res.ns / 4, res.allocs / 4);
+
+    res = measure(iterations, [&]() {
+        rbjson::Object obj;
+        for (size_t i = 0; i < state_size; ++i) {
+            obj.set(STATE_KEYS[i], double(i));
+        }
+    });
+    printf("%-32s %10.1f %8.1f\n", "insert, state with 14 members", res.ns, res.allocs);
+
+    res = measure(iterations, [&]() {
+        for (size_t i = 0; i < state_size; i += 2) {
+            state.set(STATE_KEYS[i], double(i + 1));
+        }
+    });
+    printf("%-32s %10.1f %8.1f\n", "replace, 7 members of a state", res.ns / 7, res.allocs / 7);
+
+    res = measure(iterations, [&]() { sink += state.str().size(); });
+    printf("%-32s %10.1f %8.1f\n", "serialize state, json", res.ns, res.allocs);
+
+    res = measure(iterations, [&]() { sink += state.msgpack().size(); });
+    printf("%-32s %10.1f %8.1f\n", "serialize state, msgpack", res.ns, res.allocs);
+
+    res = measure(iterations, [&]() { delete state.copy(); });
+    printf("%-32s %10.1f %8.1f\n", "copy state", res.ns, res.allocs);
+    return 0;
+}
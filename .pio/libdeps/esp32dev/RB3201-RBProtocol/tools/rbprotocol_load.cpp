@@ -0,0 +1,660 @@
+/*
+ * Load generator for rb::Protocol, running on Linux over the loopback.
+ *
+ * The "robot" (rb::Protocol on top of the pthread shim in host/) and a client run
+ * in one process, so both ends share a clock. The client possesses the robot and floods
+ * it with "joy" packets and must-arrive commands, while the robot sends must-arrive
+ * "ping" packets back. It reports throughput, latency percentiles and retransmissions.
+ *
+ * Build from the library directory with host/CMakeLists.txt:
+ *
+ *   cmake -S host -B build && cmake --build build -j
+ *
+ * Usage: rbprotocol_load [--duration s] [--joy-rate hz] [--cmd-rate hz] [--ping-rate hz]
+ *                        [--log-rate hz] [--loss pct] [--msgpack] [--batch] [--hot-joy] [--latest-wins ms]
+ *                        [--spectators n] [--clock-sync ms] [--port n] [--verbose]
+ *
+ * A rate of 0 sends as fast as possible. --loss drops that percentage of datagrams
+ * received by the client, to exercise the retransmissions. --hot-joy decodes "joy"
+ * with Protocol::add_hot_command() instead of the main callback. --latest-wins
+ * coalesces "joy" with that age limit, 0 for none; joys replaced by newer ones
+ * are then reported as lost. --spectators adds clients that only watch, they
+ * get the robot's pings along with the possessing client. --clock-sync enables
+ * the clock synchronization with that period, the client's clock is offset by
+ * CLIENT_CLOCK_OFFSET_MS and the robot's estimate and latency histograms are printed.
+ * --log-rate floods the robot with send_log(), the pings should not be slowed down by it
+ * and the messages over RBPROTOCOL_LOG_RATE are suppressed. Messages with counters lower than the newest one seen are
+ * reported as out of order, the RBController app drops them.
+ *
+ * Exits with 1 when a must-arrive ping or, without --loss, a command was not delivered,
+ * when a message arrived out of order or when Protocol::mustarrive_state() of the last pings
+ * does not match what the client received.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <getopt.h>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rbprotocol.h"
+
+using namespace rbjson;
+
+namespace {
+
+// Like Date.now() in the app, far beyond what a float holds with ms precision.
+static const int64_t CLIENT_CLOCK_OFFSET_MS = 1700000000000LL;
+
+// The client's clock, in us.
+int64_t clientUs() {
+    return esp_timer_get_time() + CLIENT_CLOCK_OFFSET_MS * 1000;
+}
+
+// Sets the client's time as the low and high field, see Protocol::set_clock_sync_period().
+void setTime(Object& pkt, const char* low_key, const char* high_key, int64_t us) {
+    const int64_t unit = int64_t(1 << 20) * 1000;
+    pkt.set(low_key, double(us % unit) / 1000);
+    pkt.set(high_key, double(us / unit));
+}
+
+struct Options {
+    double duration_s = 5;
+    double joy_rate = 100;
+    double cmd_rate = 10;
+    double ping_rate = 50;
+    double log_rate = -1;
+    double loss_pct = 0;
+    bool msgpack = false;
+    bool batch = false;
+    bool hot_joy = false;
+    int latest_wins_ms = -1;
+    int spectators = 0;
+    int clock_sync_ms = 0;
+    uint16_t port = 42425;
+    bool verbose = false;
+};
+
+// Send and receive timestamps of numbered messages, 0 means not yet.
+class Timeline {
+public:
+    explicit Timeline(size_t capacity)
+        : m_capacity(capacity)
+        , m_sent(new std::atomic<int64_t>[capacity])
+        , m_recv(new std::atomic<int64_t>[capacity])
+        , m_count(0) {
+        for (size_t i = 0; i < capacity; ++i) {
+            m_sent[i] = 0;
+            m_recv[i] = 0;
+        }
+    }
+
+    // Returns the sequence number of the new message or -1 if full.
+    int64_t add() {
+        const size_t seq = m_count.load();
+        if (seq >= m_capacity)
+            return -1;
+        m_sent[seq] = esp_timer_get_time();
+        m_count = seq + 1;
+        return seq;
+    }
+
+    void received(int64_t seq) {
+        if (seq < 0 || size_t(seq) >= m_count.load())
+            return;
+        int64_t expected = 0;
+        m_recv[seq].compare_exchange_strong(expected, esp_timer_get_time());
+    }
+
+    bool wasReceived(int64_t seq) const { return seq >= 0 && size_t(seq) < m_count.load() && m_recv[seq] != 0; }
+
+    size_t lost() const {
+        const size_t count = m_count.load();
+        size_t lost = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (m_recv[i] == 0)
+                ++lost;
+        }
+        return lost;
+    }
+
+    void report(const char* name, double duration_s) const {
+        std::vector<int64_t> lat;
+        const size_t count = m_count.load();
+        for (size_t i = 0; i < count; ++i) {
+            if (m_recv[i] != 0)
+                lat.push_back(m_recv[i] - m_sent[i]);
+        }
+        std::sort(lat.begin(), lat.end());
+
+        const double loss = count != 0 ? 100.0 * (count - lat.size()) / count : 0.0;
+        printf("%-6s sent %8zu  received %8zu (%.0f/s)  lost %6.2f %%", name, count, lat.size(),
+            lat.size() / duration_s, loss);
+        if (!lat.empty()) {
+            auto pct = [&](double p) { return lat[std::min(lat.size() - 1, size_t(p * lat.size()))]; };
+            printf("  latency us: p50 %lld  p90 %lld  p99 %lld  max %lld", (long long)pct(0.5), (long long)pct(0.9),
+                (long long)pct(0.99), (long long)lat.back());
+        }
+        printf("\n");
+    }
+
+private:
+    const size_t m_capacity;
+    std::unique_ptr<std::atomic<int64_t>[]> m_sent;
+    std::unique_ptr<std::atomic<int64_t>[]> m_recv;
+    std::atomic<size_t> m_count;
+};
+
+class Client {
+public:
+    Client(const Options& opt, Timeline& cmds, Timeline& pings)
+        : m_opt(opt)
+        , m_cmds(cmds)
+        , m_pings(pings)
+        , m_counter(0)
+        , m_datagrams(0)
+        , m_messages(0)
+        , m_dropped(0)
+        , m_read_counter(-1)
+        , m_out_of_order(0)
+        , m_possessed(false)
+        , m_stop(false) {
+        m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset(&m_robot, 0, sizeof(m_robot));
+        m_robot.sin_family = AF_INET;
+        m_robot.sin_port = htons(opt.port);
+        m_robot.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        struct timeval tv = { 0, 100000 };
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    ~Client() {
+        m_stop = true;
+        if (m_thread.joinable())
+            m_thread.join();
+        close(m_socket);
+    }
+
+    void start() {
+        m_thread = std::thread(&Client::recvLoop, this);
+
+        Object possess;
+        possess.set("c", "possess");
+        if (m_opt.msgpack)
+            possess.set("enc", "msgpack");
+        if (m_opt.batch)
+            possess.set("batch", new Bool(true));
+        send(possess, -1);
+    }
+
+    bool possessed() const { return m_possessed.load(); }
+
+    void sendJoy(int64_t seq) {
+        Object pkt;
+        pkt.set("c", "joy");
+        pkt.set("s", seq);
+        setTime(pkt, "t", "th", clientUs());
+        Array* data = new Array();
+        for (int i = 0; i < 2; ++i) {
+            Object* axis = new Object();
+            axis->set("x", (seq * 37 + i) % RBPROTOCOL_AXIS_MAX);
+            axis->set("y", -(seq * 13 + i) % RBPROTOCOL_AXIS_MAX);
+            data->push_back(axis);
+        }
+        pkt.set("data", data);
+        send(pkt);
+    }
+
+    void sendCmd(int64_t seq) {
+        Object pkt;
+        pkt.set("c", "cmd");
+        pkt.set("f", seq);
+        send(pkt);
+    }
+
+    uint32_t datagrams() const { return m_datagrams.load(); }
+    uint32_t messages() const { return m_messages.load(); }
+    uint32_t dropped() const { return m_dropped.load(); }
+    uint32_t outOfOrder() const { return m_out_of_order.load(); }
+
+private:
+    void send(Object& pkt, int32_t counter) {
+        pkt.set("n", counter);
+        const std::string data = m_opt.msgpack ? pkt.msgpack() : pkt.str();
+        sendto(m_socket, data.data(), data.size(), 0, (struct sockaddr*)&m_robot, sizeof(m_robot));
+    }
+
+    // The robot drops packets with older counters, so they must be sent in order.
+    void send(Object& pkt) {
+        std::lock_guard<std::mutex> l(m_send_mutex);
+        send(pkt, m_counter++);
+    }
+
+    void recvLoop() {
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<double> uniform(0, 100);
+        std::vector<char> buf(65536);
+
+        while (!m_stop) {
+            const ssize_t res = recv(m_socket, buf.data(), buf.size(), 0);
+            if (res <= 0)
+                continue;
+            if (m_opt.loss_pct > 0 && uniform(rng) < m_opt.loss_pct) {
+                ++m_dropped;
+                continue;
+            }
+            ++m_datagrams;
+            handleDatagram(buf.data(), res);
+        }
+    }
+
+    void handleDatagram(char* buf, size_t size) {
+        const uint8_t first = buf[0];
+        if (first == '[') {
+            int depth = 0;
+            bool in_string = false;
+            char* msg = nullptr;
+            for (size_t i = 1; i < size; ++i) {
+                const char c = buf[i];
+                if (in_string) {
+                    if (c == '\\')
+                        ++i;
+                    else if (c == '"')
+                        in_string = false;
+                    continue;
+                }
+                if (c == '"') {
+                    in_string = true;
+                } else if (c == '{' || c == '[') {
+                    if (depth++ == 0)
+                        msg = buf + i;
+                } else if ((c == '}' || c == ']') && depth > 0 && --depth == 0) {
+                    handleMsg(parse(msg, buf + i + 1 - msg));
+                }
+            }
+        } else if ((first & 0xF0) == 0x90 || first == 0xdc) {
+            size_t count = first & 0x0F;
+            size_t pos = 1;
+            if (first == 0xdc) {
+                count = (uint8_t(buf[1]) << 8) | uint8_t(buf[2]);
+                pos = 3;
+            }
+            for (size_t i = 0; i < count && pos < size; ++i) {
+                size_t used = 0;
+                Object* pkt = parseMsgpack(buf + pos, size - pos, &used);
+                if (pkt == nullptr)
+                    break;
+                handleMsg(pkt);
+                pos += used;
+            }
+        } else if (first == '{') {
+            handleMsg(parse(buf, size));
+        } else {
+            handleMsg(parseMsgpack(buf, size));
+        }
+    }
+
+    void handleMsg(Object* pkt) {
+        std::unique_ptr<Object> autoptr(pkt);
+        if (pkt == nullptr)
+            return;
+        ++m_messages;
+
+        // Same check as the robot's accept_counter().
+        if (pkt->contains("n")) {
+            const int32_t n = pkt->getInt("n");
+            if (n != -1 && n < m_read_counter && m_read_counter - n < 25)
+                ++m_out_of_order;
+            else
+                m_read_counter = n;
+        }
+
+        const auto cmd = pkt->getString("c");
+        if (cmd == "_sync") {
+            const int64_t t2 = clientUs();
+            Object resp;
+            resp.set("c", "_sync");
+            resp.set("id", pkt->getInt("id"));
+            setTime(resp, "t2", "t2h", t2);
+            setTime(resp, "t3", "t3h", clientUs());
+            send(resp);
+        } else if (pkt->contains("e")) {
+            Object ack;
+            ack.set("c", cmd);
+            ack.set("e", pkt->getInt("e"));
+            send(ack);
+
+            if (cmd == "log") {
+                m_possessed = true;
+            } else if (cmd == "ping") {
+                m_pings.received(pkt->getInt("s", -1));
+            }
+        } else if (pkt->contains("f")) {
+            m_cmds.received(pkt->getInt("f"));
+        }
+    }
+
+    const Options& m_opt;
+    Timeline& m_cmds;
+    Timeline& m_pings;
+
+    int m_socket;
+    struct sockaddr_in m_robot;
+    std::thread m_thread;
+
+    std::mutex m_send_mutex;
+    int32_t m_counter;
+    std::atomic<uint32_t> m_datagrams;
+    std::atomic<uint32_t> m_messages;
+    std::atomic<uint32_t> m_dropped;
+    int32_t m_read_counter;
+    std::atomic<uint32_t> m_out_of_order;
+    std::atomic<bool> m_possessed;
+    std::atomic<bool> m_stop;
+};
+
+// Watches the robot without possessing it, it only counts what it receives.
+class Spectator {
+public:
+    explicit Spectator(uint16_t port)
+        : m_datagrams(0)
+        , m_bytes(0)
+        , m_stop(false) {
+        m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        memset(&m_robot, 0, sizeof(m_robot));
+        m_robot.sin_family = AF_INET;
+        m_robot.sin_port = htons(port);
+        m_robot.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        struct timeval tv = { 0, 100000 };
+        setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        m_thread = std::thread(&Spectator::loop, this);
+    }
+
+    ~Spectator() {
+        m_stop = true;
+        m_thread.join();
+        close(m_socket);
+    }
+
+    uint32_t datagrams() const { return m_datagrams.load(); }
+    uint32_t bytes() const { return m_bytes.load(); }
+
+private:
+    void loop() {
+        static const char spectate[] = "{\"c\":\"spectate\"}";
+        std::vector<char> buf(65536);
+        int64_t next_spectate = 0;
+
+        while (!m_stop) {
+            if (esp_timer_get_time() >= next_spectate) {
+                sendto(m_socket, spectate, sizeof(spectate) - 1, 0, (struct sockaddr*)&m_robot, sizeof(m_robot));
+                next_spectate = esp_timer_get_time() + 1000000;
+            }
+
+            const ssize_t res = recv(m_socket, buf.data(), buf.size(), 0);
+            if (res > 0) {
+                ++m_datagrams;
+                m_bytes += res;
+            }
+        }
+    }
+
+    int m_socket;
+    struct sockaddr_in m_robot;
+    std::thread m_thread;
+    std::atomic<uint32_t> m_datagrams;
+    std::atomic<uint32_t> m_bytes;
+    std::atomic<bool> m_stop;
+};
+
+// Calls fn(seq) at rate per second until the deadline, or as fast as possible if rate is 0.
+template <typename Fn>
+void generate(double rate, int64_t deadline_us, Timeline& timeline, Fn fn) {
+    const int64_t period_us = rate > 0 ? int64_t(1000000 / rate) : 0;
+    int64_t next = esp_timer_get_time();
+    while (esp_timer_get_time() < deadline_us) {
+        const int64_t seq = timeline.add();
+        if (seq < 0)
+            return;
+        fn(seq);
+        if (period_us != 0) {
+            next += period_us;
+            const int64_t wait = next - esp_timer_get_time();
+            if (wait > 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+}
+
+void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--duration s] [--joy-rate hz] [--cmd-rate hz] [--ping-rate hz] [--log-rate hz] [--loss pct]\n"
+                    "       [--msgpack] [--batch] [--hot-joy] [--latest-wins ms] [--spectators n] [--clock-sync ms]\n"
+                    "       [--port n] [--verbose]\n",
+        name);
+}
+
+}; // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+
+    static const struct option long_opts[] = {
+        { "duration", required_argument, nullptr, 'd' },
+        { "joy-rate", required_argument, nullptr, 'j' },
+        { "cmd-rate", required_argument, nullptr, 'c' },
+        { "ping-rate", required_argument, nullptr, 'p' },
+        { "log-rate", required_argument, nullptr, 'g' },
+        { "loss", required_argument, nullptr, 'l' },
+        { "msgpack", no_argument, nullptr, 'm' },
+        { "batch", no_argument, nullptr, 'b' },
+        { "hot-joy", no_argument, nullptr, 'H' },
+        { "latest-wins", required_argument, nullptr, 'L' },
+        { "spectators", required_argument, nullptr, 'S' },
+        { "clock-sync", required_argument, nullptr, 'C' },
+        { "port", required_argument, nullptr, 'P' },
+        { "verbose", no_argument, nullptr, 'v' },
+        { nullptr, 0, nullptr, 0 },
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "d:j:c:p:g:l:mbHL:S:C:P:v", long_opts, nullptr)) != -1) {
+        switch (c) {
+        case 'd':
+            opt.duration_s = atof(optarg);
+            break;
+        case 'j':
+            opt.joy_rate = atof(optarg);
+            break;
+        case 'c':
+            opt.cmd_rate = atof(optarg);
+            break;
+        case 'p':
+            opt.ping_rate = atof(optarg);
+            break;
+        case 'g':
+            opt.log_rate = atof(optarg);
+            break;
+        case 'l':
+            opt.loss_pct = atof(optarg);
+            break;
+        case 'm':
+            opt.msgpack = true;
+            break;
+        case 'b':
+            opt.batch = true;
+            break;
+        case 'H':
+            opt.hot_joy = true;
+            break;
+        case 'L':
+            opt.latest_wins_ms = atoi(optarg);
+            break;
+        case 'S':
+            opt.spectators = atoi(optarg);
+            break;
+        case 'C':
+            opt.clock_sync_ms = atoi(optarg);
+            break;
+        case 'P':
+            opt.port = atoi(optarg);
+            break;
+        case 'v':
+            opt.verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    esp_log_level_set("*", opt.verbose ? ESP_LOG_INFO : ESP_LOG_NONE);
+
+    Timeline joys(4 * 1024 * 1024);
+    Timeline cmds(1024 * 1024);
+    Timeline pings(1024 * 1024);
+    std::vector<uint32_t> ping_ids(1024 * 1024, UINT32_MAX);
+    Timeline logs(1024 * 1024);
+
+    rb::Protocol prot("load", "robot", "rbprotocol_load", [&](const std::string& cmd, Object* pkt) {
+        if (cmd == "joy")
+            joys.received(pkt->getInt("s", -1));
+    });
+    if (opt.hot_joy) {
+        prot.add_hot_command("joy", { "s" }, [&](const rb::Protocol::HotValues& values) {
+            joys.received(values.has(0) ? int64_t(values.values[0]) : -1);
+        });
+    }
+    prot.set_clock_sync_period(opt.clock_sync_ms);
+    if (opt.latest_wins_ms >= 0)
+        prot.set_latest_wins("joy", opt.latest_wins_ms);
+    prot.start(opt.port);
+
+    Client client(opt, cmds, pings);
+    client.start();
+
+    for (int i = 0; i < 100 && !client.possessed(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (!client.possessed()) {
+        fprintf(stderr, "Failed to possess the robot on port %u\n", opt.port);
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<Spectator>> spectators;
+    for (int i = 0; i < opt.spectators; ++i) {
+        spectators.emplace_back(new Spectator(opt.port));
+    }
+
+    const int64_t start = esp_timer_get_time();
+    const int64_t deadline = start + int64_t(opt.duration_s * 1000000);
+
+    std::vector<std::thread> generators;
+    if (opt.cmd_rate >= 0) {
+        generators.emplace_back([&] { generate(opt.cmd_rate, deadline, cmds, [&](int64_t seq) { client.sendCmd(seq); }); });
+    }
+    if (opt.ping_rate >= 0) {
+        generators.emplace_back([&] {
+            generate(opt.ping_rate, deadline, pings, [&](int64_t seq) {
+                Object* pkt = new Object();
+                pkt->set("s", seq);
+                ping_ids[seq] = prot.send_mustarrive("ping", pkt);
+            });
+        });
+    }
+    if (opt.log_rate >= 0) {
+        generators.emplace_back([&] {
+            generate(opt.log_rate, deadline, logs, [&](int64_t seq) { prot.send_log("log message #%lld\n", (long long)seq); });
+        });
+    }
+    if (opt.joy_rate >= 0) {
+        generate(opt.joy_rate, deadline, joys, [&](int64_t seq) { client.sendJoy(seq); });
+    }
+    for (auto& t : generators) {
+        t.join();
+    }
+
+    // Give the retransmissions a chance to finish.
+    for (int i = 0; i < 100 && prot.mustarrive_stats().pending != 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    const double duration = double(deadline - start) / 1000000;
+    printf("encoding %s, batching %s, %.1f s, client drops %.1f %% of datagrams\n", opt.msgpack ? "msgpack" : "json",
+        opt.batch ? "on" : "off", duration, opt.loss_pct);
+    joys.report("joy", duration);
+    cmds.report("cmd", duration);
+    pings.report("ping", duration);
+
+    const auto st = prot.link_stats();
+    printf("robot: rx %u, rx lost %u, coalesced %u, stale %u, tx %u, tx dropped %u, send queue max %u\n",
+        st.rx_packets, st.rx_lost, st.rx_coalesced, st.rx_stale, st.tx_packets, st.tx_dropped, st.send_queue_max);
+    printf("robot must-arrive: sent %u, retransmits %u, drops %u, pending %u, srtt %u us, rto %u us\n",
+        st.mustarrive.sent, st.mustarrive.retransmits, st.mustarrive.drops, st.mustarrive.pending,
+        st.mustarrive.srtt_us, st.mustarrive.rto_us);
+    printf("robot lanes: max depth control %u, state %u, bulk %u; log messages suppressed %u\n",
+        st.lane_queue_max[rb::Protocol::LANE_CONTROL], st.lane_queue_max[rb::Protocol::LANE_STATE],
+        st.lane_queue_max[rb::Protocol::LANE_BULK], st.log_suppressed);
+    printf("client: %u datagrams, %u messages, %u dropped on purpose, %u out of order\n", client.datagrams(),
+        client.messages(), client.dropped(), client.outOfOrder());
+
+    if (opt.clock_sync_ms != 0) {
+        const auto clock = prot.clock_sync();
+        printf("clock: synced %d, offset %lld us (actual %lld), drift %.2f ppm, delay %u us, %u samples\n",
+            clock.synced, (long long)clock.offset_us, (long long)CLIENT_CLOCK_OFFSET_MS * 1000, clock.drift_ppm,
+            clock.delay_us, clock.samples);
+
+        rb::Protocol::CommandLatency lat[RBPROTOCOL_LATENCY_COMMANDS];
+        const size_t count = prot.command_latency(lat, RBPROTOCOL_LATENCY_COMMANDS);
+        for (size_t i = 0; i < count; ++i) {
+            printf("latency %-6s n %u, avg %llu us, max %u us, buckets (< 2^i ms):", lat[i].cmd, lat[i].count,
+                (unsigned long long)(lat[i].sum_us / std::max(lat[i].count, 1u)), lat[i].max_us);
+            for (size_t b = 0; b < RBPROTOCOL_LATENCY_BUCKETS; ++b) {
+                printf(" %u", lat[i].buckets[b]);
+            }
+            printf("\n");
+        }
+    }
+
+    std::vector<rb::Protocol::SpectatorStats> sp_stats(spectators.size());
+    sp_stats.resize(prot.spectator_stats(sp_stats.data(), sp_stats.size()));
+    for (size_t i = 0; i < spectators.size(); ++i) {
+        printf("spectator %zu: %u datagrams, %u bytes", i, spectators[i]->datagrams(), spectators[i]->bytes());
+        if (i < sp_stats.size()) {
+            printf(", robot sent %u datagrams, %u bytes, dropped %u", sp_stats[i].tx_packets, sp_stats[i].tx_bytes,
+                sp_stats[i].tx_dropped);
+        }
+        printf("\n");
+    }
+
+    // The outcome of the last pings is still known, it must match what the client got.
+    size_t ping_state_mismatch = 0;
+    const int64_t ping_count = std::count_if(ping_ids.begin(), ping_ids.end(), [](uint32_t id) { return id != UINT32_MAX; });
+    for (int64_t seq = std::max<int64_t>(0, ping_count - RBPROTOCOL_MUSTARRIVE_SLOTS); seq < ping_count; ++seq) {
+        const bool delivered = prot.mustarrive_state(ping_ids[seq]) == rb::Protocol::MUSTARRIVE_DELIVERED;
+        if (delivered != pings.wasReceived(seq))
+            ++ping_state_mismatch;
+    }
+
+    prot.stop();
+
+    // The client does not retransmit the commands, their acks are lost with --loss.
+    const size_t cmds_lost = opt.loss_pct == 0 ? cmds.lost() : 0;
+    if (cmds_lost != 0 || pings.lost() != 0 || client.outOfOrder() != 0 || ping_state_mismatch != 0) {
+        fprintf(stderr, "FAILED: %zu commands and %zu pings not delivered, %u messages out of order, "
+                        "%zu pings with a wrong mustarrive_state()\n",
+            cmds_lost, pings.lost(), client.outOfOrder(), ping_state_mismatch);
+        return 1;
+    }
+    return 0;
+}